@@ -36,6 +36,7 @@ if [ $OS = Linux ]; then
    -ljulia \
    -Wl,-rpath,$JULIA_DIR/lib \
    -l m \
+   -pthread \
    "
 
 elif [ $OS = Darwin ]; then
@@ -157,9 +158,19 @@ elif [ $1 = "tests" ]; then
    $CC $CFLAGS $WARNINGS $INCLUDES -o tests source_code/tests.cpp $LIBS
    exit
 
+elif [ $1 = "bench" ]; then
+   set -xe
+   $CC $CFLAGS -O3 $WARNINGS -o bench source_code/benchmarks.cpp -l m -pthread
+   exit
+
+elif [ $1 = "headless" ]; then
+   set -xe
+   $CC $CFLAGS -O3 $WARNINGS -o headless source_code/headless.cpp -l m -pthread
+   exit
+
 elif [ $1 = "web" ]; then
    CC=em++
-   CFLAGS="-D WEB -o index.html -s USE_GLFW=3 --shell-file shell-minimal.html"
+   CFLAGS="-D WEB -o index.html -s USE_GLFW=3 -msimd128 --shell-file shell-minimal.html"
    INCLUDES="\
    -I dependencies/raylib/src \
    "
@@ -0,0 +1,471 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "useful_utils.cpp"
+#include "particles.cpp"
+#include "time_varying.cpp"
+#include "expression.cpp"
+
+// Batched Dormand-Prince 5(4) with a step size per particle.
+//
+// Every particle integrates ahead of the displayed time with its own steps
+// and keeps the dense output of its last step. A new history row at time T is
+// read off that interpolant, so rows fall exactly on the frame times no matter
+// where the steps ended. Within a block of lanes only the particles that have
+// not reached T yet take another step; finished lanes are swapped out of the
+// compact working set, so one stiff particle only costs its own extra steps.
+
+// f for n lanes, each at its own time
+typedef void (*BatchRhs)(void *ctx, const f64 *t, const f64 *x, const f64 *y, f64 *dx, f64 *dy, int n);
+
+#define max_adaptive_steps 1000  // per particle per row, after that it stalls
+#define adaptive_min_step 1e-12
+
+struct AdaptiveStats
+{
+   u64 steps;
+   u64 rejected;
+   u64 stalled;
+};
+
+struct AdaptiveSolver
+{
+   int count;
+   f64 rtol;
+   f64 atol;
+   // the integrator's own time and state, at or ahead of the newest row
+   f64 *ts, *sx, *sy;
+   f64 *h;         // next step size
+   f64 *hlast;     // last accepted step, which ended at ts
+   f64 *dense[5];  // its dense output coefficients, x and y interleaved
+   f64 *k1x, *k1y; // f at (ts, sx, sy), reused as the first stage
+   u32 *birthstep; // the particle's birthstep when its lane was started
+   AdaptiveStats *chunkstats;
+   AdaptiveStats stats;
+};
+
+void freeadaptive(AdaptiveSolver *s)
+{
+   free(s->ts);
+   free(s->sx);
+   free(s->sy);
+   free(s->h);
+   free(s->hlast);
+   free(s->k1x);
+   free(s->k1y);
+   for (int k = 0; k < 5; k += 1)
+      free(s->dense[k]);
+   free(s->birthstep);
+   free(s->chunkstats);
+   memset(s, 0, sizeof(*s));
+}
+
+// Returns false, with s empty, when the memory is not there.
+bool tryinitadaptive(AdaptiveSolver *s, int count, f64 rtol = 1e-6, f64 atol = 1e-9)
+{
+   memset(s, 0, sizeof(*s));
+   s->count = count;
+   s->rtol = rtol;
+   s->atol = atol;
+   bool ok = true;
+   f64 **arrays[] = {&s->ts, &s->sx, &s->sy, &s->h, &s->hlast, &s->k1x, &s->k1y};
+   for (int a = 0; a < arrlen(arrays); a += 1)
+   {
+      *arrays[a] = (f64 *) malloc((size_t) count * sizeof(f64));
+      ok = ok && *arrays[a];
+   }
+   for (int k = 0; k < 5; k += 1)
+   {
+      s->dense[k] = (f64 *) malloc(2 * (size_t) count * sizeof(f64));
+      ok = ok && s->dense[k];
+   }
+   s->birthstep = (u32 *) malloc((size_t) count * sizeof(u32));
+   s->chunkstats = (AdaptiveStats *) calloc((size_t) (count + particle_chunk - 1) / particle_chunk, sizeof(AdaptiveStats));
+   if (!ok || !s->birthstep || !s->chunkstats)
+   {
+      freeadaptive(s);
+      return false;
+   }
+   for (int i = 0; i < count; i += 1)
+      s->ts[i] = NAN;
+   return true;
+}
+
+void initadaptive(AdaptiveSolver *s, int count, f64 rtol = 1e-6, f64 atol = 1e-9)
+{
+   bool ok = tryinitadaptive(s, count, rtol, atol);
+   AN(ok);
+   (void) ok;
+}
+
+// bytes of the solver for count particles
+static inline
+size_t adaptivememory(int count)
+{
+   return (7 + 5 * 2) * (size_t) count * sizeof(f64) + (size_t) count * sizeof(u32)
+        + (size_t) ((count + particle_chunk - 1) / particle_chunk) * sizeof(AdaptiveStats);
+}
+
+// every lane restarts from its particle's current row on the next step,
+// e.g. after f changed
+static inline
+void invalidateadaptive(AdaptiveSolver *s)
+{
+   for (int i = 0; i < s->count; i += 1)
+      s->ts[i] = NAN;
+}
+
+// Dormand and Prince's coefficients, with the dense output of Hairer's dopri5
+namespace dopri
+{
+   const f64 c2 = 1/5.0, c3 = 3/10.0, c4 = 4/5.0, c5 = 8/9.0;
+   const f64 a21 = 1/5.0;
+   const f64 a31 = 3/40.0, a32 = 9/40.0;
+   const f64 a41 = 44/45.0, a42 = -56/15.0, a43 = 32/9.0;
+   const f64 a51 = 19372/6561.0, a52 = -25360/2187.0, a53 = 64448/6561.0, a54 = -212/729.0;
+   const f64 a61 = 9017/3168.0, a62 = -355/33.0, a63 = 46732/5247.0, a64 = 49/176.0, a65 = -5103/18656.0;
+   const f64 a71 = 35/384.0, a73 = 500/1113.0, a74 = 125/192.0, a75 = -2187/6784.0, a76 = 11/84.0;
+   const f64 e1 = 71/57600.0, e3 = -71/16695.0, e4 = 71/1920.0, e5 = -17253/339200.0, e6 = 22/525.0, e7 = -1/40.0;
+   const f64 d1 = -12715105075/11282082432.0, d3 = 87487479700/32700410799.0, d4 = -10690763975/1880347072.0,
+             d5 = 701980252875/199316789632.0, d6 = -1453857185/822651844.0, d7 = 69997945/29380423.0;
+}
+
+// the working set of one block; lanes [0, n) are still integrating
+struct AdaptiveLanes
+{
+   int n;
+   int idx[vm_lanes];
+   f64 t[vm_lanes], x[vm_lanes], y[vm_lanes], h[vm_lanes];
+   f64 k1x[vm_lanes], k1y[vm_lanes];
+   int steps[vm_lanes];
+};
+
+struct AdaptiveJob
+{
+   AdaptiveSolver *s;
+   Particles *p;
+   BatchRhs rhs;
+   void *ctx;
+   f64 t0;  // time of the current row
+   f64 T;   // time of the row being made
+   const f64 *x, *y;
+   f64 *newx, *newy;
+};
+
+static inline
+void storedense(AdaptiveSolver *s, int i, int comp, f64 y0, f64 y1, f64 h, f64 k1, f64 k3, f64 k4, f64 k5, f64 k6, f64 k7)
+{
+   using namespace dopri;
+   f64 ydiff = y1 - y0;
+   f64 bspl = h * k1 - ydiff;
+   s->dense[0][2*i + comp] = y0;
+   s->dense[1][2*i + comp] = ydiff;
+   s->dense[2][2*i + comp] = bspl;
+   s->dense[3][2*i + comp] = ydiff - h * k7 - bspl;
+   s->dense[4][2*i + comp] = h * (d1 * k1 + d3 * k3 + d4 * k4 + d5 * k5 + d6 * k6 + d7 * k7);
+}
+
+static inline
+f64 evaldense(AdaptiveSolver *s, int i, int comp, f64 theta)
+{
+   f64 theta1 = 1 - theta;
+   return s->dense[0][2*i + comp] + theta * (s->dense[1][2*i + comp] + theta1 * (s->dense[2][2*i + comp]
+         + theta * (s->dense[3][2*i + comp] + theta1 * s->dense[4][2*i + comp])));
+}
+
+// one attempted step for every lane in the working set
+static
+void dopristep(AdaptiveJob *job, AdaptiveLanes *w, AdaptiveStats *stats)
+{
+   using namespace dopri;
+   AdaptiveSolver *s = job->s;
+   int n = w->n;
+   f64 tt[vm_lanes], xx[vm_lanes], yy[vm_lanes];
+   f64 k2x[vm_lanes], k2y[vm_lanes], k3x[vm_lanes], k3y[vm_lanes], k4x[vm_lanes], k4y[vm_lanes];
+   f64 k5x[vm_lanes], k5y[vm_lanes], k6x[vm_lanes], k6y[vm_lanes], k7x[vm_lanes], k7y[vm_lanes];
+   f64 x1[vm_lanes], y1[vm_lanes];
+
+   for (int l = 0; l < n; l += 1)
+   {
+      f64 h = w->h[l];
+      tt[l] = w->t[l] + c2 * h;
+      xx[l] = w->x[l] + h * a21 * w->k1x[l];
+      yy[l] = w->y[l] + h * a21 * w->k1y[l];
+   }
+   job->rhs(job->ctx, tt, xx, yy, k2x, k2y, n);
+   for (int l = 0; l < n; l += 1)
+   {
+      f64 h = w->h[l];
+      tt[l] = w->t[l] + c3 * h;
+      xx[l] = w->x[l] + h * (a31 * w->k1x[l] + a32 * k2x[l]);
+      yy[l] = w->y[l] + h * (a31 * w->k1y[l] + a32 * k2y[l]);
+   }
+   job->rhs(job->ctx, tt, xx, yy, k3x, k3y, n);
+   for (int l = 0; l < n; l += 1)
+   {
+      f64 h = w->h[l];
+      tt[l] = w->t[l] + c4 * h;
+      xx[l] = w->x[l] + h * (a41 * w->k1x[l] + a42 * k2x[l] + a43 * k3x[l]);
+      yy[l] = w->y[l] + h * (a41 * w->k1y[l] + a42 * k2y[l] + a43 * k3y[l]);
+   }
+   job->rhs(job->ctx, tt, xx, yy, k4x, k4y, n);
+   for (int l = 0; l < n; l += 1)
+   {
+      f64 h = w->h[l];
+      tt[l] = w->t[l] + c5 * h;
+      xx[l] = w->x[l] + h * (a51 * w->k1x[l] + a52 * k2x[l] + a53 * k3x[l] + a54 * k4x[l]);
+      yy[l] = w->y[l] + h * (a51 * w->k1y[l] + a52 * k2y[l] + a53 * k3y[l] + a54 * k4y[l]);
+   }
+   job->rhs(job->ctx, tt, xx, yy, k5x, k5y, n);
+   for (int l = 0; l < n; l += 1)
+   {
+      f64 h = w->h[l];
+      tt[l] = w->t[l] + h;
+      xx[l] = w->x[l] + h * (a61 * w->k1x[l] + a62 * k2x[l] + a63 * k3x[l] + a64 * k4x[l] + a65 * k5x[l]);
+      yy[l] = w->y[l] + h * (a61 * w->k1y[l] + a62 * k2y[l] + a63 * k3y[l] + a64 * k4y[l] + a65 * k5y[l]);
+   }
+   job->rhs(job->ctx, tt, xx, yy, k6x, k6y, n);
+   for (int l = 0; l < n; l += 1)
+   {
+      f64 h = w->h[l];
+      x1[l] = w->x[l] + h * (a71 * w->k1x[l] + a73 * k3x[l] + a74 * k4x[l] + a75 * k5x[l] + a76 * k6x[l]);
+      y1[l] = w->y[l] + h * (a71 * w->k1y[l] + a73 * k3y[l] + a74 * k4y[l] + a75 * k5y[l] + a76 * k6y[l]);
+   }
+   // tt still holds t + h
+   job->rhs(job->ctx, tt, x1, y1, k7x, k7y, n);
+
+   for (int l = 0; l < n; l += 1)
+   {
+      f64 h = w->h[l];
+      f64 errx = h * (e1 * w->k1x[l] + e3 * k3x[l] + e4 * k4x[l] + e5 * k5x[l] + e6 * k6x[l] + e7 * k7x[l]);
+      f64 erry = h * (e1 * w->k1y[l] + e3 * k3y[l] + e4 * k4y[l] + e5 * k5y[l] + e6 * k6y[l] + e7 * k7y[l]);
+      f64 scx = s->atol + s->rtol * max(fabs(w->x[l]), fabs(x1[l]));
+      f64 scy = s->atol + s->rtol * max(fabs(w->y[l]), fabs(y1[l]));
+      f64 err = sqrt(0.5 * ((errx / scx) * (errx / scx) + (erry / scy) * (erry / scy)));
+      // a nan error fails both comparisons and shrinks the step the most
+      f64 fac = err == 0 ? 5 : 0.9 * pow(err, -0.2);
+      fac = fac >= 0.2 ? min(fac, 5.0) : 0.2;
+      // there is nothing to step from once the state is not finite, so the
+      // lane gives up the row instead of retrying it
+      if (!(isfinite(w->x[l]) && isfinite(w->y[l])))
+      {
+         w->steps[l] = max_adaptive_steps;
+         continue;
+      }
+      w->steps[l] += 1;
+
+      bool accept = err <= 1 || h <= adaptive_min_step;
+      if (!accept)
+      {
+         stats->rejected += 1;
+         w->h[l] = h * min(fac, 1.0);
+         continue;
+      }
+      stats->steps += 1;
+      int i = w->idx[l];
+      storedense(s, i, 0, w->x[l], x1[l], h, w->k1x[l], k3x[l], k4x[l], k5x[l], k6x[l], k7x[l]);
+      storedense(s, i, 1, w->y[l], y1[l], h, w->k1y[l], k3y[l], k4y[l], k5y[l], k6y[l], k7y[l]);
+      s->hlast[i] = h;
+      w->t[l] += h;
+      w->x[l] = x1[l];
+      w->y[l] = y1[l];
+      w->k1x[l] = k7x[l];
+      w->k1y[l] = k7y[l];
+      w->h[l] = h * fac;
+   }
+}
+
+// writes a lane back to the solver and removes it from the working set
+static inline
+void retirelane(AdaptiveSolver *s, AdaptiveLanes *w, int l)
+{
+   int i = w->idx[l];
+   s->ts[i] = w->t[l];
+   s->sx[i] = w->x[l];
+   s->sy[i] = w->y[l];
+   s->h[i] = w->h[l];
+   s->k1x[i] = w->k1x[l];
+   s->k1y[i] = w->k1y[l];
+
+   int last = w->n - 1;
+   w->idx[l] = w->idx[last];
+   w->t[l] = w->t[last];
+   w->x[l] = w->x[last];
+   w->y[l] = w->y[last];
+   w->h[l] = w->h[last];
+   w->k1x[l] = w->k1x[last];
+   w->k1y[l] = w->k1y[last];
+   w->steps[l] = w->steps[last];
+   w->n -= 1;
+}
+
+static
+void adaptivechunk(void *ctx, int begin, int end)
+{
+   AdaptiveJob *job = (AdaptiveJob *) ctx;
+   AdaptiveSolver *s = job->s;
+   Particles *p = job->p;
+   const f64 *x = job->x;
+   const f64 *y = job->y;
+   AdaptiveStats *stats = &s->chunkstats[begin / particle_chunk];
+   f64 T = job->T;
+
+   AdaptiveLanes w;
+   for (int block = begin; block < end; block += vm_lanes)
+   {
+      int blockend = min(block + vm_lanes, end);
+
+      // (re)start lanes whose particle was spawned since they last ran, or
+      // that are not at the current row's time
+      f64 st[vm_lanes], sxs[vm_lanes], sys[vm_lanes], fx[vm_lanes], fy[vm_lanes];
+      int fresh[vm_lanes];
+      int numfresh = 0;
+      for (int i = block; i < blockend; i += 1)
+      {
+         bool current = s->ts[i] >= job->t0 && s->ts[i] - s->hlast[i] <= job->t0;
+         if (s->birthstep[i] == p->birthstep[i] && current)
+            continue;
+         s->birthstep[i] = p->birthstep[i];
+         s->ts[i] = job->t0;
+         s->sx[i] = x[i];
+         s->sy[i] = y[i];
+         s->h[i] = T - job->t0;
+         s->hlast[i] = 0;
+         st[numfresh] = job->t0;
+         sxs[numfresh] = x[i];
+         sys[numfresh] = y[i];
+         fresh[numfresh++] = i;
+      }
+      if (numfresh > 0)
+      {
+         job->rhs(job->ctx, st, sxs, sys, fx, fy, numfresh);
+         for (int f = 0; f < numfresh; f += 1)
+         {
+            s->k1x[fresh[f]] = fx[f];
+            s->k1y[fresh[f]] = fy[f];
+         }
+      }
+
+      // gather the lanes that have to step to reach T
+      w.n = 0;
+      for (int i = block; i < blockend; i += 1)
+      {
+         if (s->ts[i] >= T)
+            continue;
+         int l = w.n++;
+         w.idx[l] = i;
+         w.t[l] = s->ts[i];
+         w.x[l] = s->sx[i];
+         w.y[l] = s->sy[i];
+         w.h[l] = s->h[i];
+         w.k1x[l] = s->k1x[i];
+         w.k1y[l] = s->k1y[i];
+         w.steps[l] = 0;
+      }
+
+      while (w.n > 0)
+      {
+         dopristep(job, &w, stats);
+         for (int l = w.n - 1; l >= 0; l -= 1)
+         {
+            if (w.t[l] >= T)
+               retirelane(s, &w, l);
+            else if (w.steps[l] >= max_adaptive_steps)
+            {
+               // gives up on this row; the lane stays behind and the row
+               // shows where it got to
+               stats->stalled += 1;
+               int i = w.idx[l];
+               s->hlast[i] = 0;
+               retirelane(s, &w, l);
+            }
+         }
+      }
+
+      // read the row off each particle's last step
+      for (int i = block; i < blockend; i += 1)
+      {
+         f64 hlast = s->hlast[i];
+         if (hlast == 0 || s->ts[i] < T)
+         {
+            job->newx[i] = s->sx[i];
+            job->newy[i] = s->sy[i];
+            continue;
+         }
+         f64 theta = (T - (s->ts[i] - hlast)) / hlast;
+         job->newx[i] = evaldense(s, i, 0, theta);
+         job->newy[i] = evaldense(s, i, 1, theta);
+      }
+   }
+}
+
+// new history row h after the current one
+void stepadaptive(AdaptiveSolver *s, Particles *p, BatchRhs rhs, void *ctx, f64 h, ThreadPool *pool = NULL)
+{
+   assert(s->count == p->count);
+   int numchunks = (p->count + particle_chunk - 1) / particle_chunk;
+   memset(s->chunkstats, 0, (size_t) numchunks * sizeof(AdaptiveStats));
+
+   AdaptiveJob job;
+   job.s = s;
+   job.p = p;
+   job.rhs = rhs;
+   job.ctx = ctx;
+   job.t0 = p->time;
+   job.T = p->time + h;
+   job.x = currentx(p);
+   job.y = currenty(p);
+   advancehistory(p);
+   job.newx = currentx(p);
+   job.newy = currenty(p);
+   parallelfor(pool, p->count, particle_chunk, adaptivechunk, &job);
+   p->time = job.T;
+
+   for (int c = 0; c < numchunks; c += 1)
+   {
+      s->stats.steps += s->chunkstats[c].steps;
+      s->stats.rejected += s->chunkstats[c].rejected;
+      s->stats.stalled += s->chunkstats[c].stalled;
+   }
+}
+
+// right-hand sides
+
+struct ProgramRhs
+{
+   Program *prog;
+   VmEnv env;
+};
+
+void programrhs(void *ctx, const f64 *t, const f64 *x, const f64 *y, f64 *dx, f64 *dy, int n)
+{
+   ProgramRhs *rhs = (ProgramRhs *) ctx;
+   Program *prog = rhs->prog;
+   alignas(cacheline_size) f64 regs[max_vm_regs][vm_lanes];
+   loaduniforms(prog, regs, &rhs->env);
+   memcpy(regs[VM_T], t, (size_t) n * sizeof(f64));
+   memcpy(regs[VM_X], x, (size_t) n * sizeof(f64));
+   memcpy(regs[VM_Y], y, (size_t) n * sizeof(f64));
+   runprogram(prog, regs, n);
+   memcpy(dx, regs[prog->out[0]], (size_t) n * sizeof(f64));
+   memcpy(dy, regs[prog->out[1]], (size_t) n * sizeof(f64));
+}
+
+struct MatrixRhs
+{
+   MatrixFn A;
+   void *ctx;
+};
+
+void matrixrhs(void *ctx, const f64 *t, const f64 *x, const f64 *y, f64 *dx, f64 *dy, int n)
+{
+   MatrixRhs *rhs = (MatrixRhs *) ctx;
+   for (int l = 0; l < n; l += 1)
+   {
+      Mat2x2F64 A = rhs->A(rhs->ctx, t[l]);
+      dx[l] = A(0, 0) * x[l] + A(0, 1) * y[l];
+      dy[l] = A(1, 0) * x[l] + A(1, 1) * y[l];
+   }
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "useful_utils.cpp"
+#include "draw_backend.cpp"
+
+// The coordinate axes with their ticks and labels, drawn once into a render
+// texture and then put on screen with a single textured quad. The texture is
+// only redrawn when the zoom, the pan, the window size or the kind of axes
+// change. Without raylib only drawaxesimmediate() is there, for the software
+// rasterizer.
+//
+// Like the persistence buffer, the texture holds premultiplied colors over a
+// transparent background, so the anti-aliased edges of the labels come out
+// as light as when they are drawn straight to the screen.
+
+enum AxesKind
+{
+   AXES_2D,
+   AXES_1D,  // x axis only, in its own color
+};
+
+struct AxesKey
+{
+   int kind;
+   int pixelsperunit;
+   int width, height;
+   int originx, originy;  // pixel of the origin
+   Color axiscolor;
+};
+
+static inline
+AxesKey makeaxeskey(AxesKind kind, int pixelsperunit, int width, int height, Color axiscolor, int panx = 0, int pany = 0)
+{
+   AxesKey key;
+   memset(&key, 0, sizeof(key));
+   key.kind = kind;
+   key.pixelsperunit = pixelsperunit;
+   key.width = width;
+   key.height = height;
+   key.originx = width/2 + panx;
+   key.originy = height/2 + pany;
+   key.axiscolor = axiscolor;
+   return key;
+}
+
+// the first multiple of step at or after -origin, so that origin + n step is
+// the first tick on screen
+static inline
+int firsttick(int origin, int step)
+{
+   int n = -origin / step;
+   return origin + n * step < 0 ? n + 1 : n;
+}
+
+// the axes drawn directly, one call per tick and label; the thin lines run
+// through pixel centers
+void drawaxesimmediate(AxesKey *key, DrawBackend *b)
+{
+   int width = key->width;
+   int height = key->height;
+   int ppu = key->pixelsperunit;
+   int x0 = key->originx;
+   int y0 = key->originy;
+   int ticklen = 5;
+   f32 cx = (f32) x0 + 0.5f;
+   f32 cy = (f32) y0 + 0.5f;
+   char label[16];
+   if (key->kind == AXES_2D)
+   {
+      drawline(b, {0.5f, cy}, {(f32) width - 0.5f, cy}, 1, key->axiscolor);
+      drawline(b, {cx, 0.5f}, {cx, (f32) height - 0.5f}, 1, key->axiscolor);
+   }
+   else
+      drawline(b, {0, (f32) y0}, {(f32) width - 1, (f32) y0}, 3, key->axiscolor);
+
+   // only the ticks on screen, however far the view is panned
+   for (int xval = firsttick(x0, ppu); x0 + xval * ppu < width; xval += 1)
+   {
+      int x = x0 + xval * ppu;
+      drawline(b, {(f32) x + 0.5f, cy + (f32) ticklen}, {(f32) x + 0.5f, cy - (f32) ticklen}, 1, BLACK);
+      if (xval != 0 && xval % 10 == 0)
+      {
+         snprintf(label, sizeof(label), "%d", xval);
+         b->text(b->ctx, label, x - (xval > 0 ? 10 : 15), y0 + ticklen + 10, 20, DARKGRAY);
+      }
+   }
+   if (key->kind == AXES_1D)
+   {
+      b->text(b->ctx, "0", x0 - 4, y0 + ticklen + 10, 20, DARKGRAY);
+      return;
+   }
+   for (int n = firsttick(y0, ppu); y0 + n * ppu < height; n += 1)
+   {
+      int y = y0 + n * ppu;
+      int yval = -n;
+      drawline(b, {cx - (f32) ticklen, (f32) y + 0.5f}, {cx + (f32) ticklen, (f32) y + 0.5f}, 1, BLACK);
+      if (yval != 0 && yval % 10 == 0)
+      {
+         snprintf(label, sizeof(label), "%d", yval);
+         b->text(b->ctx, label, x0 + ticklen + 15, y - 10, 20, DARKGRAY);
+      }
+   }
+}
+
+#ifdef RAYLIB_H
+
+struct AxesLayer
+{
+   RenderTexture2D target;
+   AxesKey key;
+   bool valid;
+   u64 rebuilds;
+};
+
+AxesLayer axeslayer = {};
+
+static inline
+bool axeslayerstale(AxesLayer *layer, AxesKey *key)
+{
+   return !layer->valid || memcmp(&layer->key, key, sizeof(AxesKey)) != 0;
+}
+
+void drawaxeslayer(AxesLayer *layer, AxesKey key)
+{
+   if (key.width <= 0 || key.height <= 0)
+      return;
+   if (axeslayerstale(layer, &key))
+   {
+      if (!layer->valid || layer->key.width != key.width || layer->key.height != key.height)
+      {
+         if (layer->valid)
+            UnloadRenderTexture(layer->target);
+         layer->target = LoadRenderTexture(key.width, key.height);
+      }
+      BeginTextureMode(layer->target);
+      ClearBackground(BLANK);
+      // rgb = src.rgb src.a + dst.rgb (1 - src.a), a = src.a + dst.a (1 - src.a)
+      rlSetBlendFactorsSeparate(RL_SRC_ALPHA, RL_ONE_MINUS_SRC_ALPHA, RL_ONE, RL_ONE_MINUS_SRC_ALPHA,
+            RL_FUNC_ADD, RL_FUNC_ADD);
+      BeginBlendMode(BLEND_CUSTOM_SEPARATE);
+      drawaxesimmediate(&key, &raylibbackend);
+      EndBlendMode();
+      EndTextureMode();
+      layer->key = key;
+      layer->valid = true;
+      layer->rebuilds += 1;
+   }
+   // render textures are stored bottom up
+   Rectangle source = {0, 0, (f32) key.width, (f32) -key.height};
+   BeginBlendMode(BLEND_ALPHA_PREMULTIPLY);
+   DrawTextureRec(layer->target.texture, source, (Vector2){0, 0}, WHITE);
+   EndBlendMode();
+}
+
+#endif
@@ -0,0 +1,499 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "useful_utils.cpp"
+#include "linearalgebra.cpp"
+#include "particles.cpp"
+#include "time_varying.cpp"
+#include "expression.cpp"
+#include "software_raster.cpp"
+#include "view_transform.cpp"
+
+// keep the optimizer from hoisting or throwing away the benchmarked work
+volatile f64 benchone = 1;
+volatile f64 benchsink = 0;
+
+static inline
+Mat2x2F64 rotationscaling(f64 a, f64 w)
+{
+   return {a, w, -w, a};
+}
+
+static inline
+Mat2x2F64 expm_rotationscaling(f64 a, f64 w)
+{
+   return exp(a) * Mat2x2F64(cos(w), sin(w), -sin(w), cos(w));
+}
+
+static inline
+f64 maxabsdiff(Mat2x2F64 A, Mat2x2F64 B)
+{
+   f64 result = 0;
+   for (int i = 0; i < 4; i += 1)
+      result = max(result, fabs(A.elems[i] - B.elems[i]));
+   return result;
+}
+
+void bench_expm()
+{
+   puts("==== expm: pade vs taylor ====");
+   constexpr int iters = 200000;
+   const f64 norms[] = {0.01, 0.1, 1, 5, 20};
+
+   printf("%8s %8s | %10s %10s %10s %10s | %10s %10s\n",
+         "||A||_1", "pade m,s",
+         "2x2 pade", "2x2 taylor", "pade err", "taylor err",
+         "4x4 pade", "4x4 taylor");
+   for (int n = 0; n < arrlen(norms); n += 1)
+   {
+      // ||A||_1 = |a| + |w|
+      f64 a = -0.25 * norms[n];
+      f64 w = 0.75 * norms[n];
+      Mat2x2F64 A = rotationscaling(a, w);
+      Mat2x2F64 exact = expm_rotationscaling(a, w);
+      Mat4x4F64 Ablock = BlockMatrix(A, Zero2x2(), Zero2x2(), A);
+
+      f64 t0 = gettime_s();
+      for (int i = 0; i < iters; i += 1)
+         benchsink = benchsink + expm(benchone * A).elems[0];
+      f64 t1 = gettime_s();
+      for (int i = 0; i < iters; i += 1)
+         benchsink = benchsink + expm_taylor(benchone * A).elems[0];
+      f64 t2 = gettime_s();
+      for (int i = 0; i < iters; i += 1)
+         benchsink = benchsink + expm(benchone * Ablock).elems[0];
+      f64 t3 = gettime_s();
+      for (int i = 0; i < iters; i += 1)
+         benchsink = benchsink + expm_taylor(benchone * Ablock).elems[0];
+      f64 t4 = gettime_s();
+
+      PadeParams params = choosepade(opnorm1(A));
+      printf("%8.2f %5d,%-2d | %7.1f ns %7.1f ns %10.2e %10.2e | %7.1f ns %7.1f ns\n",
+            norms[n],
+            params.degree, params.squarings,
+            1e9 * (t1 - t0) / iters,
+            1e9 * (t2 - t1) / iters,
+            maxabsdiff(expm(A), exact) / exp(a),
+            maxabsdiff(expm_taylor(A), exact) / exp(a),
+            1e9 * (t3 - t2) / iters,
+            1e9 * (t4 - t3) / iters);
+   }
+   puts("errors are relative to the exact exponential of a rotation-scaling matrix");
+}
+
+void bench_expm_closedform()
+{
+   puts("==== 2x2 expm: closed form vs pade vs taylor ====");
+   constexpr int iters = 1000000;
+   const char *names[] = {"real", "complex", "repeated"};
+   Mat2x2F64 cases[] = {
+      Mat2x2F64(1, 3, 2, 4),
+      rotationscaling(-0.3, 2),
+      Mat2x2F64(2, 0, 1, 2),
+   };
+
+   printf("%10s | %12s %10s %10s | %10s\n", "eigvals", "closed form", "pade", "taylor", "max diff");
+   for (int n = 0; n < arrlen(cases); n += 1)
+   {
+      // the size of one dt * A step in the app
+      Mat2x2F64 A = (1/60.0) * cases[n];
+
+      f64 t0 = gettime_s();
+      for (int i = 0; i < iters; i += 1)
+         benchsink = benchsink + expm_closedform(benchone * A).elems[0];
+      f64 t1 = gettime_s();
+      for (int i = 0; i < iters; i += 1)
+         benchsink = benchsink + expm(benchone * A).elems[0];
+      f64 t2 = gettime_s();
+      for (int i = 0; i < iters; i += 1)
+         benchsink = benchsink + expm_taylor(benchone * A).elems[0];
+      f64 t3 = gettime_s();
+
+      printf("%10s | %9.1f ns %7.1f ns %7.1f ns | %10.2e\n",
+            names[n],
+            1e9 * (t1 - t0) / iters,
+            1e9 * (t2 - t1) / iters,
+            1e9 * (t3 - t2) / iters,
+            maxabsdiff(expm_closedform(A), expm(A)));
+   }
+}
+
+// the array-of-structs layout the particle store replaced, for comparison
+struct AosTrajectory
+{
+   Vec2F64 recentpositions[16];
+   int curidx;
+   int size;
+};
+
+void bench_propagate()
+{
+   puts("==== particle propagation: SoA kernels vs array of structs ====");
+   constexpr int hist = 16;
+   const int counts[] = {1000, 100000, 1000000, 4000000};
+   Mat2x2F64 M = expm_closedform((1/60.0) * Mat2x2F64(-0.3, 2, -1.5, 0.1));
+
+   printf("%10s | %10s", "particles", "aos");
+   for (int level = 0; level < NUM_SIMD_LEVELS; level += 1)
+   {
+      if (simdlevel_supported((SimdLevel) level))
+         printf(" %12s", simdlevel_names[level]);
+   }
+   puts("   (ns per particle per step)");
+
+   for (int c = 0; c < arrlen(counts); c += 1)
+   {
+      int n = counts[c];
+      int steps = max(4, 20000000 / n);
+
+      Vec2F64 *states = (Vec2F64 *) malloc((size_t) n * sizeof(Vec2F64));
+      AosTrajectory *trajs = (AosTrajectory *) calloc((size_t) n, sizeof(AosTrajectory));
+      for (int i = 0; i < n; i += 1)
+         states[i] = {randfloat64(-20, 20), randfloat64(-20, 20)};
+      f64 t0 = gettime_s();
+      for (int s = 0; s < steps; s += 1)
+      {
+         Mat2x2F64 Ms = benchone * M;
+         for (int i = 0; i < n; i += 1)
+         {
+            Vec2F64 newstate = matvecmul(Ms, states[i]);
+            AosTrajectory *tr = &trajs[i];
+            tr->recentpositions[tr->curidx] = newstate;
+            tr->curidx = (tr->curidx + 1) % hist;
+            tr->size = min(hist, tr->size + 1);
+            states[i] = newstate;
+         }
+      }
+      f64 t1 = gettime_s();
+      benchsink = benchsink + states[n / 2].elems[0];
+      printf("%10d | %10.3f", n, 1e9 * (t1 - t0) / ((f64) steps * n));
+      free(states);
+      free(trajs);
+
+      Particles p;
+      initparticles(&p, n, hist);
+      for (int i = 0; i < n; i += 1)
+         spawnparticle(&p, i, {randfloat64(-20, 20), randfloat64(-20, 20)});
+      for (int level = 0; level < NUM_SIMD_LEVELS; level += 1)
+      {
+         if (!simdlevel_supported((SimdLevel) level))
+            continue;
+         setsimdlevel(&p, (SimdLevel) level);
+         t0 = gettime_s();
+         for (int s = 0; s < steps; s += 1)
+            propagateparticles(&p, benchone * M);
+         t1 = gettime_s();
+         benchsink = benchsink + currentx(&p)[n / 2];
+         printf(" %12.3f", 1e9 * (t1 - t0) / ((f64) steps * n));
+      }
+      puts("");
+      freeparticles(&p);
+   }
+}
+
+void bench_threadscaling()
+{
+   puts("==== threaded particle propagation ====");
+   constexpr int n = 4000000;
+   constexpr int steps = 20;
+   Mat2x2F64 M = expm_closedform((1/60.0) * Mat2x2F64(-0.3, 2, -1.5, 0.1));
+   Particles p;
+   initparticles(&p, n, 16);
+   for (int i = 0; i < n; i += 1)
+      spawnparticle(&p, i, {randfloat64(-20, 20), randfloat64(-20, 20)});
+
+   printf("%8s | %16s %8s   (%d particles, %s kernel)\n", "threads", "Mparticles/s", "speedup", n, simdlevel_names[p.simd]);
+   f64 single = 0;
+   for (int numthreads = 1; numthreads <= hardwarethreads(); numthreads += 1)
+   {
+      ThreadPool pool;
+      initthreadpool(&pool, numthreads);
+      f64 t0 = gettime_s();
+      for (int s = 0; s < steps; s += 1)
+         propagateparticles(&p, benchone * M, &pool);
+      f64 t1 = gettime_s();
+      freethreadpool(&pool);
+
+      f64 rate = (f64) n * steps / (t1 - t0);
+      if (numthreads == 1)
+         single = rate;
+      printf("%8d | %16.1f %8.2f\n", numthreads, 1e-6 * rate, rate / single);
+   }
+   benchsink = benchsink + currentx(&p)[n / 2];
+   freeparticles(&p);
+}
+
+static
+Mat2x2F64 benchmathieu(void *ctx, f64 t)
+{
+   return {0, -(1.5 - 0.6 * cos(2 * t)), 1, 0};
+}
+
+void bench_timevarying()
+{
+   puts("==== time-varying A(t): 4th order magnus vs rk4 ====");
+   constexpr f64 T = 20;
+   Vec2F64 init = {1, 0};
+
+   Particles p;
+   initparticles(&p, 1, 2);
+   spawnparticle(&p, 0, init);
+   for (int s = 0; s < 1 << 16; s += 1)
+      stepmagnus(&p, benchmathieu, NULL, T / (1 << 16));
+   Vec2F64 reference = getMostRecentPos(&p, 0);
+   freeparticles(&p);
+
+   printf("%8s | %12s %12s   (error at t = %.0f)\n", "steps", "magnus", "rk4", T);
+   for (int n = 50; n <= 3200; n *= 2)
+   {
+      f64 err[2];
+      for (int method = 0; method < 2; method += 1)
+      {
+         initparticles(&p, 1, 2);
+         spawnparticle(&p, 0, init);
+         for (int s = 0; s < n; s += 1)
+         {
+            if (method == 0)
+               stepmagnus(&p, benchmathieu, NULL, T / n);
+            else
+               steprk4(&p, benchmathieu, NULL, T / n);
+         }
+         Vec2F64 d = getMostRecentPos(&p, 0) - reference;
+         err[method] = sqrt(dot(d, d));
+         freeparticles(&p);
+      }
+      printf("%8d | %12.3e %12.3e\n", n, err[0], err[1]);
+   }
+
+   constexpr int n = 1000000;
+   constexpr int steps = 20;
+   initparticles(&p, n, 16);
+   for (int i = 0; i < n; i += 1)
+      spawnparticle(&p, i, {randfloat64(-20, 20), randfloat64(-20, 20)});
+   f64 t0 = gettime_s();
+   for (int s = 0; s < steps; s += 1)
+      stepmagnus(&p, benchmathieu, NULL, benchone / 60);
+   f64 t1 = gettime_s();
+   for (int s = 0; s < steps; s += 1)
+      steprk4(&p, benchmathieu, NULL, benchone / 60);
+   f64 t2 = gettime_s();
+   benchsink = benchsink + currentx(&p)[n / 2];
+   printf("%8s | %12.1f %12.1f   (Mparticle steps/s, %d particles)\n", "rate",
+         1e-6 * n * steps / (t1 - t0),
+         1e-6 * n * steps / (t2 - t1), n);
+   freeparticles(&p);
+}
+
+// the same rk4 step as stepnonlinear with van der pol written out by hand
+static
+void vanderpolrk4(Particles *p, f64 mu, f64 h)
+{
+   const f64 *x = currentx(p);
+   const f64 *y = currenty(p);
+   advancehistory(p);
+   f64 *newx = currentx(p);
+   f64 *newy = currenty(p);
+   for (int i = 0; i < p->count; i += 1)
+   {
+      f64 x0 = x[i], y0 = y[i];
+      f64 k1x = y0;
+      f64 k1y = mu * (1 - x0 * x0) * y0 - x0;
+      f64 x1 = x0 + 0.5 * h * k1x, y1 = y0 + 0.5 * h * k1y;
+      f64 k2x = y1;
+      f64 k2y = mu * (1 - x1 * x1) * y1 - x1;
+      f64 x2 = x0 + 0.5 * h * k2x, y2 = y0 + 0.5 * h * k2y;
+      f64 k3x = y2;
+      f64 k3y = mu * (1 - x2 * x2) * y2 - x2;
+      f64 x3 = x0 + h * k3x, y3 = y0 + h * k3y;
+      f64 k4x = y3;
+      f64 k4y = mu * (1 - x3 * x3) * y3 - x3;
+      newx[i] = x0 + h / 6 * (k1x + 2 * k2x + 2 * k3x + k4x);
+      newy[i] = y0 + h / 6 * (k1y + 2 * k2y + 2 * k3y + k4y);
+   }
+}
+
+void bench_expression()
+{
+   puts("==== x' = f(x): bytecode vm vs hand-written c++ (van der pol, rk4) ====");
+   constexpr int n = 1000000;
+   constexpr int steps = 20;
+   Program prog;
+   bool ok = compileprogram(&prog, "y", "mu*(1 - x^2)*y - x");
+   assert(ok);
+   (void) ok;
+   VmEnv env = {0, {0, 0, 0, 0, 1.5}};
+
+   Particles p;
+   initparticles(&p, n, 16);
+   for (int i = 0; i < n; i += 1)
+      spawnparticle(&p, i, {randfloat64(-3, 3), randfloat64(-3, 3)});
+   f64 t0 = gettime_s();
+   for (int s = 0; s < steps; s += 1)
+      vanderpolrk4(&p, 1.5, benchone / 60);
+   f64 t1 = gettime_s();
+   for (int s = 0; s < steps; s += 1)
+      stepnonlinear(&p, &prog, env, benchone / 60);
+   f64 t2 = gettime_s();
+   benchsink = benchsink + currentx(&p)[n / 2];
+   printf("%d instructions | %8.2f ns hand-written %8.2f ns vm   (per particle step)\n",
+         prog.numcode,
+         1e9 * (t1 - t0) / ((f64) n * steps),
+         1e9 * (t2 - t1) / ((f64) n * steps));
+   freeparticles(&p);
+}
+
+static inline
+f64 libcrandom(f64 minval, f64 maxval)
+{
+   return (f64) rand() / (f64) RAND_MAX * (maxval - minval) + minval;
+}
+
+void bench_spawn()
+{
+   puts("==== spawning ====");
+   constexpr int n = 1000000;
+   constexpr int reps = 10;
+   Particles p;
+   initparticles(&p, n, 2);
+
+   f64 t0 = gettime_s();
+   for (int r = 0; r < reps; r += 1)
+      for (int i = 0; i < n; i += 1)
+         spawnparticle(&p, i, {libcrandom(-20, 20), libcrandom(-20, 20)});
+   f64 t1 = gettime_s();
+   for (int r = 0; r < reps; r += 1)
+      for (int i = 0; i < n; i += 1)
+         spawnparticle(&p, i, {randfloat64(-20, 20), randfloat64(-20, 20)});
+   f64 t2 = gettime_s();
+   Rng rng;
+   seedrng(&rng, 1);
+   for (int r = 0; r < reps; r += 1)
+      spawnuniform(&p, 0, {-20, -20}, {20, 20}, &rng);
+   f64 t3 = gettime_s();
+   benchsink = benchsink + currentx(&p)[n / 2];
+
+   printf("%-28s %8.2f ns/particle\n", "rand() per particle", 1e9 * (t1 - t0) / (reps * n));
+   printf("%-28s %8.2f ns/particle\n", "xoshiro per particle", 1e9 * (t2 - t1) / (reps * n));
+   printf("%-28s %8.2f ns/particle\n", "xoshiro lanes, per chunk", 1e9 * (t3 - t2) / (reps * n));
+   freeparticles(&p);
+}
+
+// a frame like the game's: 400 trails of 15 segments over a few axis lines
+void bench_softrender()
+{
+   puts("==== software rasterizer, 800x600 ====");
+   constexpr int frames = 20;
+   SoftRenderer r;
+   initsoftrenderer(&r, 800, 600);
+   printf("%8s | %12s %8s\n", "threads", "ms/frame", "speedup");
+   f64 single = 0;
+   for (int numthreads = 1; numthreads <= hardwarethreads(); numthreads += 1)
+   {
+      ThreadPool pool;
+      initthreadpool(&pool, numthreads);
+      Rng rng;
+      seedrng(&rng, 1);
+      f64 t0 = gettime_s();
+      for (int f = 0; f < frames; f += 1)
+      {
+         softclear(&r, {245, 245, 245, 255});
+         softline(&r, 0, 300.5f, 800, 300.5f, 1, {0, 0, 0, 255});
+         softline(&r, 400.5f, 0, 400.5f, 600, 1, {0, 0, 0, 255});
+         for (int i = 0; i < 400; i += 1)
+         {
+            f32 x = (f32) randuniform(&rng, 0, 800), y = (f32) randuniform(&rng, 0, 600);
+            for (int s = 0; s < 15; s += 1)
+            {
+               f32 nx = x + (f32) randuniform(&rng, -8, 8), ny = y + (f32) randuniform(&rng, -8, 8);
+               softline(&r, x, y, nx, ny, 3 - 0.1f * (f32) s, {190, 33, 55, 255});
+               x = nx;
+               y = ny;
+            }
+         }
+         softrender(&r, &pool);
+      }
+      f64 t1 = gettime_s();
+      freethreadpool(&pool);
+      f64 ms = 1e3 * (t1 - t0) / frames;
+      if (numthreads == 1)
+         single = ms;
+      printf("%8d | %12.2f %8.2f\n", numthreads, ms, single / ms);
+   }
+   benchsink = benchsink + r.pixels[300 * 800 + 400].r;
+   freesoftrenderer(&r);
+}
+
+// trail pixels of every drawn history point: one point at a time as the draw loop
+// used to, against whole rows through the view transform kernels
+void bench_viewtransform()
+{
+   puts("==== history to screen pixels, 100000 particles x 16 ====");
+   constexpr int n = 100000;
+   constexpr int hist = 16;
+   constexpr int reps = 20;
+   ViewTransform vt = makeviewtransform(20, 800, 600, 13, -7);
+   f64 alpha = 0.3;
+   Particles p;
+   initparticles(&p, n, hist);
+   for (int i = 0; i < n; i += 1)
+      spawnparticle(&p, i, {randfloat64(-20, 20), randfloat64(-20, 20)});
+   for (int s = 0; s < hist; s += 1)
+      propagateparticles(&p, expm_closedform((1/60.0) * Mat2x2F64(-0.3, 2, -1.5, 0.1)));
+   f32 *pixels = (f32 *) malloc(2 * (size_t) n * hist * sizeof(f32));
+   AN(pixels);
+
+   f64 t0 = gettime_s();
+   for (int r = 0; r < reps; r += 1)
+   {
+      // the oldest row is only blended from, not drawn
+      for (int ago = 0; ago + 1 < hist; ago += 1)
+      {
+         const f64 *x = histrow(&p, p.histx, ago);
+         const f64 *y = histrow(&p, p.histy, ago);
+         const f64 *olderx = histrow(&p, p.histx, ago + 1);
+         const f64 *oldery = histrow(&p, p.histy, ago + 1);
+         for (int i = 0; i < n; i += 1)
+         {
+            Vec2F64 pos = {x[i], y[i]};
+            if (ago + 1 < trailsize(&p, i))
+               pos = Vec2F64(olderx[i], oldery[i]) + alpha * (pos - Vec2F64(olderx[i], oldery[i]));
+            Vec2F64 pixel = viewtopixel(&vt, pos);
+            pixels[2 * ((size_t) i * hist + ago)] = (f32) pixel.elems[0];
+            pixels[2 * ((size_t) i * hist + ago) + 1] = (f32) pixel.elems[1];
+         }
+      }
+   }
+   f64 t1 = gettime_s();
+   benchsink = benchsink + (f64) pixels[n];
+   printf("%-28s %8.3f ns/point\n", "per point", 1e9 * (t1 - t0) / ((f64) reps * n * (hist - 1)));
+
+   for (int level = 0; level < NUM_SIMD_LEVELS; level += 1)
+   {
+      if (!simdlevel_supported((SimdLevel) level))
+         continue;
+      setsimdlevel(&p, (SimdLevel) level);
+      t0 = gettime_s();
+      for (int r = 0; r < reps; r += 1)
+         historytopixels(&vt, &p, alpha, 0, n, pixels);
+      t1 = gettime_s();
+      benchsink = benchsink + (f64) pixels[n];
+      printf("rows, %-22s %8.3f ns/point\n", simdlevel_names[level], 1e9 * (t1 - t0) / ((f64) reps * n * (hist - 1)));
+   }
+   free(pixels);
+   freeparticles(&p);
+}
+
+int main(void)
+{
+   bench_expm();
+   bench_expm_closedform();
+   bench_propagate();
+   bench_threadscaling();
+   bench_timevarying();
+   bench_expression();
+   bench_spawn();
+   bench_softrender();
+   bench_viewtransform();
+   return 0;
+}
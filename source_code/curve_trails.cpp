@@ -0,0 +1,119 @@
+#pragma once
+
+#include "useful_utils.cpp"
+#include "linearalgebra.cpp"
+#include "view_transform.cpp"
+
+// Trails of dx/dt = A x drawn from the exact flow instead of the stored
+// history. Going back s seconds from the state x drawn now lands on
+// e^{-sA} x, so the trail over the last `span` seconds is that curve for s in
+// [0, span]. The propagators for s on a grid of curve_grid steps are the same
+// for every particle, so they are computed once per frame, and a point of the
+// curve then costs one 2x2 product.
+//
+// Vertices are placed by the error in pixels: a piece of the curve is split
+// in half while its middle lies further than `tolerance` from the chord, so
+// straight stretches get one segment and tight curls as many as the grid has.
+
+#define curve_grid 64
+#define curve_basepieces 4  // split up front, so a curl can't hide between ends
+
+struct CurveTrail
+{
+   Mat2x2F64 P[curve_grid + 1];  // e^{-(lag + k h) A}
+   f64 h;                        // seconds between grid points
+   f64 rowdt;                    // seconds per history row, the unit of ages
+   f32 sx, sy, ox, oy;           // the view, see view_transform.cpp
+};
+
+// lag is how far the drawn states are behind the current ones
+void initcurvetrail(CurveTrail *c, Mat2x2F64 A, f64 span, f64 lag, f64 rowdt, const ViewTransform *vt)
+{
+   c->h = span / curve_grid;
+   c->rowdt = rowdt;
+   c->sx = (f32) vt->sx;
+   c->sy = (f32) vt->sy;
+   c->ox = (f32) vt->ox;
+   c->oy = (f32) vt->oy;
+   for (int k = 0; k <= curve_grid; k += 1)
+      c->P[k] = expm_closedform(-(lag + k * c->h) * A);
+}
+
+struct CurveScratch
+{
+   Vector2 pixel[curve_grid + 1];
+   bool have[curve_grid + 1];
+};
+
+static inline
+Vector2 curvepixel(CurveTrail *c, CurveScratch *s, Vec2F64 x, int k)
+{
+   if (!s->have[k])
+   {
+      Vec2F64 p = matvecmul(c->P[k], x);
+      s->pixel[k] = {(f32) p.elems[0] * c->sx + c->ox, (f32) p.elems[1] * c->sy + c->oy};
+      s->have[k] = true;
+   }
+   return s->pixel[k];
+}
+
+// appends the vertices after k0 up to k1 of the piece [k0, k1]
+static
+int refinecurve(CurveTrail *c, CurveScratch *s, Vec2F64 x, int k0, int k1, f32 tolerance, Vector2 *points, f32 *ages)
+{
+   if (k1 - k0 >= 2)
+   {
+      int km = (k0 + k1) / 2;
+      Vector2 a = curvepixel(c, s, x, k0);
+      Vector2 b = curvepixel(c, s, x, k1);
+      Vector2 m = curvepixel(c, s, x, km);
+      f32 dx = b.x - a.x, dy = b.y - a.y;
+      f32 mx = m.x - a.x, my = m.y - a.y;
+      f32 length2 = dx * dx + dy * dy;
+      // distance of m from the chord, or from a for a closed piece
+      f32 cross = dx * my - dy * mx;
+      bool split = length2 > 0
+         ? cross * cross > tolerance * tolerance * length2
+         : mx * mx + my * my > tolerance * tolerance;
+      if (split)
+      {
+         int n = refinecurve(c, s, x, k0, km, tolerance, points, ages);
+         return n + refinecurve(c, s, x, km, k1, tolerance, points + n, ages + n);
+      }
+   }
+   points[0] = curvepixel(c, s, x, k1);
+   ages[0] = (f32) (k1 * c->h / c->rowdt);
+   return 1;
+}
+
+// The trail of the particle whose current state is x, over grid points
+// 0..kend, newest first, within tolerance pixels. points and ages need room
+// for curve_grid + 1 entries; returns how many were written.
+int tessellatecurve(CurveTrail *c, Vec2F64 x, int kend, f32 tolerance, Vector2 *points, f32 *ages)
+{
+   CurveScratch s;
+   memset(s.have, 0, sizeof(s.have));
+   points[0] = curvepixel(c, &s, x, 0);
+   ages[0] = 0;
+   if (kend <= 0)
+      return 1;
+   kend = min(kend, curve_grid);
+   int n = 1;
+   int pieces = min(curve_basepieces, kend);
+   for (int piece = 0; piece < pieces; piece += 1)
+   {
+      int k0 = kend * piece / pieces;
+      int k1 = kend * (piece + 1) / pieces;
+      n += refinecurve(c, &s, x, k0, k1, tolerance, points + n, ages + n);
+   }
+   return n;
+}
+
+// how many grid points back a trail of `seconds` reaches
+static inline
+int curvegridend(CurveTrail *c, f64 seconds)
+{
+   if (!(seconds > 0) || !(c->h > 0))
+      return 0;
+   return (int) min(floor(seconds / c->h + 1e-9), (f64) curve_grid);
+}
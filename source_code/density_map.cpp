@@ -0,0 +1,175 @@
+#pragma once
+
+#include "useful_utils.cpp"
+#include "threadpool.cpp"
+
+// Where the particles are, as a histogram over the screen instead of one line
+// per particle, for counts where the trails melt into a blob anyway. Every
+// slice of the particles is binned by one worker into its own private bins,
+// so there are no atomics; the slices are then summed row by row into the
+// decaying density, which is tone mapped to the pixels of one texture.
+// Drawing costs the same for any number of particles.
+
+#define density_rowchunk 16
+
+struct DensityMap
+{
+   int width, height;  // bins
+   int numslices;
+   u32 *bins;          // numslices private histograms, each width*height
+   f32 *density;       // decayed sum of the bins over frames
+   f32 *rowmax;
+   f32 maxdensity;
+   Color *pixels;
+   Color ramp[256];
+};
+
+void freedensitymap(DensityMap *m)
+{
+   free(m->bins);
+   free(m->density);
+   free(m->rowmax);
+   free(m->pixels);
+   m->bins = NULL;
+   m->density = NULL;
+   m->rowmax = NULL;
+   m->pixels = NULL;
+   m->width = 0;
+   m->height = 0;
+   m->numslices = 0;
+}
+
+void cleardensitymap(DensityMap *m)
+{
+   size_t size = (size_t) m->width * (size_t) m->height;
+   memset(m->bins, 0, (size_t) m->numslices * size * sizeof(u32));
+   memset(m->density, 0, size * sizeof(f32));
+   memset(m->pixels, 0, size * sizeof(Color));
+   m->maxdensity = 0;
+}
+
+// from transparent through color to black, so the densest spots stand out
+void initdensitymap(DensityMap *m, int width, int height, int numslices, Color color)
+{
+   assert(width > 0 && height > 0 && numslices > 0);
+   freedensitymap(m);
+   m->width = width;
+   m->height = height;
+   m->numslices = numslices;
+   size_t size = (size_t) width * (size_t) height;
+   m->bins = (u32 *) malloc((size_t) numslices * size * sizeof(u32));
+   m->density = (f32 *) malloc(size * sizeof(f32));
+   m->rowmax = (f32 *) malloc((size_t) height * sizeof(f32));
+   m->pixels = (Color *) malloc(size * sizeof(Color));
+   AN(m->bins);
+   AN(m->density);
+   AN(m->rowmax);
+   AN(m->pixels);
+   cleardensitymap(m);
+   for (int i = 0; i < 256; i += 1)
+   {
+      f32 v = (f32) i / 255;
+      f32 dark = max(2 * v - 1, 0.0f);  // second half fades to black
+      m->ramp[i].r = (unsigned char) ((f32) color.r * (1 - dark));
+      m->ramp[i].g = (unsigned char) ((f32) color.g * (1 - dark));
+      m->ramp[i].b = (unsigned char) ((f32) color.b * (1 - dark));
+      m->ramp[i].a = (unsigned char) (255 * min(2 * v, 1.0f));
+   }
+}
+
+struct DensityJob
+{
+   DensityMap *m;
+   const f64 *x, *y;
+   int count;
+   f64 scale;          // bins per unit
+   f64 originx, originy;  // bin of the origin
+   f32 decay;
+   f32 lognorm;
+};
+
+static
+void binslices(void *ctx, int begin, int end)
+{
+   DensityJob *job = (DensityJob *) ctx;
+   DensityMap *m = job->m;
+   f64 width = m->width, height = m->height;
+   for (int slice = begin; slice < end; slice += 1)
+   {
+      u32 *bins = &m->bins[(size_t) slice * (size_t) m->width * (size_t) m->height];
+      i64 first = (i64) job->count * slice / m->numslices;
+      i64 last = (i64) job->count * (slice + 1) / m->numslices;
+      for (i64 i = first; i < last; i += 1)
+      {
+         f64 bx = job->x[i] * job->scale + job->originx;
+         f64 by = -job->y[i] * job->scale + job->originy;
+         // also false for NaN
+         if (!(bx >= 0 && bx < width && by >= 0 && by < height))
+            continue;
+         bins[(size_t) by * (size_t) m->width + (size_t) bx] += 1;
+      }
+   }
+}
+
+// density = decay * density + the bins of every slice, which are cleared
+static
+void reducerows(void *ctx, int begin, int end)
+{
+   DensityJob *job = (DensityJob *) ctx;
+   DensityMap *m = job->m;
+   size_t size = (size_t) m->width * (size_t) m->height;
+   for (int row = begin; row < end; row += 1)
+   {
+      size_t first = (size_t) row * (size_t) m->width;
+      f32 *density = &m->density[first];
+      for (int x = 0; x < m->width; x += 1)
+         density[x] *= job->decay;
+      for (int slice = 0; slice < m->numslices; slice += 1)
+      {
+         u32 *bins = &m->bins[(size_t) slice * size + first];
+         for (int x = 0; x < m->width; x += 1)
+         {
+            density[x] += (f32) bins[x];
+            bins[x] = 0;
+         }
+      }
+      f32 rowmax = 0;
+      for (int x = 0; x < m->width; x += 1)
+         rowmax = max(rowmax, density[x]);
+      m->rowmax[row] = rowmax;
+   }
+}
+
+// log scale, so thin regions stay visible next to the dense ones
+static
+void tonemaprows(void *ctx, int begin, int end)
+{
+   DensityJob *job = (DensityJob *) ctx;
+   DensityMap *m = job->m;
+   for (int row = begin; row < end; row += 1)
+   {
+      size_t first = (size_t) row * (size_t) m->width;
+      for (int x = 0; x < m->width; x += 1)
+      {
+         f32 v = log1pf(m->density[first + x]) * job->lognorm;
+         m->pixels[first + x] = m->ramp[(int) clampfloat(255 * v, 0, 255)];
+      }
+   }
+}
+
+// Adds the particles at (x, y) to the map after fading it by decay, and tone
+// maps it into pixels. A particle at (x, y) lands in bin
+// (x scale + originx, -y scale + originy).
+void updatedensitymap(DensityMap *m, const f64 *x, const f64 *y, int count, f64 scale, f64 originx, f64 originy,
+      f32 decay, ThreadPool *pool = NULL)
+{
+   DensityJob job = {m, x, y, count, scale, originx, originy, decay, 0};
+   parallelfor(pool, m->numslices, 1, binslices, &job);
+   parallelfor(pool, m->height, density_rowchunk, reducerows, &job);
+   f32 maxdensity = 0;
+   for (int row = 0; row < m->height; row += 1)
+      maxdensity = max(maxdensity, m->rowmax[row]);
+   m->maxdensity = maxdensity;
+   job.lognorm = maxdensity > 0 ? 1 / log1pf(maxdensity) : 0;
+   parallelfor(pool, m->height, density_rowchunk, tonemaprows, &job);
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <string.h>
+
+#include "useful_utils.cpp"
+
+// Small pull-based dependency graph for values derived from the ui state.
+//
+// An input node watches a piece of memory and bumps its version when the
+// bytes change. A derived node remembers the versions of its dependencies it
+// was last computed from; needsupdate() compares them and, if any differ,
+// tells the caller to recompute and bumps the node's own version, so derived
+// nodes can depend on other derived nodes. Dependencies have to be updated
+// before their dependents, which the getter functions do by calling each
+// other.
+
+#define max_cache_deps 4
+#define max_cache_snapshot 64
+#define max_cache_nodes 32
+
+struct CacheNode
+{
+   const char *name;
+   u32 version;
+   int numdeps;
+   CacheNode *deps[max_cache_deps];
+   u32 seen[max_cache_deps];
+   bool valid;
+   u64 hits;
+   u64 misses;
+
+   // inputs only
+   int snapshotsize;
+   u8 snapshot[max_cache_snapshot];
+};
+
+CacheNode *cachenodes[max_cache_nodes];
+int numcachenodes = 0;
+
+static inline
+void registercachenode(CacheNode *node, const char *name)
+{
+   assert(numcachenodes < max_cache_nodes);
+   memset(node, 0, sizeof(*node));
+   node->name = name;
+   cachenodes[numcachenodes++] = node;
+}
+
+void initcacheinput(CacheNode *node, const char *name, int size)
+{
+   assert(size <= max_cache_snapshot);
+   registercachenode(node, name);
+   node->snapshotsize = size;
+}
+
+template <typename... Deps>
+void initderived(CacheNode *node, const char *name, Deps... deps)
+{
+   CacheNode *list[] = {NULL, deps...};
+   int numdeps = arrlen(list) - 1;
+   assert(numdeps <= max_cache_deps);
+   registercachenode(node, name);
+   node->numdeps = numdeps;
+   for (int i = 0; i < numdeps; i += 1)
+      node->deps[i] = list[i + 1];
+}
+
+// compares the watched memory against the last snapshot
+void watchinput(CacheNode *node, const void *value)
+{
+   if (node->valid && memcmp(node->snapshot, value, node->snapshotsize) == 0)
+   {
+      node->hits += 1;
+      return;
+   }
+   memcpy(node->snapshot, value, node->snapshotsize);
+   node->valid = true;
+   node->version += 1;
+   node->misses += 1;
+}
+
+// true if any dependency changed since the last call that returned true; the
+// caller must then recompute the value
+bool needsupdate(CacheNode *node)
+{
+   bool stale = !node->valid;
+   for (int i = 0; i < node->numdeps; i += 1)
+      stale = stale || node->deps[i]->version != node->seen[i];
+
+   if (!stale)
+   {
+      node->hits += 1;
+      return false;
+   }
+   for (int i = 0; i < node->numdeps; i += 1)
+      node->seen[i] = node->deps[i]->version;
+   node->valid = true;
+   node->version += 1;
+   node->misses += 1;
+   return true;
+}
+
+void resetcachestats()
+{
+   for (int i = 0; i < numcachenodes; i += 1)
+   {
+      cachenodes[i]->hits = 0;
+      cachenodes[i]->misses = 0;
+   }
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "useful_utils.cpp"
+
+// The few primitives the scene is drawn with: batches of lines, batches of
+// triangles, text and images. The game draws them with raylib; the headless
+// runner and the benchmarks hand the same calls to the software rasterizer,
+// so they run the game's own drawing code without a GPU.
+
+// without raylib, e.g. in the headless runner, its plain types and the colors
+// the shared drawing code uses
+#ifndef RAYLIB_H
+struct Vector2
+{
+   float x, y;
+};
+
+struct Color
+{
+   unsigned char r, g, b, a;
+};
+
+#define CLITERAL(type) type
+#define BLACK CLITERAL(Color){0, 0, 0, 255}
+#define WHITE CLITERAL(Color){255, 255, 255, 255}
+#define BLANK CLITERAL(Color){0, 0, 0, 0}
+#define RAYWHITE CLITERAL(Color){245, 245, 245, 255}
+#define DARKGRAY CLITERAL(Color){80, 80, 80, 255}
+#define LIGHTGRAY CLITERAL(Color){200, 200, 200, 255}
+#define MAROON CLITERAL(Color){190, 33, 55, 255}
+#define GREEN CLITERAL(Color){0, 228, 48, 255}
+#define LIME CLITERAL(Color){0, 158, 47, 255}
+#define BLUE CLITERAL(Color){0, 121, 241, 255}
+#define SKYBLUE CLITERAL(Color){102, 191, 255, 255}
+#define DARKBLUE CLITERAL(Color){0, 82, 172, 255}
+#endif
+
+// an RGBA image for the software renderer, and the same image as a texture
+// for raylib
+struct BackendImage
+{
+   const u8 *rgba;
+   unsigned int texture;
+   int width, height;
+};
+
+struct DrawBackend
+{
+   void *ctx;
+   // verts[2k], verts[2k + 1] is a line, one color per vertex
+   void (*lines)(void *ctx, const Vector2 *verts, const Color *colors, int numverts, f32 thickness);
+   // verts[3k .. 3k + 2] is a triangle, one color per vertex
+   void (*triangles)(void *ctx, const Vector2 *verts, const Color *colors, int numverts);
+   void (*text)(void *ctx, const char *text, int x, int y, int size, Color color);
+   // top left corner at (x, y)
+   void (*image)(void *ctx, const BackendImage *image, int x, int y);
+};
+
+static inline
+void drawline(DrawBackend *b, Vector2 from, Vector2 to, f32 thickness, Color color)
+{
+   Vector2 verts[2] = {from, to};
+   Color colors[2] = {color, color};
+   b->lines(b->ctx, verts, colors, 2, thickness);
+}
+
+#ifdef RAYLIB_H
+
+#define backend_batch_verts (6 * 2048)
+
+static
+void rl_lines(void *ctx, const Vector2 *verts, const Color *colors, int numverts, f32 thickness)
+{
+   if (thickness > 1)
+   {
+      for (int k = 0; k + 1 < numverts; k += 2)
+         DrawLineEx(verts[k], verts[k + 1], thickness, colors[k]);
+      return;
+   }
+   for (int begin = 0; begin + 1 < numverts; begin += backend_batch_verts)
+   {
+      int end = min(begin + backend_batch_verts, numverts & ~1);
+      rlCheckRenderBatchLimit(end - begin);
+      rlBegin(RL_LINES);
+      for (int k = begin; k < end; k += 1)
+      {
+         rlColor4ub(colors[k].r, colors[k].g, colors[k].b, colors[k].a);
+         rlVertex2f(verts[k].x, verts[k].y);
+      }
+      rlEnd();
+   }
+}
+
+static
+void rl_triangles(void *ctx, const Vector2 *verts, const Color *colors, int numverts)
+{
+   // consecutive batches of the same mode end up in a single draw call
+   for (int begin = 0; begin + 2 < numverts; begin += backend_batch_verts)
+   {
+      int end = min(begin + backend_batch_verts, numverts - numverts % 3);
+      rlCheckRenderBatchLimit(end - begin);
+      rlBegin(RL_TRIANGLES);
+      for (int k = begin; k < end; k += 1)
+      {
+         rlColor4ub(colors[k].r, colors[k].g, colors[k].b, colors[k].a);
+         rlVertex2f(verts[k].x, verts[k].y);
+      }
+      rlEnd();
+   }
+}
+
+static
+void rl_text(void *ctx, const char *text, int x, int y, int size, Color color)
+{
+   DrawText(text, x, y, size, color);
+}
+
+static
+void rl_image(void *ctx, const BackendImage *image, int x, int y)
+{
+   Texture2D texture = {image->texture, image->width, image->height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+   DrawTexture(texture, x, y, WHITE);
+}
+
+DrawBackend raylibbackend = {NULL, rl_lines, rl_triangles, rl_text, rl_image};
+
+static inline
+BackendImage textureimage(Texture2D texture)
+{
+   BackendImage image = {NULL, texture.id, texture.width, texture.height};
+   return image;
+}
+
+#endif
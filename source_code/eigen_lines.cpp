@@ -0,0 +1,56 @@
+#pragma once
+
+#include "useful_utils.cpp"
+#include "linearalgebra.cpp"
+#include "view_transform.cpp"
+#include "draw_backend.cpp"
+
+// The lines through the origin along the eigenvectors of A, or along the real
+// and imaginary parts of one eigenvector when the eigenvalues are complex.
+// Green where the flow grows along the line, blue where it decays.
+
+struct EigenLines
+{
+   Vector2 start[2];
+   Vector2 end[2];
+   Color color[2];
+};
+
+static inline
+Vector2 topixelvector(const ViewTransform *vt, Vec2F64 x)
+{
+   Vec2F64 pixel = viewtopixel(vt, x);
+   return {(f32) pixel.elems[0], (f32) pixel.elems[1]};
+}
+
+void buildeigenlines(EigenLines *lines, Eigen *eigen, const ViewTransform *vt)
+{
+   bool eigvals_are_real = eigen->values[0].im == 0 && eigen->values[1].im == 0;
+   f64 lenscale = 1000;
+   Vec2F64 v1rl = {eigen->vectors[0][0].rl, eigen->vectors[0][1].rl};
+   Vec2F64 v2rl = {eigen->vectors[1][0].rl, eigen->vectors[1][1].rl};
+   Vec2F64 v1im = {eigen->vectors[0][0].im, eigen->vectors[0][1].im};
+   // for complex eigenvalues, the real and imaginary parts of one eigenvector
+   Vec2F64 second = eigvals_are_real ? v2rl : v1im;
+   lines->start[0] = topixelvector(vt, lenscale * v1rl);
+   lines->end[0] = topixelvector(vt, -lenscale * v1rl);
+   lines->start[1] = topixelvector(vt, lenscale * second);
+   lines->end[1] = topixelvector(vt, -lenscale * second);
+   if (eigvals_are_real)
+   {
+      lines->color[0] = eigen->values[0].rl > 0 ? GREEN : BLUE;
+      lines->color[1] = eigen->values[1].rl > 0 ? GREEN : BLUE;
+   }
+   else
+   {
+      lines->color[0] = eigen->values[0].rl > 0 ? LIME : SKYBLUE;
+      lines->color[1] = lines->color[0];
+   }
+}
+
+void draweigenlines(EigenLines *lines, DrawBackend *b)
+{
+   f32 thickness = 3;
+   for (int i = 0; i < 2; i += 1)
+      drawline(b, lines->start[i], lines->end[i], thickness, lines->color[i]);
+}
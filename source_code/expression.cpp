@@ -0,0 +1,556 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "useful_utils.cpp"
+#include "particles.cpp"
+
+// Compiles right-hand sides like "mu*(1 - x^2)*y - x" to a small register
+// bytecode and evaluates it over blocks of particles. Every register is a row
+// of vm_lanes values and every instruction loops over the whole row, so the
+// dispatch cost is paid once per instruction per block instead of once per
+// particle, and the loops are plain arrays the compiler can vectorize.
+//
+// Grammar, lowest precedence first:
+//    expr    = term (('+' | '-') term)*
+//    term    = unary (('*' | '/') unary)*
+//    unary   = '-' unary | power
+//    power   = primary ('^' unary)?
+//    primary = number | name | function '(' expr ')' | '(' expr ')'
+
+#define vm_lanes 64
+#define max_vm_regs 48
+#define max_vm_code 256
+#define max_expression_length 128
+
+enum OpCode
+{
+   OP_ADD,
+   OP_SUB,
+   OP_MUL,
+   OP_DIV,
+   OP_POW,
+   OP_NEG,
+   OP_SIN,
+   OP_COS,
+   OP_TAN,
+   OP_EXP,
+   OP_LOG,
+   OP_SQRT,
+   OP_ABS,
+   OP_TANH,
+};
+
+// named registers; x and y are per particle, the rest are the same for every
+// lane and filled once per run
+enum VmVar
+{
+   VM_X,
+   VM_Y,
+   VM_T,
+   VM_A,
+   VM_B,
+   VM_C,
+   VM_D,
+   VM_MU,
+   NUM_VM_VARS,
+};
+
+const char *vmvar_names[NUM_VM_VARS] = {"x", "y", "t", "a", "b", "c", "d", "mu"};
+#define num_vm_params (NUM_VM_VARS - VM_A)
+
+struct Instr
+{
+   u8 op;
+   u8 dst;
+   u8 a;
+   u8 b;
+};
+
+// registers: the variables, then the constants, then temporaries
+struct Program
+{
+   Instr code[max_vm_code];
+   int numcode;
+   f64 consts[max_vm_regs];
+   int numconsts;
+   int out[2];  // registers holding dx/dt and dy/dt
+   bool usest;
+
+   char error[96];
+};
+
+struct VmEnv
+{
+   f64 t;
+   f64 params[num_vm_params];
+};
+
+struct Parser
+{
+   const char *name;
+   const char *src;
+   const char *cur;
+   Program *prog;
+   int numtemps;
+   bool failed;
+};
+
+// a constant that has not been put in a register yet, so constant
+// subexpressions fold at compile time
+struct Operand
+{
+   bool isconst;
+   f64 value;
+   int reg;
+};
+
+static
+void parseerror(Parser *ps, const char *msg)
+{
+   if (ps->failed)
+      return;
+   ps->failed = true;
+   snprintf(ps->prog->error, sizeof(ps->prog->error), "%s: %s at column %d", ps->name, msg, (int) (ps->cur - ps->src) + 1);
+}
+
+static inline
+void skipspaces(Parser *ps)
+{
+   while (*ps->cur == ' ' || *ps->cur == '\t')
+      ps->cur += 1;
+}
+
+static
+int constreg(Parser *ps, f64 value)
+{
+   Program *prog = ps->prog;
+   for (int i = 0; i < prog->numconsts; i += 1)
+   {
+      if (prog->consts[i] == value)
+         return NUM_VM_VARS + i;
+   }
+   if (NUM_VM_VARS + prog->numconsts + ps->numtemps >= max_vm_regs)
+   {
+      parseerror(ps, "too many constants");
+      return 0;
+   }
+   prog->consts[prog->numconsts] = value;
+   prog->numconsts += 1;
+   return NUM_VM_VARS + prog->numconsts - 1;
+}
+
+static
+int toreg(Parser *ps, Operand x)
+{
+   return x.isconst ? constreg(ps, x.value) : x.reg;
+}
+
+// temporaries are numbered from the top of the register file down, so that
+// constants found later in the expression never collide with them
+static
+int pushtemp(Parser *ps)
+{
+   ps->numtemps += 1;
+   if (NUM_VM_VARS + ps->prog->numconsts + ps->numtemps > max_vm_regs)
+   {
+      parseerror(ps, "expression too deep");
+      return max_vm_regs - 1;
+   }
+   return max_vm_regs - ps->numtemps;
+}
+
+static
+void emit(Parser *ps, OpCode op, int dst, int a, int b)
+{
+   Program *prog = ps->prog;
+   if (prog->numcode == max_vm_code)
+   {
+      parseerror(ps, "expression too long");
+      return;
+   }
+   prog->code[prog->numcode++] = {(u8) op, (u8) dst, (u8) a, (u8) b};
+}
+
+static inline
+bool istemp(Parser *ps, int reg)
+{
+   return reg >= max_vm_regs - ps->numtemps;
+}
+
+static
+f64 applyop(OpCode op, f64 a, f64 b)
+{
+   switch (op)
+   {
+      case OP_ADD: return a + b;
+      case OP_SUB: return a - b;
+      case OP_MUL: return a * b;
+      case OP_DIV: return a / b;
+      case OP_POW: return pow(a, b);
+      case OP_NEG: return -a;
+      case OP_SIN: return sin(a);
+      case OP_COS: return cos(a);
+      case OP_TAN: return tan(a);
+      case OP_EXP: return exp(a);
+      case OP_LOG: return log(a);
+      case OP_SQRT: return sqrt(a);
+      case OP_ABS: return fabs(a);
+      case OP_TANH: return tanh(a);
+   }
+   return 0;
+}
+
+// The result reuses an operand's temporary. Temporaries are a stack and the
+// right operand was pushed last, so when both are temporaries the right one is
+// on top and can be popped; x*x passes the same one twice.
+static
+Operand binary(Parser *ps, OpCode op, Operand l, Operand r)
+{
+   if (l.isconst && r.isconst)
+      return {true, applyop(op, l.value, r.value), 0};
+   int a = toreg(ps, l);
+   int b = toreg(ps, r);
+   int dst;
+   if (istemp(ps, a))
+   {
+      dst = a;
+      if (istemp(ps, b) && b != a)
+         ps->numtemps -= 1;
+   }
+   else if (istemp(ps, b))
+      dst = b;
+   else
+      dst = pushtemp(ps);
+   emit(ps, op, dst, a, b);
+   return {false, 0, dst};
+}
+
+static
+Operand unary(Parser *ps, OpCode op, Operand x)
+{
+   if (x.isconst)
+      return {true, applyop(op, x.value, 0), 0};
+   int dst = istemp(ps, x.reg) ? x.reg : pushtemp(ps);
+   emit(ps, op, dst, x.reg, 0);
+   return {false, 0, dst};
+}
+
+static Operand parseexpr(Parser *ps);
+static Operand parseunary(Parser *ps);
+
+static
+Operand parseprimary(Parser *ps)
+{
+   skipspaces(ps);
+   const char *start = ps->cur;
+   if ((*start >= '0' && *start <= '9') || *start == '.')
+   {
+      char *end;
+      f64 value = strtod(start, &end);
+      ps->cur = end;
+      return {true, value, 0};
+   }
+   if (*start == '(')
+   {
+      ps->cur += 1;
+      Operand x = parseexpr(ps);
+      skipspaces(ps);
+      if (*ps->cur != ')')
+         parseerror(ps, "expected ')'");
+      else
+         ps->cur += 1;
+      return x;
+   }
+
+   while ((*ps->cur >= 'a' && *ps->cur <= 'z') || (*ps->cur >= 'A' && *ps->cur <= 'Z') || *ps->cur == '_')
+      ps->cur += 1;
+   int len = (int) (ps->cur - start);
+   if (len == 0)
+   {
+      parseerror(ps, *start ? "unexpected character" : "unexpected end");
+      return {true, 0, 0};
+   }
+
+   for (int v = 0; v < NUM_VM_VARS; v += 1)
+   {
+      if ((int) strlen(vmvar_names[v]) == len && strncmp(start, vmvar_names[v], len) == 0)
+      {
+         ps->prog->usest = ps->prog->usest || v == VM_T;
+         return {false, 0, v};
+      }
+   }
+   if (len == 2 && strncmp(start, "pi", 2) == 0)
+      return {true, 3.14159265358979323846, 0};
+
+   const char *names[] = {"sin", "cos", "tan", "exp", "log", "sqrt", "abs", "tanh"};
+   const OpCode ops[] = {OP_SIN, OP_COS, OP_TAN, OP_EXP, OP_LOG, OP_SQRT, OP_ABS, OP_TANH};
+   for (int f = 0; f < arrlen(names); f += 1)
+   {
+      if ((int) strlen(names[f]) != len || strncmp(start, names[f], len) != 0)
+         continue;
+      skipspaces(ps);
+      if (*ps->cur != '(')
+      {
+         parseerror(ps, "expected '(' after function");
+         return {true, 0, 0};
+      }
+      ps->cur += 1;
+      Operand arg = parseexpr(ps);
+      skipspaces(ps);
+      if (*ps->cur != ')')
+         parseerror(ps, "expected ')'");
+      else
+         ps->cur += 1;
+      return unary(ps, ops[f], arg);
+   }
+
+   ps->cur = start;
+   parseerror(ps, "unknown name");
+   ps->cur += len;
+   return {true, 0, 0};
+}
+
+static
+Operand parsepower(Parser *ps)
+{
+   Operand base = parseprimary(ps);
+   skipspaces(ps);
+   if (*ps->cur != '^')
+      return base;
+   ps->cur += 1;
+   Operand exponent = parseunary(ps);
+   // small integer powers are repeated multiplies
+   if (exponent.isconst && !base.isconst && (exponent.value == 2 || exponent.value == 3 || exponent.value == 4))
+   {
+      if (exponent.value == 3 && istemp(ps, base.reg))
+      {
+         // x^3 still needs x after squaring, so the square gets its own
+         // temporary
+         int b = base.reg;
+         int sq = pushtemp(ps);
+         emit(ps, OP_MUL, sq, b, b);
+         emit(ps, OP_MUL, b, sq, b);
+         ps->numtemps -= 1;
+         return {false, 0, b};
+      }
+      Operand square = binary(ps, OP_MUL, base, base);
+      if (exponent.value == 4)
+         return binary(ps, OP_MUL, square, square);
+      if (exponent.value == 3)
+         return binary(ps, OP_MUL, square, base);
+      return square;
+   }
+   return binary(ps, OP_POW, base, exponent);
+}
+
+static
+Operand parseunary(Parser *ps)
+{
+   skipspaces(ps);
+   if (*ps->cur == '-')
+   {
+      ps->cur += 1;
+      return unary(ps, OP_NEG, parseunary(ps));
+   }
+   if (*ps->cur == '+')
+      ps->cur += 1;
+   return parsepower(ps);
+}
+
+static
+Operand parseterm(Parser *ps)
+{
+   Operand x = parseunary(ps);
+   for (;;)
+   {
+      skipspaces(ps);
+      char c = *ps->cur;
+      if (c != '*' && c != '/')
+         return x;
+      ps->cur += 1;
+      x = binary(ps, c == '*' ? OP_MUL : OP_DIV, x, parseunary(ps));
+   }
+}
+
+static
+Operand parseexpr(Parser *ps)
+{
+   Operand x = parseterm(ps);
+   for (;;)
+   {
+      skipspaces(ps);
+      char c = *ps->cur;
+      if (c != '+' && c != '-')
+         return x;
+      ps->cur += 1;
+      x = binary(ps, c == '+' ? OP_ADD : OP_SUB, x, parseterm(ps));
+   }
+}
+
+// Compiles dx/dt = fx, dy/dt = fy. Returns false and sets prog->error if
+// either does not parse.
+bool compileprogram(Program *prog, const char *fx, const char *fy)
+{
+   memset(prog, 0, sizeof(*prog));
+   const char *srcs[2] = {fx, fy};
+   int reserved = 0;
+   for (int k = 0; k < 2; k += 1)
+   {
+      // the first result stays in its temporary while the second is parsed
+      Parser ps = {k == 0 ? "dx/dt" : "dy/dt", srcs[k], srcs[k], prog, reserved, false};
+      Operand result = parseexpr(&ps);
+      skipspaces(&ps);
+      if (!ps.failed && *ps.cur != '\0')
+         parseerror(&ps, "unexpected character");
+      if (ps.failed)
+      {
+         prog->numcode = 0;
+         return false;
+      }
+      prog->out[k] = toreg(&ps, result);
+      reserved = ps.numtemps;
+   }
+   return true;
+}
+
+// fills the registers that are the same for every lane
+static inline
+void loaduniforms(Program *prog, f64 (*regs)[vm_lanes], VmEnv *env)
+{
+   for (int l = 0; l < vm_lanes; l += 1)
+   {
+      regs[VM_T][l] = env->t;
+      for (int k = 0; k < num_vm_params; k += 1)
+         regs[VM_A + k][l] = env->params[k];
+      for (int k = 0; k < prog->numconsts; k += 1)
+         regs[NUM_VM_VARS + k][l] = prog->consts[k];
+   }
+}
+
+// runs the program on the first n lanes; x and y are in their registers
+static
+void runprogram(Program *prog, f64 (*regs)[vm_lanes], int n)
+{
+   for (int pc = 0; pc < prog->numcode; pc += 1)
+   {
+      Instr in = prog->code[pc];
+      f64 *d = regs[in.dst];
+      const f64 *a = regs[in.a];
+      const f64 *b = regs[in.b];
+      switch ((OpCode) in.op)
+      {
+         case OP_ADD: for (int l = 0; l < n; l += 1) d[l] = a[l] + b[l]; break;
+         case OP_SUB: for (int l = 0; l < n; l += 1) d[l] = a[l] - b[l]; break;
+         case OP_MUL: for (int l = 0; l < n; l += 1) d[l] = a[l] * b[l]; break;
+         case OP_DIV: for (int l = 0; l < n; l += 1) d[l] = a[l] / b[l]; break;
+         case OP_POW: for (int l = 0; l < n; l += 1) d[l] = pow(a[l], b[l]); break;
+         case OP_NEG: for (int l = 0; l < n; l += 1) d[l] = -a[l]; break;
+         case OP_SIN: for (int l = 0; l < n; l += 1) d[l] = sin(a[l]); break;
+         case OP_COS: for (int l = 0; l < n; l += 1) d[l] = cos(a[l]); break;
+         case OP_TAN: for (int l = 0; l < n; l += 1) d[l] = tan(a[l]); break;
+         case OP_EXP: for (int l = 0; l < n; l += 1) d[l] = exp(a[l]); break;
+         case OP_LOG: for (int l = 0; l < n; l += 1) d[l] = log(a[l]); break;
+         case OP_SQRT: for (int l = 0; l < n; l += 1) d[l] = sqrt(a[l]); break;
+         case OP_ABS: for (int l = 0; l < n; l += 1) d[l] = fabs(a[l]); break;
+         case OP_TANH: for (int l = 0; l < n; l += 1) d[l] = tanh(a[l]); break;
+      }
+   }
+}
+
+// f(x, y) at a single point, for the ui and for tests
+Vec2F64 evalprogram(Program *prog, VmEnv *env, Vec2F64 state)
+{
+   f64 regs[max_vm_regs][vm_lanes];
+   loaduniforms(prog, regs, env);
+   regs[VM_X][0] = state.elems[0];
+   regs[VM_Y][0] = state.elems[1];
+   runprogram(prog, regs, 1);
+   return {regs[prog->out[0]][0], regs[prog->out[1]][0]};
+}
+
+struct NonlinearJob
+{
+   Particles *p;
+   Program *prog;
+   VmEnv env;
+   f64 h;
+   const f64 *x, *y;
+   f64 *newx, *newy;
+};
+
+// classic RK4, one block of lanes at a time so the stages stay in L1
+static
+void nonlinearchunk(void *ctx, int begin, int end)
+{
+   NonlinearJob *job = (NonlinearJob *) ctx;
+   Program *prog = job->prog;
+   f64 h = job->h;
+   // offset of the next stage's input, and weight of each stage in the result
+   const f64 nextc[4] = {0.5 * h, 0.5 * h, h, 0};
+   const f64 stagew[4] = {h / 6, h / 3, h / 3, h / 6};
+
+   alignas(cacheline_size) f64 regs[max_vm_regs][vm_lanes];
+   alignas(cacheline_size) f64 accx[vm_lanes];
+   alignas(cacheline_size) f64 accy[vm_lanes];
+   VmEnv env = job->env;
+   loaduniforms(prog, regs, &env);
+
+   for (int block = begin; block < end; block += vm_lanes)
+   {
+      int n = min(vm_lanes, end - block);
+      const f64 *x0 = job->x + block;
+      const f64 *y0 = job->y + block;
+      f64 *rx = regs[VM_X];
+      f64 *ry = regs[VM_Y];
+      memcpy(accx, x0, (size_t) n * sizeof(f64));
+      memcpy(accy, y0, (size_t) n * sizeof(f64));
+      memcpy(rx, x0, (size_t) n * sizeof(f64));
+      memcpy(ry, y0, (size_t) n * sizeof(f64));
+      for (int s = 0; s < 4; s += 1)
+      {
+         if (prog->usest)
+         {
+            for (int l = 0; l < n; l += 1)
+               regs[VM_T][l] = env.t + (s == 0 ? 0 : nextc[s - 1]);
+         }
+         runprogram(prog, regs, n);
+         const f64 *kx = regs[prog->out[0]];
+         const f64 *ky = regs[prog->out[1]];
+         f64 w = stagew[s];
+         f64 c = nextc[s];
+         // k may be the x or y register itself (e.g. dx/dt = y), so each
+         // lane reads it before the next stage's input overwrites it
+         for (int l = 0; l < n; l += 1)
+         {
+            f64 kxl = kx[l];
+            f64 kyl = ky[l];
+            accx[l] += w * kxl;
+            accy[l] += w * kyl;
+            rx[l] = x0[l] + c * kxl;
+            ry[l] = y0[l] + c * kyl;
+         }
+      }
+      memcpy(job->newx + block, accx, (size_t) n * sizeof(f64));
+      memcpy(job->newy + block, accy, (size_t) n * sizeof(f64));
+   }
+}
+
+// one RK4 step of dx/dt = f(x, y, t) for every particle
+void stepnonlinear(Particles *p, Program *prog, VmEnv env, f64 h, ThreadPool *pool = NULL)
+{
+   NonlinearJob job;
+   job.p = p;
+   job.prog = prog;
+   job.env = env;
+   job.env.t = p->time;
+   job.h = h;
+   job.x = currentx(p);
+   job.y = currenty(p);
+   advancehistory(p);
+   job.newx = currentx(p);
+   job.newy = currenty(p);
+   parallelfor(pool, p->count, particle_chunk, nonlinearchunk, &job);
+   p->time += h;
+}
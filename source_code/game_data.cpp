@@ -3,7 +3,18 @@
 int framenumber = 0;
 f64 t = 0;
 f64 t_prevframe = 0;
-f64 dt = 0;
+f64 frame_dt = 0;
+
+// Fixed-step simulation clock. Frame time is accumulated and spent in whole
+// steps of dt, so the propagator stays the same from frame to frame and a
+// stall cannot turn into one huge step. Rendering interpolates by sim_alpha
+// between the last two simulated states.
+f64 sim_rate_hz = 120;
+f64 dt = 1 / sim_rate_hz;
+int max_catchup_steps = 8;
+f64 sim_accumulator = 0;
+int sim_steps = 0;    // fixed steps to take this frame
+f64 sim_alpha = 0;    // how far the frame time is past the last step, in steps
 f64 drawtime_ms = 0;
 
 // UI related
@@ -13,3 +24,19 @@ bool pausewasclicked = false;
 bool resumewasclicked = false;
 
 Texture2D equation_texture;
+
+static inline
+void advanceclock(f64 elapsed)
+{
+   dt = 1 / sim_rate_hz;
+   sim_accumulator += elapsed;
+   sim_steps = (int) (sim_accumulator / dt);
+   if (sim_steps > max_catchup_steps)
+   {
+      // drop the backlog instead of trying to catch up after a stall
+      sim_steps = max_catchup_steps;
+      sim_accumulator = sim_steps * dt;
+   }
+   sim_accumulator -= sim_steps * dt;
+   sim_alpha = sim_accumulator / dt;
+}
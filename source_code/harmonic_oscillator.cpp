@@ -2,8 +2,21 @@
 
 #include "trajectories.cpp"
 
+CacheNode cache_oscA;
+CacheNode cache_osceigen;
+CacheNode cache_oscpropagator;
+
 void gameloop_oscillator()
 {
+   static bool cacheinitialized = false;
+   if (!cacheinitialized)
+   {
+      initcacheinput(&cache_oscA, "oscillator A", sizeof(Mat2x2F64));
+      initderived(&cache_osceigen, "oscillator eigen", &cache_oscA);
+      initderived(&cache_oscpropagator, "oscillator propagator", &cache_oscA, &cache_dt);
+      cacheinitialized = true;
+   }
+
    drawcoordaxes();
 
    DrawText(TextFormat("Frame time: %02.02f ms", drawtime_ms), 10, 50, 20, DARKGRAY);
@@ -54,8 +67,19 @@ void gameloop_oscillator()
    }
 
    Mat2x2F64 A = {0, (f64) -k_springconstant / (f64)boxMass_kg, 1, (f64) -k_friction / (f64)boxMass_kg};
-   Eigen eigen = decomposition(A);
-   Vec2F64 newstate = matvecmul(expm(dt * A), currentstate);
+   watchinput(&cache_oscA, &A);
+   watchinput(&cache_dt, &dt);
+   static Eigen eigen;
+   static Mat2x2F64 propagator;
+   if (needsupdate(&cache_osceigen))
+      eigen = decomposition(A);
+   if (needsupdate(&cache_oscpropagator))
+      propagator = expm_closedform(dt * A);
+
+   // the box advances by this frame's whole number of fixed steps
+   Vec2F64 newstate = currentstate;
+   for (int s = 0; s < sim_steps; s += 1)
+      newstate = matvecmul(propagator, newstate);
 
    ImGui::Text("A:[%f %f\n%f %f]", A.elems[0], A.elems[2], A.elems[1], A.elems[3]);
    ImGui::Text("eigenvalues:\n%f + %f i,\n%f + %f i\n",
@@ -67,34 +91,12 @@ void gameloop_oscillator()
          eigen.vectors[1][0].rl, eigen.vectors[1][0].im,
          eigen.vectors[1][1].rl, eigen.vectors[1][1].im);
 
-   time_since_last_spawn += dt;
-   while (time_since_last_spawn > spawn_period)
-   {
-      Vec2F64 newcoords = randomcoord();
-      initTrajectory(&trajectories[newtrajidx]);
-      addstate(currentstates, newtrajidx, newcoords);
-      newtrajidx = (newtrajidx + 1) % numtrajectories;
-
-      time_since_last_spawn -= spawn_period;
-   }
-
-   step(A);
+   simulate(A, true);
 
+   findrecyclable();
    { ZoneScopedN("draw trajectories");
-   for (int i = 0; i < numtrajectories; i++)
-   {
-      Trajectory trajectory = trajectories[i];
-
-      Vector2 points[histcapacity];
-      for (int i = 0; i < trajectory.size; i += 1)
-      {
-         points[i] = coords2pixels(getRecentPos(trajectory, i));
-      }
-      for (int i = 0; i < trajectory.size - 1; i += 1)
-      {
-         DrawLineEx(points[i], points[i + 1], 1, LIGHTGRAY);
-      }
-   }
+   updatetrailpixels(sim_alpha, {1, 0, 0, LIGHTGRAY});
+   drawtrails();
    }
 
    // draw box
@@ -159,7 +161,7 @@ void gameloop_oscillator()
    {
       currentstate = newstate;
       disp_m = (f32) newstate.elems[0];
-      t += dt;
+      t += sim_steps * dt;
 
       pausewasclicked = ImGui::Button("pause");
       if (pausewasclicked || (IsKeyPressed(KEY_SPACE) && !io.WantCaptureKeyboard))
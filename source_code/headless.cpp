@@ -0,0 +1,394 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "useful_utils.cpp"
+#include "linearalgebra.cpp"
+#include "threadpool.cpp"
+#include "particles.cpp"
+#include "trajectory_file.cpp"
+#include "software_raster.cpp"
+#include "view_transform.cpp"
+#include "axes_layer.cpp"
+#include "quiver.cpp"
+#include "trail_mesh.cpp"
+#include "eigen_lines.cpp"
+#include "../assets/xdoteqAx.c"
+
+// Runs dx/dt = A x + B u on a cloud of particles without a window and streams
+// the states to disk. Uses the same propagator and kernels as the game, so a
+// run here steps exactly like the game's linear dynamical system does.
+// With --render the frames are also drawn by the software rasterizer, with
+// the game's own drawing code for the axes, direction field, trails,
+// eigenvector lines and equation of its linear mode.
+
+struct HeadlessOptions
+{
+   Mat2x2F64 A;
+   Mat2x2F64 B;
+   Vec2F64 u;
+   f64 dt;
+   f64 duration;
+   f64 box;
+   int count;
+   int every;
+   int numthreads;
+   SampleMode sampling;
+   u64 seed;
+   const char *binpath;
+   const char *csvpath;
+   const char *npypath;
+   const char *renderdir;
+   bool ppm;
+   int width, height;
+   int pixelsperunit;
+   int traillength;
+};
+
+static
+void printusage(const char *program)
+{
+   printf("usage: %s [options]\n"
+         "   --A a11,a12,a21,a22   dynamics matrix, row by row (default 0,1,-1,-0.2)\n"
+         "   --B b11,b12,b21,b22   input matrix (default identity)\n"
+         "   --u u1,u2             constant input (default 0,0)\n"
+         "   --dt DT               step size (default 1/60)\n"
+         "   --duration T          simulated time (default 10)\n"
+         "   --particles N         number of particles (default 10000)\n"
+         "   --box L               initial states are uniform in [-L, L]^2 (default 20)\n"
+         "   --seed S              random seed for the initial states (default 1)\n"
+         "   --sampling MODE       initial states from random, halton or sobol points (default random)\n"
+         "   --every K             save every K-th step (default 1)\n"
+         "   --threads N           worker threads (default: all cores)\n"
+         "   --out FILE            binary trajectory file\n"
+         "   --csv FILE            also write CSV\n"
+         "   --npy FILE            also write a NumPy array of shape (frames, 2, N)\n"
+         "   --render DIR          draw the saved frames on the CPU into DIR/frame_NNNNN.png\n"
+         "   --format png|ppm      image format for --render (default png)\n"
+         "   --size WxH            frame size in pixels (default 800x600)\n"
+         "   --scale P             pixels per unit (default 20)\n"
+         "   --trail N             trail length in steps, with --render (default 16)\n"
+         "Without any output file only the throughput is reported.\n",
+         program);
+}
+
+static
+bool parsematrix(const char *s, Mat2x2F64 *M)
+{
+   f64 a11, a12, a21, a22;
+   if (sscanf(s, "%lf,%lf,%lf,%lf", &a11, &a12, &a21, &a22) != 4)
+      return false;
+   *M = {a11, a21, a12, a22};
+   return true;
+}
+
+static
+bool parsevector(const char *s, Vec2F64 *v)
+{
+   f64 v1, v2;
+   if (sscanf(s, "%lf,%lf", &v1, &v2) != 2)
+      return false;
+   *v = {v1, v2};
+   return true;
+}
+
+static
+bool parseoptions(HeadlessOptions *o, int argc, char **argv)
+{
+   for (int i = 1; i < argc; i += 1)
+   {
+      if (i + 1 >= argc)
+         return false;
+      const char *arg = argv[i];
+      const char *val = argv[++i];
+      if (strcmp(arg, "--A") == 0)
+      {
+         if (!parsematrix(val, &o->A))
+            return false;
+      }
+      else if (strcmp(arg, "--B") == 0)
+      {
+         if (!parsematrix(val, &o->B))
+            return false;
+      }
+      else if (strcmp(arg, "--u") == 0)
+      {
+         if (!parsevector(val, &o->u))
+            return false;
+      }
+      else if (strcmp(arg, "--dt") == 0)
+         o->dt = atof(val);
+      else if (strcmp(arg, "--duration") == 0)
+         o->duration = atof(val);
+      else if (strcmp(arg, "--box") == 0)
+         o->box = atof(val);
+      else if (strcmp(arg, "--particles") == 0)
+         o->count = atoi(val);
+      else if (strcmp(arg, "--seed") == 0)
+         o->seed = strtoull(val, NULL, 10);
+      else if (strcmp(arg, "--sampling") == 0)
+      {
+         if (strcmp(val, "random") == 0)
+            o->sampling = SAMPLE_RANDOM;
+         else if (strcmp(val, "halton") == 0)
+            o->sampling = SAMPLE_HALTON;
+         else if (strcmp(val, "sobol") == 0)
+            o->sampling = SAMPLE_SOBOL;
+         else
+            return false;
+      }
+      else if (strcmp(arg, "--every") == 0)
+         o->every = atoi(val);
+      else if (strcmp(arg, "--threads") == 0)
+         o->numthreads = atoi(val);
+      else if (strcmp(arg, "--out") == 0)
+         o->binpath = val;
+      else if (strcmp(arg, "--csv") == 0)
+         o->csvpath = val;
+      else if (strcmp(arg, "--npy") == 0)
+         o->npypath = val;
+      else if (strcmp(arg, "--render") == 0)
+         o->renderdir = val;
+      else if (strcmp(arg, "--format") == 0)
+      {
+         if (strcmp(val, "png") != 0 && strcmp(val, "ppm") != 0)
+            return false;
+         o->ppm = strcmp(val, "ppm") == 0;
+      }
+      else if (strcmp(arg, "--size") == 0)
+      {
+         if (sscanf(val, "%dx%d", &o->width, &o->height) != 2)
+            return false;
+      }
+      else if (strcmp(arg, "--scale") == 0)
+         o->pixelsperunit = atoi(val);
+      else if (strcmp(arg, "--trail") == 0)
+         o->traillength = atoi(val);
+      else
+         return false;
+   }
+   return o->dt > 0 && o->duration >= 0 && o->count > 0 && o->every > 0 && o->numthreads > 0
+      && o->width > 0 && o->height > 0 && o->pixelsperunit > 0 && o->traillength >= 3;
+}
+
+#define headless_quiver_spacing 32
+
+struct FrameRender
+{
+   SoftRenderer soft;
+   DrawBackend backend;
+   ViewTransform view;
+   AxesKey axes;
+   Quiver quiver;
+   EigenLines eigenlines;
+   TrailMesh trails;
+   Vector2 *trailpoints;
+   BackendImage equation;
+   const char *dir;
+   bool ppm;
+   u32 numframes;
+   f64 rastertime;
+   f64 encodetime;
+};
+
+// the parts of the frame that only depend on A and the view
+static
+void initframerender(FrameRender *fr, HeadlessOptions *o, Particles *p)
+{
+   *fr = {};
+   initsoftrenderer(&fr->soft, o->width, o->height);
+   fr->backend = softbackend(&fr->soft);
+   fr->view = makeviewtransform(o->pixelsperunit, o->width, o->height);
+   fr->axes = makeaxeskey(AXES_2D, o->pixelsperunit, o->width, o->height, BLACK);
+   buildquiver(&fr->quiver, o->A, &fr->view, o->width, o->height, headless_quiver_spacing, DARKBLUE);
+   Eigen eigen = decomposition(o->A);
+   buildeigenlines(&fr->eigenlines, &eigen, &fr->view);
+   fr->trailpoints = (Vector2 *) malloc((size_t) p->count * (size_t) p->histcapacity * sizeof(Vector2));
+   AN(fr->trailpoints);
+   fr->equation = {&xdoteqAx[0][0], 0, arrlen(xdoteqAx[0]) / 4, arrlen(xdoteqAx)};
+   fr->dir = o->renderdir;
+   fr->ppm = o->ppm;
+}
+
+static
+void freeframerender(FrameRender *fr)
+{
+   freesoftrenderer(&fr->soft);
+   freequiver(&fr->quiver);
+   freetrailmesh(&fr->trails);
+   free(fr->trailpoints);
+   *fr = {};
+}
+
+// the game's linear mode, in the order it draws it; the frames fall on steps,
+// so the trails are not interpolated
+static
+void drawsoftframe(FrameRender *fr, Particles *p, ThreadPool *pool)
+{
+   DrawBackend *b = &fr->backend;
+   softclear(&fr->soft, torgba8(RAYWHITE));
+   drawaxesimmediate(&fr->axes, b);
+   drawquiver(&fr->quiver, b);
+   buildtrails(&fr->trails, p, &fr->view, 1, fr->trailpoints, NULL, default_trailstyle, pool);
+   drawtrailmesh(&fr->trails, b);
+   draweigenlines(&fr->eigenlines, b);
+   b->image(b->ctx, &fr->equation, 250, 30);
+}
+
+static
+bool renderframe(FrameRender *fr, Particles *p, ThreadPool *pool)
+{
+   f64 t0 = gettime_s();
+   drawsoftframe(fr, p, pool);
+   softrender(&fr->soft, pool);
+   f64 t1 = gettime_s();
+   fr->rastertime += t1 - t0;
+
+   char path[1024];
+   snprintf(path, sizeof(path), "%s/frame_%05u.%s", fr->dir, fr->numframes, fr->ppm ? "ppm" : "png");
+   fr->numframes += 1;
+   FILE *f = fopen(path, "wb");
+   if (!f)
+   {
+      fprintf(stderr, "could not open '%s' for writing\n", path);
+      return false;
+   }
+   bool ok = fr->ppm ? writeppm(&fr->soft, f) : writepng(&fr->soft, f);
+   ok = fclose(f) == 0 && ok;
+   fr->encodetime += gettime_s() - t1;
+   return ok;
+}
+
+static
+FILE *openoutput(const char *path)
+{
+   if (!path)
+      return NULL;
+   FILE *f = fopen(path, "wb");
+   if (!f)
+      fprintf(stderr, "could not open '%s' for writing\n", path);
+   return f;
+}
+
+int main(int argc, char **argv)
+{
+   HeadlessOptions o;
+   o.A = {0, -1, 1, -0.2};
+   o.B = Identity2x2();
+   o.u = {0, 0};
+   o.dt = 1 / 60.0;
+   o.duration = 10;
+   o.box = 20;
+   o.count = 10000;
+   o.every = 1;
+   o.numthreads = hardwarethreads();
+   o.sampling = SAMPLE_RANDOM;
+   o.seed = 1;
+   o.binpath = NULL;
+   o.csvpath = NULL;
+   o.npypath = NULL;
+   o.renderdir = NULL;
+   o.ppm = false;
+   o.width = 800;
+   o.height = 600;
+   o.pixelsperunit = 20;
+   o.traillength = 16;
+   if (!parseoptions(&o, argc, argv))
+   {
+      printusage(argv[0]);
+      return 1;
+   }
+
+   u64 numsteps = (u64) llround(o.duration / o.dt);
+   u64 numframes = numsteps / (u64) o.every + 1;
+   if (numframes > UINT32_MAX)
+   {
+      fprintf(stderr, "too many frames (%llu), raise --every\n", (unsigned long long) numframes);
+      return 1;
+   }
+
+   FILE *bin = openoutput(o.binpath);
+   FILE *csv = openoutput(o.csvpath);
+   FILE *npy = openoutput(o.npypath);
+   if ((o.binpath && !bin) || (o.csvpath && !csv) || (o.npypath && !npy))
+      return 1;
+   bool rendering = o.renderdir != NULL;
+   bool saving = bin || csv || npy || rendering;
+
+   ThreadPool pool;
+   initthreadpool(&pool, o.numthreads);
+   Particles p;
+   initparticles(&p, o.count, rendering ? o.traillength : 2);
+   Sampler sampler;
+   initsampler(&sampler, o.sampling, o.seed);
+   spawnsampled(&p, 0, {-o.box, -o.box}, {o.box, o.box}, &sampler, &pool);
+
+   Discretized d = discretize(o.A, o.B, o.dt);
+   Vec2F64 b = matvecmul(d.N, o.u);
+
+   TrajectoryWriter writer;
+   TrajectoryHeader header = maketrajectoryheader(o.count, (u32) numframes, o.dt, o.every * o.dt,
+         o.A, o.B, o.u, o.seed);
+   inittrajectorywriter(&writer, bin, csv, npy, header);
+
+   FrameRender render = {};
+   if (rendering)
+      initframerender(&render, &o, &p);
+
+   bool ok = true;
+   f64 steptime = 0;
+   f64 writetime = 0;
+   if (saving)
+   {
+      writeframe(&writer, p.time, currentx(&p), currenty(&p));
+      if (rendering)
+         ok = renderframe(&render, &p, &pool);
+   }
+   for (u64 s = 1; s <= numsteps; s += 1)
+   {
+      f64 t0 = gettime_s();
+      propagateparticles(&p, d.M, b, &pool);
+      p.time = (f64) s * o.dt;
+      f64 t1 = gettime_s();
+      steptime += t1 - t0;
+      if (saving && s % (u64) o.every == 0)
+      {
+         writeframe(&writer, p.time, currentx(&p), currenty(&p));
+         if (rendering && ok)
+            ok = renderframe(&render, &p, &pool);
+         writetime += gettime_s() - t1;
+      }
+   }
+
+   ok = finishtrajectorywriter(&writer) && ok;
+   if (bin)
+      ok = fclose(bin) == 0 && ok;
+   if (csv)
+      ok = fclose(csv) == 0 && ok;
+   if (npy)
+      ok = fclose(npy) == 0 && ok;
+
+   f64 particlesteps = (f64) numsteps * (f64) o.count;
+   fprintf(stderr, "%d particles, %llu steps, %u frames, %d threads\n",
+         o.count, (unsigned long long) numsteps, writer.framesdone, pool.numthreads);
+   fprintf(stderr, "step: %.3f s, %.1f Mparticle-steps/s\n",
+         steptime, steptime > 0 ? 1e-6 * particlesteps / steptime : 0.0);
+   if (saving)
+      fprintf(stderr, "write: %.3f s\n", writetime);
+   if (rendering)
+   {
+      f64 n = max((f64) render.numframes, 1.0);
+      fprintf(stderr, "render: %u frames of %dx%d, raster %.2f ms/frame, encode %.2f ms/frame\n",
+            render.numframes, o.width, o.height, 1e3 * render.rastertime / n, 1e3 * render.encodetime / n);
+      freeframerender(&render);
+   }
+
+   freeparticles(&p);
+   freethreadpool(&pool);
+   if (!ok)
+   {
+      fprintf(stderr, "writing the output failed\n");
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "trajectories.cpp"
+#include "time_varying.cpp"
+#include "adaptive.cpp"
+
+// Hill's equation x'' + f(t) x = 0 with a periodic f, written as dx/dt = A(t) x
+// with A(t) = [0 1; -f(t) 0]. Mathieu's equation has f(t) = a - 2q cos(2t);
+// Meissner's equation replaces the cosine by a square wave, which comes from a
+// table. Depending on a and q the trajectories stay bounded or blow up
+// (parametric resonance).
+
+enum HillKind
+{
+   HILL_MATHIEU,
+   HILL_MEISSNER,
+};
+
+struct HillParams
+{
+   f64 a;
+   f64 q;
+};
+
+constexpr f64 hill_period = 3.14159265358979323846;  // of cos(2t)
+
+HillKind hillkind = HILL_MATHIEU;
+Integrator hillintegrator = INTEGRATOR_RK4;
+HillParams hillparams = {1, 0.2};
+MatrixTable meissnertable;
+
+static inline
+Mat2x2F64 hillmatrix(f64 f)
+{
+   return {0, -f, 1, 0};
+}
+
+Mat2x2F64 mathieu(void *ctx, f64 t)
+{
+   HillParams *params = (HillParams *) ctx;
+   return hillmatrix(params->a - 2 * params->q * cos(2 * t));
+}
+
+void buildmeissnertable(MatrixTable *table, HillParams params)
+{
+   table->count = 0;
+   table->period = hill_period;
+   addknot(table, 0, hillmatrix(params.a + 2 * params.q));
+   addknot(table, 0.5 * hill_period, hillmatrix(params.a + 2 * params.q));
+   addknot(table, 0.5 * hill_period, hillmatrix(params.a - 2 * params.q));
+   addknot(table, hill_period, hillmatrix(params.a - 2 * params.q));
+}
+
+void gameloop_hill()
+{
+   MatrixFn Afn = mathieu;
+   void *ctx = &hillparams;
+   if (hillkind == HILL_MEISSNER)
+   {
+      buildmeissnertable(&meissnertable, hillparams);
+      Afn = evaltable;
+      ctx = &meissnertable;
+   }
+
+   if (!paused)
+   {
+      f64 t_stepstart = GetTime();
+      for (int s = 0; s < sim_steps; s += 1)
+      {
+         if (spawn_new_trajectories)
+            spawnovertime(dt);
+         if (hillintegrator == INTEGRATOR_DOPRI)
+         {
+            MatrixRhs rhs = {Afn, ctx};
+            stepadaptive(&adaptivesolver, &particles, matrixrhs, &rhs, dt, &threadpool);
+         }
+         else
+            stepmagnus(&particles, Afn, ctx, dt, &threadpool);
+         foreignsteps += 1;
+      }
+      steptime_ms = (GetTime() - t_stepstart) * 1000;
+   }
+
+   drawcoordaxes();
+
+   DrawText(TextFormat("Frame time: %02.02f ms", drawtime_ms), 10, 50, 20, DARKGRAY);
+   DrawText(TextFormat("t = %f", particles.time), 10, 30, 20, DARKGRAY);
+
+   findrecyclable();
+   { ZoneScopedN("draw trajectories");
+   updatetrailpixels(paused ? 1 : sim_alpha, default_trailstyle);
+   drawtrails();
+   }
+
+   ImGui::Begin("Hill's equation");
+   ImGuiIO& io = ImGui::GetIO();
+   if (ImGui::Button("reset"))
+      resetstates(&particles);
+   ImGui::SameLine();
+   if (paused)
+   {
+      DrawText("Paused", screenwidth - 100, 20, 20, DARKGRAY);
+      if (ImGui::Button("resume") || (IsKeyPressed(KEY_SPACE) && !io.WantCaptureKeyboard))
+         paused = false;
+   }
+   else
+   {
+      if (ImGui::Button("pause") || (IsKeyPressed(KEY_SPACE) && !io.WantCaptureKeyboard))
+         paused = true;
+   }
+   ImGui::Checkbox("spawn new trajectories", &spawn_new_trajectories);
+
+   int kind = hillkind;
+   ImGui::RadioButton("Mathieu", &kind, HILL_MATHIEU);
+   ImGui::SameLine();
+   ImGui::RadioButton("Meissner (square wave table)", &kind, HILL_MEISSNER);
+   bool changed = kind != hillkind;
+   hillkind = (HillKind) kind;
+
+   f32 a = (f32) hillparams.a;
+   f32 q = (f32) hillparams.q;
+   changed = ImGui::SliderFloat("a", &a, -2, 10) || changed;
+   changed = ImGui::SliderFloat("q", &q, 0, 5) || changed;
+   hillparams.a = (f64) a;
+   hillparams.q = (f64) q;
+   if (changed)
+      invalidateadaptive(&adaptivesolver);
+
+   Mat2x2F64 At = Afn(ctx, particles.time);
+   ImGui::Text("A(t) = [%6.3f %6.3f\n        %6.3f %6.3f]", At.elems[0], At.elems[2], At.elems[1], At.elems[3]);
+   adaptivecontrols(&hillintegrator, &adaptivesolver);
+   ImGui::Text("step: %.3f ms (%s)", steptime_ms, hillintegrator == INTEGRATOR_DOPRI ? "Dormand-Prince" : "4th order Magnus");
+   trajectorysizecontrols();
+   recyclecontrols();
+   ImGui::End();
+}
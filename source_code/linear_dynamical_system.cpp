@@ -5,61 +5,70 @@
 Mat2x2F64 B;
 Vec2F64 u_input;
 
-void step_with_control_input(Mat2x2F64 A, Mat2x2F64 B)
+CacheNode cache_B;
+CacheNode cache_uinput;
+CacheNode cache_inputpropagator;  // blocks of exp(dt * [A B; 0 0])
+CacheNode cache_inputupdate;      // input block applied to u
+
+Mat2x2F64 cached_dynamicsupdate;
+Mat2x2F64 cached_inputupdatematrix;
+Vec2F64 cached_inputupdate;
+
+// takes this frame's fixed steps; the 4x4 exponential only depends on A, B and
+// dt, so it is only recomputed when one of them changes
+void step_with_control_input(Mat2x2F64 A, Mat2x2F64 B, bool spawn)
 {
-   // The upper left block of the matrix exponential of the block matrix
-   //      A B
-   //      0 0
-   // is equal to the matrix exponential of A.
-   // https://math.stackexchange.com/questions/658276/integral-of-matrix-exponential/4105683#4105683
-   Mat4x4F64 Atilde = BlockMatrix(
-         A,       B,
-         Zero2x2(), Identity2x2()
-   );
-   Mat4x4F64 exp_dtAtilde = expm(dt * Atilde);
-   Mat2x2F64 dynamicsUpdateMatrix = getUpperLeftBlock(exp_dtAtilde);
-   Mat2x2F64 inputUpdateMatrix = getUpperRightBlock(exp_dtAtilde);
-
-   for (int i = 0; i < numtrajectories; i += 1)
+   static bool cacheinitialized = false;
+   if (!cacheinitialized)
    {
-      Vec2F64 newstate = matvecmul(dynamicsUpdateMatrix, currentstates[i]);
-      newstate = newstate + matvecmul(inputUpdateMatrix, u_input);
+      initcacheinput(&cache_B, "B", sizeof(Mat2x2F64));
+      initcacheinput(&cache_uinput, "u", sizeof(Vec2F64));
+      initderived(&cache_inputpropagator, "input propagator", &cache_stepA, &cache_B, &cache_dt);
+      initderived(&cache_inputupdate, "input update", &cache_inputpropagator, &cache_uinput);
+      cacheinitialized = true;
+   }
+   watchinput(&cache_stepA, &A);
+   watchinput(&cache_B, &B);
+   watchinput(&cache_uinput, &u_input);
+   watchinput(&cache_dt, &dt);
+
+   if (needsupdate(&cache_inputpropagator))
+   {
+      Discretized d = discretize(A, B, dt);
+      cached_dynamicsupdate = d.M;
+      cached_inputupdatematrix = d.N;
+   }
+   if (needsupdate(&cache_inputupdate))
+      cached_inputupdate = matvecmul(cached_inputupdatematrix, u_input);
 
-      updateposition(&trajectories[i], newstate);
-      currentstates[i] = newstate;
+   for (int s = 0; s < sim_steps; s += 1)
+   {
+      if (spawn)
+         spawnovertime(dt);
+      propagateparticles(&particles, cached_dynamicsupdate, cached_inputupdate, &threadpool);
+      particles.time += dt;
+      foreignsteps += 1;
    }
 }
 
 void gameloop_lineardynamicalsystem()
 {
+   watchframeinputs();
+
    ImGuiIO& io = ImGui::GetIO();
-   if (IsMouseButtonDown(MOUSE_BUTTON_LEFT) && !io.WantCaptureMouse)
+   bool mousespawning = IsMouseButtonDown(MOUSE_BUTTON_LEFT) && !io.WantCaptureMouse;
+   if (mousespawning)
    {
       Vec2F64 newcoords = pixels2coords(GetMousePosition());
-      initTrajectory(&trajectories[newtrajidx]);
-      addstate(currentstates, newtrajidx, newcoords);
-      newtrajidx = (newtrajidx + 1) % numtrajectories;
+      spawnparticle(&particles, newtrajidx, newcoords);
+      newtrajidx = (newtrajidx + 1) % particles.count;
 
       time_since_last_spawn = 0;
    }
-   else if (!paused && spawn_new_trajectories)
-   {
-      time_since_last_spawn += dt;
-
-      while (time_since_last_spawn > spawn_period)
-      {
-         Vec2F64 newcoords = randomcoord();
-         initTrajectory(&trajectories[newtrajidx]);
-         addstate(currentstates, newtrajidx, newcoords);
-         newtrajidx = (newtrajidx + 1) % numtrajectories;
-
-         time_since_last_spawn -= spawn_period;
-      }
-   }
 
    if (!paused)
    {
-      step_with_control_input(A, B);
+      step_with_control_input(A, B, spawn_new_trajectories && !mousespawning);
    }
 
    drawcoordaxes();
@@ -67,23 +76,13 @@ void gameloop_lineardynamicalsystem()
    DrawText(TextFormat("Frame time: %02.02f ms", drawtime_ms), 10, 50, 20, DARKGRAY);
    DrawText(TextFormat("t = %f", t), 10, 30, 20, DARKGRAY);
 
+   findrecyclable();
    { ZoneScopedN("draw trajectories");
-   for (int i = 0; i < numtrajectories; i++)
-   {
-      Trajectory trajectory = trajectories[i];
-      Vector2 points[histcapacity];
-      for (int i = 0; i < trajectory.size; i += 1)
-      {
-         points[i] = coords2pixels(getRecentPos(trajectory, i));
-      }
-      for (int i = 0; i < trajectory.size - 1; i += 1)
-      {
-         DrawLineEx(points[i], points[i + 1], 2, MAROON);
-      }
-   }
+   updatetrailpixels(paused ? 1 : sim_alpha, {2, 0, 0.6f, MAROON});
+   drawtrails();
    }
 
-   Eigen eigen = decomposition(A);
+   Eigen eigen = *geteigen();
 
    // draw the real parts of the eigenvectors
    if (show_eigenvectors)
@@ -121,9 +120,7 @@ void gameloop_lineardynamicalsystem()
    {
       t = 0;
 
-      resetstates((f64 *)currentstates);
-      for (int i = 0; i < numtrajectories; i++)
-         initTrajectory(&trajectories[i]);
+      resetstates(&particles);
    }
 
    if (paused)
@@ -135,7 +132,7 @@ void gameloop_lineardynamicalsystem()
    }
    else
    {
-      t += dt;
+      t += sim_steps * dt;
 
       pausewasclicked = ImGui::Button("pause");
       if (pausewasclicked || (IsKeyPressed(KEY_SPACE) && !io.WantCaptureKeyboard))
@@ -4,23 +4,78 @@
 
 #include "useful_utils.cpp"
 
-struct Vec2F64
+// N x M matrix with compile-time dimensions, stored in column-major order:
+// elems[c*N + r] is the element in row r, column c. This is the same layout
+// as julia arrays, so AData and the julia backend can share storage with it.
+template <int N, int M, typename T>
+struct Mat
 {
-   f64 elems[2];
+   T elems[N * M];
 
-   Vec2F64()
+   Mat()
    {
-      elems[0] = 0;
-      elems[1] = 0;
+      UNROLL for (int i = 0; i < N * M; i += 1)
+         elems[i] = 0;
    }
 
-   Vec2F64(f64 x1, f64 x2)
+   // elements are given in column-major order, e.g. Mat2x2F64(a11, a21, a12, a22)
+   template <typename... Ts>
+   Mat(T x, Ts... xs)
    {
-      elems[0] = x1;
-      elems[1] = x2;
+      static_assert(sizeof...(Ts) + 1 == N * M, "wrong number of matrix elements");
+      const T values[] = {x, (T) xs...};
+      UNROLL for (int i = 0; i < N * M; i += 1)
+         elems[i] = values[i];
+   }
+
+   T &operator()(int r, int c)
+   {
+      return elems[c * N + r];
+   }
+
+   T operator()(int r, int c) const
+   {
+      return elems[c * N + r];
    }
 };
 
+template <int N, typename T>
+using Vec = Mat<N, 1, T>;
+
+typedef Vec<2, f32> Vec2F32;
+typedef Vec<2, f64> Vec2F64;
+typedef Vec<3, f64> Vec3F64;
+typedef Vec<4, f64> Vec4F64;
+typedef Vec<6, f64> Vec6F64;
+typedef Mat<2, 2, f32> Mat2x2F32;
+typedef Mat<2, 2, f64> Mat2x2F64;
+typedef Mat<3, 3, f64> Mat3x3F64;
+typedef Mat<4, 4, f64> Mat4x4F64;
+typedef Mat<6, 6, f64> Mat6x6F64;
+
+// keeps the scalar in `s * A` from taking part in template argument deduction,
+// so that e.g. 2 * A works for both f32 and f64 matrices
+template <typename T>
+struct nondeduced
+{
+   typedef T type;
+};
+
+template <int N, int M, typename T>
+static inline
+void print(Mat<N, M, T> A)
+{
+   printf("[\n");
+   for (int r = 0; r < N; r += 1)
+   {
+      printf("[");
+      for (int c = 0; c < M; c += 1)
+         printf(c == 0 ? "%f" : ", %f", (f64) A(r, c));
+      printf("]\n");
+   }
+   printf("]\n");
+}
+
 static inline
 void printVec2F64(Vec2F64 x)
 {
@@ -35,310 +90,486 @@ void printlnVec2F64(Vec2F64 x)
 }
 
 static inline
-bool isapprox(Vec2F64 a, Vec2F64 b)
+void printMat2x2F64(Mat2x2F64 A)
 {
-   return isapprox(a.elems[0], b.elems[0]) && isapprox(a.elems[1], b.elems[1]);
+   printf("[ %f\t%f\n", A.elems[0], A.elems[2]);
+   printf("  %f\t%f ]\n", A.elems[1], A.elems[3]);
 }
 
+template <int N, int M, typename T>
 static inline
-Vec2F64 operator+(Vec2F64 a, Vec2F64 b)
+bool isapprox(Mat<N, M, T> A, Mat<N, M, T> B, typename nondeduced<T>::type tol = (T) 1e-5)
 {
-   return {a.elems[0] + b.elems[0], a.elems[1] + b.elems[1]};
+   for (int i = 0; i < N * M; i += 1)
+   {
+      if (!isapprox(A.elems[i], B.elems[i], tol))
+         return false;
+   }
+   return true;
 }
 
+template <int N, int M, typename T>
 static inline
-Vec2F64 operator-(Vec2F64 a, Vec2F64 b)
+Mat<N, M, T> operator+(Mat<N, M, T> A, Mat<N, M, T> B)
 {
-   return {a.elems[0] - b.elems[0], a.elems[1] - b.elems[1]};
+   UNROLL for (int i = 0; i < N * M; i += 1)
+      A.elems[i] += B.elems[i];
+   return A;
 }
 
+template <int N, int M, typename T>
 static inline
-Vec2F64 operator*(f64 a, Vec2F64 v)
+Mat<N, M, T> operator-(Mat<N, M, T> A, Mat<N, M, T> B)
 {
-   return {a * v.elems[0], a * v.elems[1]};
+   UNROLL for (int i = 0; i < N * M; i += 1)
+      A.elems[i] -= B.elems[i];
+   return A;
 }
 
+template <int N, int M, typename T>
 static inline
-f64 dot(Vec2F64 a, Vec2F64 b)
+Mat<N, M, T> operator*(typename nondeduced<T>::type t, Mat<N, M, T> A)
 {
-   return a.elems[0] * b.elems[0] + a.elems[1] * b.elems[1];
+   UNROLL for (int i = 0; i < N * M; i += 1)
+      A.elems[i] *= t;
+   return A;
 }
 
-struct Mat2x2F64
+template <int N, int K, int M, typename T>
+static inline
+Mat<N, M, T> matmul(Mat<N, K, T> A, Mat<K, M, T> B)
 {
-   f64 elems[4];
-
-   Mat2x2F64()
-   {
-      elems[0] = 0;
-      elems[1] = 0;
-      elems[2] = 0;
-      elems[3] = 0;
-   }
-
-   Mat2x2F64(f64 a11, f64 a21, f64 a12, f64 a22)
+   // column c of C is a linear combination of the columns of A; the innermost
+   // loop runs down a contiguous column, which the compiler vectorizes
+   Mat<N, M, T> C;
+   UNROLL for (int c = 0; c < M; c += 1)
    {
-      elems[0] = a11;
-      elems[1] = a21;
-      elems[2] = a12;
-      elems[3] = a22;
+      UNROLL for (int k = 0; k < K; k += 1)
+      {
+         UNROLL for (int r = 0; r < N; r += 1)
+            C(r, c) += A(r, k) * B(k, c);
+      }
    }
-};
+   return C;
+}
 
+// written out for 2x2, the size the simulation uses every frame
+template <typename T>
 static inline
-void printMat2x2F64(Mat2x2F64 A)
+Mat<2, 2, T> matmul(Mat<2, 2, T> A, Mat<2, 2, T> B)
 {
-   printf("[ %f\t%f\n", A.elems[0], A.elems[2]);
-   printf("  %f\t%f ]\n", A.elems[1], A.elems[3]);
+   return Mat<2, 2, T>(A(0,0)*B(0,0) + A(0,1)*B(1,0),
+                       A(1,0)*B(0,0) + A(1,1)*B(1,0),
+                       A(0,0)*B(0,1) + A(0,1)*B(1,1),
+                       A(1,0)*B(0,1) + A(1,1)*B(1,1));
 }
 
+template <int N, int M, typename T>
 static inline
-Vec2F64 matvecmul(Mat2x2F64 A, Vec2F64 x)
+Vec<N, T> matvecmul(Mat<N, M, T> A, Vec<M, T> x)
 {
-   f64 b1 = A.elems[0] * x.elems[0] + A.elems[2] * x.elems[1];
-   f64 b2 = A.elems[1] * x.elems[0] + A.elems[3] * x.elems[1];
-   return Vec2F64(b1, b2);
+   return matmul(A, x);
 }
 
+template <int N, typename T>
 static inline
-Mat2x2F64 matmul(Mat2x2F64 A, Mat2x2F64 B)
+T dot(Vec<N, T> a, Vec<N, T> b)
 {
-   f64 c11 = A.elems[0] * B.elems[0] + A.elems[2] * B.elems[1];
-   f64 c21 = A.elems[1] * B.elems[0] + A.elems[3] * B.elems[1];
-   f64 c12 = A.elems[0] * B.elems[2] + A.elems[2] * B.elems[3];
-   f64 c22 = A.elems[1] * B.elems[2] + A.elems[3] * B.elems[3];
-   return Mat2x2F64(c11, c21, c12, c22);
+   T result = 0;
+   UNROLL for (int i = 0; i < N; i += 1)
+      result += a.elems[i] * b.elems[i];
+   return result;
 }
 
+template <typename U, int N, int M, typename T>
 static inline
-bool isapprox(Mat2x2F64 A, Mat2x2F64 B)
+Mat<N, M, U> convert(Mat<N, M, T> A)
 {
-   for (int i = 0; i < 4; i += 1)
-   {
-      if (!isapprox(A.elems[i], B.elems[i]))
-         return false;
-   }
-   return true;
+   Mat<N, M, U> C;
+   UNROLL for (int i = 0; i < N * M; i += 1)
+      C.elems[i] = (U) A.elems[i];
+   return C;
 }
 
+template <int N, typename T>
 static inline
-Mat2x2F64 operator+(Mat2x2F64 A, Mat2x2F64 B)
+Mat<N, N, T> Identity()
 {
-   f64 c11 = A.elems[0] + B.elems[0];
-   f64 c21 = A.elems[1] + B.elems[1];
-   f64 c12 = A.elems[2] + B.elems[2];
-   f64 c22 = A.elems[3] + B.elems[3];
-   return Mat2x2F64(c11, c21, c12, c22);
+   Mat<N, N, T> I;
+   UNROLL for (int i = 0; i < N; i += 1)
+      I(i, i) = 1;
+   return I;
 }
 
 static inline
-Mat2x2F64 operator*(f64 t, Mat2x2F64 A)
+Mat2x2F64 Identity2x2()
 {
-   return Mat2x2F64(t * A.elems[0], t * A.elems[1], t * A.elems[2], t * A.elems[3]);
+   return Identity<2, f64>();
 }
 
 static inline
-Mat2x2F64 expm(Mat2x2F64 A)
+Mat2x2F64 Zero2x2()
 {
-   Mat2x2F64 result(1, 0, 0, 1);
-   Mat2x2F64 An(1, 0, 0, 1);
-   f64 factorial = 1;
-   for (int i = 1; i < 20; i += 1)
-   {
-      An = matmul(An, A);
-      factorial *= i;
-      result = result + (1/factorial) * An;
-   }
-   return result;
+   return Mat2x2F64();
 }
 
-Mat2x2F64 Identity2x2()
+static inline
+Mat4x4F64 Identity4x4()
 {
-   return {1, 0, 0, 1};
+   return Identity<4, f64>();
 }
 
-Mat2x2F64 Zero2x2()
+template <int N, int M, typename T>
+static inline
+T opnorm1(Mat<N, M, T> A)
 {
-   return {0, 0, 0, 0};
+   T result = 0;
+   for (int c = 0; c < M; c += 1)
+   {
+      T colsum = 0;
+      for (int r = 0; r < N; r += 1)
+         colsum += fabs(A(r, c));
+      result = max(result, colsum);
+   }
+   return result;
 }
 
-struct Mat4x4F64
+// returns Q^-1 * P, using gaussian elimination with partial pivoting
+template <int N, int M, typename T>
+static inline
+Mat<N, M, T> leftdivide(Mat<N, N, T> Q, Mat<N, M, T> P)
 {
-   f64 elems[4][4]; // column-major order: elems[c][r]
-
-   Mat4x4F64()
+   for (int k = 0; k < N; k += 1)
    {
-      for (int i = 0; i < 4; i += 1)
-         for (int j = 0; j < 4; j += 1)
-            elems[i][j] = 0;
+      int pivot = k;
+      for (int r = k + 1; r < N; r += 1)
+      {
+         if (fabs(Q(r, k)) > fabs(Q(pivot, k)))
+            pivot = r;
+      }
+      for (int c = 0; c < N; c += 1)
+      {
+         T temp = Q(k, c); Q(k, c) = Q(pivot, c); Q(pivot, c) = temp;
+      }
+      for (int c = 0; c < M; c += 1)
+      {
+         T temp = P(k, c); P(k, c) = P(pivot, c); P(pivot, c) = temp;
+      }
+      for (int r = k + 1; r < N; r += 1)
+      {
+         T l = Q(r, k) / Q(k, k);
+         for (int c = k; c < N; c += 1)
+            Q(r, c) -= l * Q(k, c);
+         for (int c = 0; c < M; c += 1)
+            P(r, c) -= l * P(k, c);
+      }
    }
 
-   Mat4x4F64(
-      f64 a11, f64 a12, f64 a13, f64 a14,
-      f64 a21, f64 a22, f64 a23, f64 a24,
-      f64 a31, f64 a32, f64 a33, f64 a34,
-      f64 a41, f64 a42, f64 a43, f64 a44)
+   Mat<N, M, T> X;
+   for (int c = 0; c < M; c += 1)
    {
-      elems[0][0] = a11;
-      elems[0][1] = a21;
-      elems[0][2] = a31;
-      elems[0][3] = a41;
-      elems[1][0] = a12;
-      elems[1][1] = a22;
-      elems[1][2] = a32;
-      elems[1][3] = a42;
-      elems[2][0] = a13;
-      elems[2][1] = a23;
-      elems[2][2] = a33;
-      elems[2][3] = a43;
-      elems[3][0] = a14;
-      elems[3][1] = a24;
-      elems[3][2] = a34;
-      elems[3][3] = a44;
+      for (int r = N - 1; r >= 0; r -= 1)
+      {
+         T sum = P(r, c);
+         for (int k = r + 1; k < N; k += 1)
+            sum -= Q(r, k) * X(k, c);
+         X(r, c) = sum / Q(r, r);
+      }
    }
-};
+   return X;
+}
 
+// returns Q^-1 * P
+template <typename T>
 static inline
-void print(Mat4x4F64 A)
+Mat<2, 2, T> leftdivide(Mat<2, 2, T> Q, Mat<2, 2, T> P)
 {
-   printf("[\n");
-   printf("[%f, %f, %f, %f]\n", A.elems[0][0], A.elems[1][0], A.elems[2][0], A.elems[3][0]);
-   printf("[%f, %f, %f, %f]\n", A.elems[0][1], A.elems[1][1], A.elems[2][1], A.elems[3][1]);
-   printf("[%f, %f, %f, %f]\n", A.elems[0][2], A.elems[1][2], A.elems[2][2], A.elems[3][2]);
-   printf("[%f, %f, %f, %f]\n", A.elems[0][3], A.elems[1][3], A.elems[2][3], A.elems[3][3]);
-   printf("]\n");
+   T detQ = Q.elems[0] * Q.elems[3] - Q.elems[2] * Q.elems[1];
+   Mat<2, 2, T> Qinv(Q.elems[3], -Q.elems[1], -Q.elems[2], Q.elems[0]);
+   return matmul((1/detQ) * Qinv, P);
 }
 
+// returns Q^-1 * P, with Q^-1 computed from the adjugate. This has a much shorter
+// dependency chain than elimination with pivoting, and is accurate enough for
+// the well conditioned denominators of the pade approximants below.
+template <typename T>
 static inline
-Mat4x4F64 matmul(Mat4x4F64 A, Mat4x4F64 B)
+Mat<4, 4, T> leftdivide(Mat<4, 4, T> Q, Mat<4, 4, T> P)
 {
-   Mat4x4F64 C;
-   for (int c = 0; c < 4; c += 1)
-   {
-      for (int r = 0; r < 4; r += 1)
-      {
-         for (int k = 0; k < 4; k += 1)
-         {
-            C.elems[c][r] += A.elems[k][r] * B.elems[c][k];
-         }
-      }
-   }
-   return C;
+   T a00 = Q(0, 0), a01 = Q(0, 1), a02 = Q(0, 2), a03 = Q(0, 3);
+   T a10 = Q(1, 0), a11 = Q(1, 1), a12 = Q(1, 2), a13 = Q(1, 3);
+   T a20 = Q(2, 0), a21 = Q(2, 1), a22 = Q(2, 2), a23 = Q(2, 3);
+   T a30 = Q(3, 0), a31 = Q(3, 1), a32 = Q(3, 2), a33 = Q(3, 3);
+
+   // 2x2 minors of the top two and bottom two rows
+   T s0 = a00 * a11 - a10 * a01;
+   T s1 = a00 * a12 - a10 * a02;
+   T s2 = a00 * a13 - a10 * a03;
+   T s3 = a01 * a12 - a11 * a02;
+   T s4 = a01 * a13 - a11 * a03;
+   T s5 = a02 * a13 - a12 * a03;
+   T c5 = a22 * a33 - a32 * a23;
+   T c4 = a21 * a33 - a31 * a23;
+   T c3 = a21 * a32 - a31 * a22;
+   T c2 = a20 * a33 - a30 * a23;
+   T c1 = a20 * a32 - a30 * a22;
+   T c0 = a20 * a31 - a30 * a21;
+
+   T detQ = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+   T invdet = 1 / detQ;
+
+   Mat<4, 4, T> Qinv(
+      ( a11 * c5 - a12 * c4 + a13 * c3) * invdet,
+      (-a10 * c5 + a12 * c2 - a13 * c1) * invdet,
+      ( a10 * c4 - a11 * c2 + a13 * c0) * invdet,
+      (-a10 * c3 + a11 * c1 - a12 * c0) * invdet,
+
+      (-a01 * c5 + a02 * c4 - a03 * c3) * invdet,
+      ( a00 * c5 - a02 * c2 + a03 * c1) * invdet,
+      (-a00 * c4 + a01 * c2 - a03 * c0) * invdet,
+      ( a00 * c3 - a01 * c1 + a02 * c0) * invdet,
+
+      ( a31 * s5 - a32 * s4 + a33 * s3) * invdet,
+      (-a30 * s5 + a32 * s2 - a33 * s1) * invdet,
+      ( a30 * s4 - a31 * s2 + a33 * s0) * invdet,
+      (-a30 * s3 + a31 * s1 - a32 * s0) * invdet,
+
+      (-a21 * s5 + a22 * s4 - a23 * s3) * invdet,
+      ( a20 * s5 - a22 * s2 + a23 * s1) * invdet,
+      (-a20 * s4 + a21 * s2 - a23 * s0) * invdet,
+      ( a20 * s3 - a21 * s1 + a22 * s0) * invdet);
+   return matmul(Qinv, P);
 }
 
+// truncated taylor series; kept around as a reference for the benchmarks
+template <int N, typename T>
 static inline
-Mat4x4F64 operator*(f64 t, Mat4x4F64 A)
+Mat<N, N, T> expm_taylor(Mat<N, N, T> A)
 {
-   Mat4x4F64 C;
-   for (int i = 0; i < 4; i += 1)
+   Mat<N, N, T> result = Identity<N, T>();
+   Mat<N, N, T> An = Identity<N, T>();
+   T factorial = 1;
+   for (int i = 1; i < 20; i += 1)
    {
-      for (int j = 0; j < 4; j += 1)
-      {
-         C.elems[i][j] = t * A.elems[i][j];
-      }
+      An = matmul(An, A);
+      factorial *= (T) i;
+      result = result + (1/factorial) * An;
    }
-   return C;
+   return result;
 }
 
+// Scaling and squaring with a diagonal Pade approximant r_m(A) = q_m(A)^-1 p_m(A).
+// Reference: N. J. Higham, "The scaling and squaring method for the matrix
+// exponential revisited", SIAM J. Matrix Anal. Appl. 26(4), 2005.
+//
+// The degree m is the smallest one whose threshold theta_m exceeds ||A||_1.
+// Above theta_13, A is scaled by 2^-s so that ||A/2^s||_1 <= theta_13 and the
+// result is squared s times. The thresholds are chosen so that
+//    r_m(2^-s A)^(2^s) = exp(A + dA),   ||dA||_1 / ||A||_1 <= 2^-53,
+// i.e. the backward error is at most the unit roundoff of f64, independent of
+// ||A||. The cost is at most 6 matmuls + 1 solve + s squarings, versus 19
+// matmuls for the truncated taylor series, which also loses accuracy once
+// ||A|| is larger than about 5.
+
+static const int pade_degrees[5] = {3, 5, 7, 9, 13};
+static const f64 pade_thetas[5] = {
+   1.495585217958292e-2,
+   2.539398330063230e-1,
+   9.504178996162932e-1,
+   2.097847961257068e0,
+   5.371920351148152e0,
+};
+
+struct PadeParams
+{
+   int degree;
+   int squarings;
+};
+
 static inline
-Mat4x4F64 operator+(Mat4x4F64 A, Mat4x4F64 B)
+PadeParams choosepade(f64 norm1)
 {
-   Mat4x4F64 C;
    for (int i = 0; i < 4; i += 1)
    {
-      for (int j = 0; j < 4; j += 1)
-      {
-         C.elems[i][j] = A.elems[i][j] + B.elems[i][j];
-      }
+      if (norm1 <= pade_thetas[i])
+         return {pade_degrees[i], 0};
    }
-   return C;
+   int squarings = 0;
+   if (norm1 > pade_thetas[4])
+      squarings = (int) ceil(log2(norm1 / pade_thetas[4]));
+   return {13, squarings};
 }
 
+// r_m(A) = q_m(A)^-1 p_m(A), with numerator p_m(A) = V + U and denominator
+// q_m(A) = V - U, where U holds the odd powers of A and V holds the even powers.
+// Each degree gets its own function, which keeps the matrices in registers.
+template <typename Mat>
 static inline
-bool isapprox(Mat4x4F64 A, Mat4x4F64 B, f64 tol = 1e-5)
+Mat pade3(Mat A, Mat I)
 {
-   for (int i = 0; i < 4; i += 1)
-   {
-      for (int j = 0; j < 4; j += 1)
-      {
-         if (!isapprox(A.elems[i][j], B.elems[i][j], tol))
-         {
-            return false;
-         }
-      }
-   }
-   return true;
+   Mat A2 = matmul(A, A);
+   Mat U = matmul(A, A2 + 60.0 * I);
+   Mat V = 12.0 * A2 + 120.0 * I;
+   return leftdivide(V - U, V + U);
 }
 
-Mat4x4F64 Identity4x4()
+template <typename Mat>
+static inline
+Mat pade5(Mat A, Mat I)
 {
-   Mat4x4F64 A;
-   A.elems[0][0] = 1;
-   A.elems[1][1] = 1;
-   A.elems[2][2] = 1;
-   A.elems[3][3] = 1;
-   return A;
+   Mat A2 = matmul(A, A);
+   Mat A4 = matmul(A2, A2);
+   Mat U = matmul(A, A4 + 420.0 * A2 + 15120.0 * I);
+   Mat V = 30.0 * A4 + 3360.0 * A2 + 30240.0 * I;
+   return leftdivide(V - U, V + U);
 }
 
+template <typename Mat>
 static inline
-Mat4x4F64 expm(Mat4x4F64 A)
+Mat pade7(Mat A, Mat I)
 {
-   Mat4x4F64 result = Identity4x4();
-   Mat4x4F64 An = Identity4x4();
-   f64 factorial = 1;
-   for (int i = 1; i < 20; i += 1)
-   {
-      An = matmul(An, A);
-      factorial *= i;
-      result = result + (1/factorial) * An;
-   }
+   Mat A2 = matmul(A, A);
+   Mat A4 = matmul(A2, A2);
+   Mat A6 = matmul(A4, A2);
+   Mat U = matmul(A, A6 + 1512.0 * A4 + 277200.0 * A2 + 8648640.0 * I);
+   Mat V = 56.0 * A6 + 25200.0 * A4 + 1995840.0 * A2 + 17297280.0 * I;
+   return leftdivide(V - U, V + U);
+}
+
+template <typename Mat>
+static inline
+Mat pade9(Mat A, Mat I)
+{
+   Mat A2 = matmul(A, A);
+   Mat A4 = matmul(A2, A2);
+   Mat A6 = matmul(A4, A2);
+   Mat A8 = matmul(A6, A2);
+   Mat U = matmul(A, A8 + 3960.0 * A6 + 2162160.0 * A4 + 302702400.0 * A2 + 8821612800.0 * I);
+   Mat V = 90.0 * A8 + 110880.0 * A6 + 30270240.0 * A4 + 2075673600.0 * A2 + 17643225600.0 * I;
+   return leftdivide(V - U, V + U);
+}
+
+template <typename Mat>
+static inline
+Mat pade13(Mat A, Mat I)
+{
+   static const f64 b[14] = {
+      64764752532480000.0, 32382376266240000.0, 7771770303897600.0,
+      1187353796428800.0, 129060195264000.0, 10559470521600.0,
+      670442572800.0, 33522128640.0, 1323241920.0,
+      40840800.0, 960960.0, 16380.0, 182.0, 1.0,
+   };
+   Mat A2 = matmul(A, A);
+   Mat A4 = matmul(A2, A2);
+   Mat A6 = matmul(A4, A2);
+   Mat U = matmul(A6, b[13] * A6 + b[11] * A4 + b[9] * A2);
+   U = matmul(A, U + b[7] * A6 + b[5] * A4 + b[3] * A2 + b[1] * I);
+   Mat V = matmul(A6, b[12] * A6 + b[10] * A4 + b[8] * A2);
+   V = V + b[6] * A6 + b[4] * A4 + b[2] * A2 + b[0] * I;
+   return leftdivide(V - U, V + U);
+}
+
+template <typename Mat>
+static inline
+Mat expm_pade(Mat A, Mat I)
+{
+   PadeParams params = choosepade(opnorm1(A));
+   if (params.degree == 3)
+      return pade3(A, I);
+   if (params.degree == 5)
+      return pade5(A, I);
+   if (params.degree == 7)
+      return pade7(A, I);
+   if (params.degree == 9)
+      return pade9(A, I);
+
+   Mat result = pade13(ldexp(1.0, -params.squarings) * A, I);
+   for (int i = 0; i < params.squarings; i += 1)
+      result = matmul(result, result);
    return result;
 }
 
-Mat4x4F64 BlockMatrix(
-      Mat2x2F64 A, Mat2x2F64 B,
-      Mat2x2F64 C, Mat2x2F64 D)
-{
-   Mat4x4F64 R;
-   R.elems[0][0] = A.elems[0];
-   R.elems[0][1] = A.elems[1];
-   R.elems[0][2] = C.elems[0];
-   R.elems[0][3] = C.elems[1];
-   R.elems[1][0] = A.elems[2];
-   R.elems[1][1] = A.elems[3];
-   R.elems[1][2] = C.elems[2];
-   R.elems[1][3] = C.elems[3];
-   R.elems[2][0] = B.elems[0];
-   R.elems[2][1] = B.elems[1];
-   R.elems[2][2] = D.elems[0];
-   R.elems[2][3] = D.elems[1];
-   R.elems[3][0] = B.elems[2];
-   R.elems[3][1] = B.elems[3];
-   R.elems[3][2] = D.elems[2];
-   R.elems[3][3] = D.elems[3];
+template <int N>
+static inline
+Mat<N, N, f64> expm(Mat<N, N, f64> A)
+{
+   return expm_pade(A, Identity<N, f64>());
+}
+
+// the pade thresholds above are for f64, so f32 matrices are promoted
+template <int N>
+static inline
+Mat<N, N, f32> expm(Mat<N, N, f32> A)
+{
+   return convert<f32>(expm(convert<f64>(A)));
+}
+
+// block matrix
+//    A B
+//    C D
+template <int N, typename T>
+static inline
+Mat<2*N, 2*N, T> BlockMatrix(
+      Mat<N, N, T> A, Mat<N, N, T> B,
+      Mat<N, N, T> C, Mat<N, N, T> D)
+{
+   Mat<2*N, 2*N, T> R;
+   for (int c = 0; c < N; c += 1)
+   {
+      for (int r = 0; r < N; r += 1)
+      {
+         R(r, c) = A(r, c);
+         R(r, c + N) = B(r, c);
+         R(r + N, c) = C(r, c);
+         R(r + N, c + N) = D(r, c);
+      }
+   }
    return R;
 }
 
-Mat2x2F64 getUpperLeftBlock(Mat4x4F64 M)
+template <int N, typename T>
+static inline
+Mat<N/2, N/2, T> getUpperLeftBlock(Mat<N, N, T> M)
 {
-   Mat2x2F64 A;
-   A.elems[0] = M.elems[0][0];
-   A.elems[1] = M.elems[0][1];
-   A.elems[2] = M.elems[1][0];
-   A.elems[3] = M.elems[1][1];
+   Mat<N/2, N/2, T> A;
+   for (int c = 0; c < N/2; c += 1)
+      for (int r = 0; r < N/2; r += 1)
+         A(r, c) = M(r, c);
    return A;
 }
 
-Mat2x2F64 getUpperRightBlock(Mat4x4F64 M)
+template <int N, typename T>
+static inline
+Mat<N/2, N/2, T> getUpperRightBlock(Mat<N, N, T> M)
 {
-   Mat2x2F64 A;
-   A.elems[0] = M.elems[2][0];
-   A.elems[1] = M.elems[2][1];
-   A.elems[2] = M.elems[3][0];
-   A.elems[3] = M.elems[3][1];
+   Mat<N/2, N/2, T> A;
+   for (int c = 0; c < N/2; c += 1)
+      for (int r = 0; r < N/2; r += 1)
+         A(r, c) = M(r, c + N/2);
    return A;
 }
 
+// zero-order hold discretization of dx/dt = A x + B u: with u held over a
+// step, x(t + dt) = M x(t) + N u. Both come out of one exponential, since
+//    exp(dt [A B; 0 0]) = [e^{dt A}  int_0^dt e^{s A} ds B; 0 I].
+// https://math.stackexchange.com/questions/658276/integral-of-matrix-exponential/4105683#4105683
+struct Discretized
+{
+   Mat2x2F64 M;
+   Mat2x2F64 N;
+};
+
+static inline
+Discretized discretize(Mat2x2F64 A, Mat2x2F64 B, f64 dt)
+{
+   Mat4x4F64 Atilde = BlockMatrix(
+         A,       B,
+         Zero2x2(), Zero2x2()
+   );
+   Mat4x4F64 exp_dtAtilde = expm(dt * Atilde);
+   return {getUpperLeftBlock(exp_dtAtilde), getUpperRightBlock(exp_dtAtilde)};
+}
+
 struct ComplexF32
 {
    f32 rl;
@@ -535,6 +766,94 @@ Eigen decomposition(Mat2x2F64 A)
    return result;
 }
 
+// Closed form exponential of a 2x2 matrix, from its trace and determinant.
+// Writing A = s I + N with s = tr(A)/2, N is traceless so N^2 = q I with
+//    q = s^2 - det(A) = discriminant / 4,
+// which gives
+//    q > 0:  e^A = e^s (cosh(sqrt(q)) I + sinh(sqrt(q))/sqrt(q) N)   (real eigenvalues)
+//    q < 0:  e^A = e^s (cos(sqrt(-q)) I + sin(sqrt(-q))/sqrt(-q) N)  (complex eigenvalues)
+//    q = 0:  e^A = e^s (I + N)                                       (repeated eigenvalue)
+// q is computed as ((a11 - a22)/2)^2 + a12 a21 rather than from the discriminant,
+// which avoids cancellation when the eigenvalues nearly coincide. Near q = 0 both
+// cosh/cos and sinhc/sinc are replaced by their taylor series in q, so the result
+// is continuous across the branches that decomposition() takes.
+static inline
+Mat2x2F64 expm_closedform(Mat2x2F64 A)
+{
+   f64 a11 = A.elems[0];
+   f64 a21 = A.elems[1];
+   f64 a12 = A.elems[2];
+   f64 a22 = A.elems[3];
+
+   f64 s = 0.5 * (a11 + a22);
+   f64 halfdiff = 0.5 * (a11 - a22);
+   f64 q = halfdiff * halfdiff + a12 * a21;
+
+   f64 ec; // e^s cosh(sqrt(q)), or e^s cos(sqrt(-q))
+   f64 ed; // e^s sinh(sqrt(q))/sqrt(q), or e^s sin(sqrt(-q))/sqrt(-q)
+   if (fabs(q) < 1e-3)
+   {
+      // truncation error is below q^4/8! ~ 2e-17
+      f64 es = exp(s);
+      ec = es * (1 + q * (1/2.0 + q * (1/24.0 + q * (1/720.0))));
+      ed = es * (1 + q * (1/6.0 + q * (1/120.0 + q * (1/5040.0))));
+   }
+   else if (q > 0)
+   {
+      // e^(s+mu) - e^(s-mu) = e^(s-mu) expm1(2 mu), without cancellation
+      f64 mu = sqrt(q);
+      f64 elow = exp(s - mu);
+      f64 halfgap = 0.5 * elow * expm1(2 * mu);
+      ec = elow + halfgap;
+      ed = halfgap / mu;
+   }
+   else
+   {
+      f64 omega = sqrt(-q);
+      f64 es = exp(s);
+      ec = es * cos(omega);
+      ed = es * sin(omega) / omega;
+   }
+
+   return Mat2x2F64(
+      ec + ed * halfdiff,
+      ed * a21,
+      ed * a12,
+      ec - ed * halfdiff);
+}
+
+// M^n by repeated squaring; pow2[j] caches M^(2^j) and is filled on demand,
+// so jumping n steps costs at most two matmuls per bit of n
+struct MatPowers2x2
+{
+   Mat2x2F64 pow2[32];
+   int numpow2;
+};
+
+static inline
+void initmatpowers(MatPowers2x2 *P, Mat2x2F64 M)
+{
+   P->pow2[0] = M;
+   P->numpow2 = 1;
+}
+
+static inline
+Mat2x2F64 matpower(MatPowers2x2 *P, u32 n)
+{
+   Mat2x2F64 result = Identity2x2();
+   for (int j = 0; n != 0; j += 1, n >>= 1)
+   {
+      if (j == P->numpow2)
+      {
+         P->pow2[j] = matmul(P->pow2[j - 1], P->pow2[j - 1]);
+         P->numpow2 += 1;
+      }
+      if (n & 1)
+         result = matmul(P->pow2[j], result);
+   }
+   return result;
+}
+
 Vec2F64 linsolve_nonsingular(Mat2x2F64 A, Vec2F64 b)
 {
    f64 a11 = A.elems[0];
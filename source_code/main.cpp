@@ -8,6 +8,7 @@
 
 // third-party libraries
 #include <raylib.h>
+#include <rlgl.h>
 #include "../dependencies/rlImGui/rlImGui.h"
 #include "../dependencies/imgui/imgui.h"
 #include "../dependencies/tracy/public/tracy/Tracy.hpp"
@@ -19,6 +20,7 @@
 #include "useful_utils.cpp"
 #include "linearalgebra.cpp"
 #include "game_data.cpp"
+#include "view_transform.cpp"
 
 #ifdef JULIA_BACKEND
    #include <julia.h>
@@ -32,83 +34,53 @@ int screenwidth = 800;
 int screenheight = 600;
 // zoom level
 int pixelsperunit = 20;
+// pixels from the center of the screen to the origin, dragged with the right mouse button
+int panx = 0;
+int pany = 0;
+ViewTransform viewtransform = makeviewtransform(pixelsperunit, screenwidth, screenheight);
 
-// 0,0 = center of screen
+// 0,0 = center of screen, until panned
 // +y = up
 // +x = right
 static inline
-Vector2 coords2pixels(Vector2 graph_coords)
+Vector2 coords2pixels(Vec2F64 graph_coords)
 {
-   Vector2 pixel_coords = {
-       graph_coords.x * pixelsperunit + screenwidth / 2,
-      -graph_coords.y * pixelsperunit + screenheight / 2
-   };
-   return pixel_coords;
+   Vec2F64 pixel = viewtopixel(&viewtransform, graph_coords);
+   return {(f32) pixel.elems[0], (f32) pixel.elems[1]};
 }
 
 static inline
-Vector2 coords2pixels(Vec2F64 graph_coords)
+Vector2 coords2pixels(Vector2 graph_coords)
 {
-   Vector2 coords_f32;
-   coords_f32.x = (f32) graph_coords.elems[0];
-   coords_f32.y = (f32) graph_coords.elems[1];
-   return coords2pixels(coords_f32);
+   return coords2pixels(Vec2F64(graph_coords.x, graph_coords.y));
 }
 
 static inline
 Vec2F64 pixels2coords(Vector2 pixel_coords)
 {
-   return {
-       ((f64)pixel_coords.x - screenwidth / 2) / pixelsperunit,
-      -((f64)pixel_coords.y - screenheight / 2) / pixelsperunit,
-   };
+   return pixeltoview(&viewtransform, Vec2F64(pixel_coords.x, pixel_coords.y));
 }
 
+#include "axes_layer.cpp"
+
 static inline
 void drawcoordaxes()
 {
-   int x0 = screenwidth/2;
-   int y0 = screenheight/2;
-   DrawLine(0, y0, screenwidth-1, y0, BLACK);
-   DrawLine(x0, 0, x0, screenheight-1, BLACK);
-
-   int ticklen = 5;
-   for (int x = x0, xval = 0; x < screenwidth; x += pixelsperunit, xval += 1)
-   {
-      DrawLine(x, y0 + ticklen, x, y0 - ticklen, BLACK);
-      if (xval != 0 && xval % 10 == 0)
-         DrawText(TextFormat("%d", xval), x - 10, y0 + ticklen + 10, 20, DARKGRAY);
-   }
-   for (int x = x0, xval = 0; x >= 0; x -= pixelsperunit, xval -= 1)
-   {
-      DrawLine(x, y0 + ticklen, x, y0 - ticklen, BLACK);
-      if (xval != 0 && xval % 10 == 0)
-         DrawText(TextFormat("%d", xval), x - 15, y0 + ticklen + 10, 20, DARKGRAY);
-   }
-   for (int y = y0, yval = 0; y < screenheight; y += pixelsperunit, yval -= 1)
-   {
-      DrawLine(x0 - ticklen, y, x0 + ticklen, y, BLACK);
-      if (yval != 0 && yval % 10 == 0)
-         DrawText(TextFormat("%d", yval), x0 + ticklen + 15, y - 10, 20, DARKGRAY);
-   }
-   for (int y = y0, yval = 0; y >= 0; y -= pixelsperunit, yval += 1)
-   {
-      DrawLine(x0 - ticklen, y, x0 + ticklen, y, BLACK);
-      if (yval != 0 && yval % 10 == 0)
-         DrawText(TextFormat("%d", yval), x0 + ticklen + 15, y - 10, 20, DARKGRAY);
-   }
+   drawaxeslayer(&axeslayer, makeaxeskey(AXES_2D, pixelsperunit, screenwidth, screenheight, BLACK, panx, pany));
 }
 
 #include "trajectories.cpp"
 #include "harmonic_oscillator.cpp"
 #include "one_dimension.cpp"
+#include "hill_equation.cpp"
 
 void gameloop()
 {
    FrameMark;
    framenumber += 1;
    f64 t_framestart = GetTime();
-   dt = t_framestart - t_prevframe;
+   frame_dt = t_framestart - t_prevframe;
+   advanceclock(frame_dt);
 
    screenwidth = GetScreenWidth();
    screenheight = GetScreenHeight();
@@ -117,9 +89,25 @@ void gameloop()
       return;
 
    ImGuiIO& io = ImGui::GetIO();
+   int oldpixelsperunit = pixelsperunit;
    if (!io.WantCaptureMouse)
       pixelsperunit = (int) (powf(1.05f, GetMouseWheelMove()) * pixelsperunit);
    pixelsperunit = clampint(pixelsperunit, 20, 1000);
+   // zoom about the center of the screen
+   panx = (int) ((i64) panx * pixelsperunit / oldpixelsperunit);
+   pany = (int) ((i64) pany * pixelsperunit / oldpixelsperunit);
+   if (!io.WantCaptureMouse && IsMouseButtonDown(MOUSE_BUTTON_RIGHT))
+   {
+      Vector2 delta = GetMouseDelta();
+      panx += (int) roundf(delta.x);
+      pany += (int) roundf(delta.y);
+   }
+   if (IsKeyPressed(KEY_HOME) && !io.WantCaptureKeyboard)
+   {
+      panx = 0;
+      pany = 0;
+   }
+   viewtransform = makeviewtransform(pixelsperunit, screenwidth, screenheight, panx, pany);
 
    BeginDrawing();
    rlImGuiBegin();
@@ -130,9 +118,15 @@ void gameloop()
       "1-D",
       "Trajectories (2-D)",
       "Harmonic oscillator",
+      "Hill's equation",
    };
    static int example_idx = 1;
    ImGui::Combo("Demo", &example_idx, examples, IM_ARRAYSIZE(examples));
+   f32 rate = (f32) sim_rate_hz;
+   if (ImGui::SliderFloat("sim rate (Hz)", &rate, 30, 960, "%.0f", ImGuiSliderFlags_Logarithmic))
+      sim_rate_hz = (f64) rate;
+   ImGui::SliderInt("max catch-up steps", &max_catchup_steps, 1, 64);
+   ImGui::Text("steps this frame: %d", sim_steps);
    ImGui::End();
 
    if (example_idx == 0)
@@ -141,6 +135,8 @@ void gameloop()
       gameloop_trajectories();
    else if (example_idx == 2)
       gameloop_oscillator();
+   else if (example_idx == 3)
+      gameloop_hill();
 
    drawtime_ms = (GetTime() - t_framestart) * 1000;
    t_prevframe = t_framestart;
@@ -158,8 +154,36 @@ void gameloop()
 #include "../assets/xdoteqAx.c"
 #endif
 
-int main(void)
+static
+void printusage(const char *program)
+{
+   printf("usage: %s [--particles N] [--trail N] [--threads N] [--seed N]\n", program);
+}
+
+int main(int argc, char **argv)
 {
+   int numtrajectories = default_numtrajectories;
+   int histcapacity = default_histcapacity;
+   int numthreads = hardwarethreads();
+   for (int i = 1; i < argc; i += 1)
+   {
+      if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc)
+         numtrajectories = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--trail") == 0 && i + 1 < argc)
+         histcapacity = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+         numthreads = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+         seedrng(&mainrng, strtoull(argv[++i], NULL, 10));
+      else
+      {
+         printusage(argv[0]);
+         return 1;
+      }
+   }
+   histcapacity = clampint(histcapacity, min_histcapacity, max_histcapacity);
+   numtrajectories = clampint(numtrajectories, 1, maxtrajectories(histcapacity));
+
    SetConfigFlags(FLAG_WINDOW_RESIZABLE);
    InitWindow(screenwidth, screenheight, "diffeqvisualizer");
    rlImGuiSetup(true);
@@ -202,8 +226,11 @@ int main(void)
 #endif
    }
 
-   for (int i = 0; i < numtrajectories; i++)
-      initTrajectory(&trajectories[i]);
+   if (!inittrajectories(numtrajectories, histcapacity, numthreads))
+   {
+      printf("not enough memory for %d particles with trails of %d\n", numtrajectories, histcapacity);
+      return 1;
+   }
 
 #ifdef JULIA_BACKEND
    jl_init();
@@ -223,7 +250,7 @@ int main(void)
 #else
    AData = A.elems;
 #endif
-   resetstates((f64 *) currentstates);
+   resetstates(&particles);
 
 #ifdef WEB
    // https://emscripten.org/docs/api_reference/emscripten.h.html#c.emscripten_set_main_loop
@@ -0,0 +1,755 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "useful_utils.cpp"
+#include "linearalgebra.cpp"
+#include "threadpool.cpp"
+#include "random.cpp"
+#include "sampling.cpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+   #include <immintrin.h>
+   #define PARTICLES_X86
+#endif
+#if defined(__wasm_simd128__)
+   #include <wasm_simd128.h>
+#endif
+
+// Structure-of-arrays particle store. The history is a ring of rows, one row
+// per step, and each row holds the x (or y) coordinate of every particle, so
+// a step reads one row and writes the next with unit-stride loads and stores.
+// The current states are the newest row; there is no separate copy.
+//
+// For a constant A every particle also remembers one state it passed through
+// and the time it was there, so its state at any other time is
+// e^{(t - basetime) A} base. The analytic mode evaluates that directly instead
+// of stepping, which neither accumulates rounding error nor needs to go through
+// the intermediate steps to reach a time.
+
+// new = M * old + b for particles [begin, end)
+typedef void (*PropagateKernel)(
+      Mat2x2F64 M, Vec2F64 b,
+      const f64 *x, const f64 *y,
+      f64 *newx, f64 *newy,
+      int begin, int end);
+
+enum SimdLevel
+{
+   SIMD_SCALAR,
+   SIMD_SSE2,
+   SIMD_AVX2,
+   SIMD_WASM128,
+   NUM_SIMD_LEVELS,
+};
+
+const char *simdlevel_names[NUM_SIMD_LEVELS] = {"scalar", "sse2", "avx2", "wasm simd128"};
+
+// rows are padded to a whole number of cache lines
+#define particle_row_align cacheline_size
+// particles per parallelfor chunk; a multiple of the doubles in a cache line,
+// so chunks never share a line
+#define particle_chunk 4096
+
+struct Particles
+{
+   int count;
+   int histcapacity;
+   int stride;      // length of a history row, count rounded up to a cache line
+   int curidx;      // history row holding the current states
+   u32 stepcount;
+   f64 *histx;      // histcapacity rows of stride elements
+   f64 *histy;
+   u32 *birthstep;  // stepcount when each particle was (re)spawned
+   f64 time;        // simulated time of the current row
+   f64 *basex;      // a state each particle passed through under the current A
+   f64 *basey;
+   f64 *basetime;   // and when
+   SimdLevel simd;
+   PropagateKernel propagate;
+};
+
+static
+void propagate_scalar(Mat2x2F64 M, Vec2F64 b, const f64 *x, const f64 *y, f64 *newx, f64 *newy, int begin, int end)
+{
+   f64 m00 = M(0, 0), m01 = M(0, 1), m10 = M(1, 0), m11 = M(1, 1);
+   f64 bx = b.elems[0], by = b.elems[1];
+   for (int i = begin; i < end; i += 1)
+   {
+      f64 xi = x[i];
+      f64 yi = y[i];
+      newx[i] = m00 * xi + m01 * yi + bx;
+      newy[i] = m10 * xi + m11 * yi + by;
+   }
+}
+
+// The vector kernels do the same multiplies and adds in the same order as the
+// scalar one (no fma), so every kernel gives bit-identical results.
+
+#ifdef PARTICLES_X86
+__attribute__((target("sse2")))
+static
+void propagate_sse2(Mat2x2F64 M, Vec2F64 b, const f64 *x, const f64 *y, f64 *newx, f64 *newy, int begin, int end)
+{
+   __m128d m00 = _mm_set1_pd(M(0, 0));
+   __m128d m01 = _mm_set1_pd(M(0, 1));
+   __m128d m10 = _mm_set1_pd(M(1, 0));
+   __m128d m11 = _mm_set1_pd(M(1, 1));
+   __m128d bx = _mm_set1_pd(b.elems[0]);
+   __m128d by = _mm_set1_pd(b.elems[1]);
+
+   int i = begin;
+   for (; i + 2 <= end; i += 2)
+   {
+      __m128d xi = _mm_loadu_pd(x + i);
+      __m128d yi = _mm_loadu_pd(y + i);
+      _mm_storeu_pd(newx + i, _mm_add_pd(_mm_add_pd(_mm_mul_pd(m00, xi), _mm_mul_pd(m01, yi)), bx));
+      _mm_storeu_pd(newy + i, _mm_add_pd(_mm_add_pd(_mm_mul_pd(m10, xi), _mm_mul_pd(m11, yi)), by));
+   }
+   propagate_scalar(M, b, x, y, newx, newy, i, end);
+}
+
+__attribute__((target("avx2")))
+static
+void propagate_avx2(Mat2x2F64 M, Vec2F64 b, const f64 *x, const f64 *y, f64 *newx, f64 *newy, int begin, int end)
+{
+   __m256d m00 = _mm256_set1_pd(M(0, 0));
+   __m256d m01 = _mm256_set1_pd(M(0, 1));
+   __m256d m10 = _mm256_set1_pd(M(1, 0));
+   __m256d m11 = _mm256_set1_pd(M(1, 1));
+   __m256d bx = _mm256_set1_pd(b.elems[0]);
+   __m256d by = _mm256_set1_pd(b.elems[1]);
+
+   int i = begin;
+   for (; i + 4 <= end; i += 4)
+   {
+      __m256d xi = _mm256_loadu_pd(x + i);
+      __m256d yi = _mm256_loadu_pd(y + i);
+      _mm256_storeu_pd(newx + i, _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m00, xi), _mm256_mul_pd(m01, yi)), bx));
+      _mm256_storeu_pd(newy + i, _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m10, xi), _mm256_mul_pd(m11, yi)), by));
+   }
+   propagate_scalar(M, b, x, y, newx, newy, i, end);
+}
+#endif
+
+#ifdef __wasm_simd128__
+static
+void propagate_wasm128(Mat2x2F64 M, Vec2F64 b, const f64 *x, const f64 *y, f64 *newx, f64 *newy, int begin, int end)
+{
+   v128_t m00 = wasm_f64x2_splat(M(0, 0));
+   v128_t m01 = wasm_f64x2_splat(M(0, 1));
+   v128_t m10 = wasm_f64x2_splat(M(1, 0));
+   v128_t m11 = wasm_f64x2_splat(M(1, 1));
+   v128_t bx = wasm_f64x2_splat(b.elems[0]);
+   v128_t by = wasm_f64x2_splat(b.elems[1]);
+
+   int i = begin;
+   for (; i + 2 <= end; i += 2)
+   {
+      v128_t xi = wasm_v128_load(x + i);
+      v128_t yi = wasm_v128_load(y + i);
+      wasm_v128_store(newx + i, wasm_f64x2_add(wasm_f64x2_add(wasm_f64x2_mul(m00, xi), wasm_f64x2_mul(m01, yi)), bx));
+      wasm_v128_store(newy + i, wasm_f64x2_add(wasm_f64x2_add(wasm_f64x2_mul(m10, xi), wasm_f64x2_mul(m11, yi)), by));
+   }
+   propagate_scalar(M, b, x, y, newx, newy, i, end);
+}
+#endif
+
+static inline
+bool simdlevel_supported(SimdLevel level)
+{
+   switch (level)
+   {
+      case SIMD_SCALAR:
+         return true;
+#ifdef PARTICLES_X86
+      case SIMD_SSE2:
+         return __builtin_cpu_supports("sse2");
+      case SIMD_AVX2:
+         return __builtin_cpu_supports("avx2");
+#endif
+#ifdef __wasm_simd128__
+      // wasm has no runtime feature detection; a module built with -msimd128
+      // fails to load on engines without simd, so reaching here means it works
+      case SIMD_WASM128:
+         return true;
+#endif
+      default:
+         return false;
+   }
+}
+
+static inline
+PropagateKernel propagatekernel(SimdLevel level)
+{
+   assert(simdlevel_supported(level));
+   switch (level)
+   {
+#ifdef PARTICLES_X86
+      case SIMD_SSE2:
+         return propagate_sse2;
+      case SIMD_AVX2:
+         return propagate_avx2;
+#endif
+#ifdef __wasm_simd128__
+      case SIMD_WASM128:
+         return propagate_wasm128;
+#endif
+      default:
+         return propagate_scalar;
+   }
+}
+
+static inline
+SimdLevel best_simdlevel()
+{
+   for (int level = NUM_SIMD_LEVELS - 1; level > SIMD_SCALAR; level -= 1)
+   {
+      if (simdlevel_supported((SimdLevel) level))
+         return (SimdLevel) level;
+   }
+   return SIMD_SCALAR;
+}
+
+static inline
+void setsimdlevel(Particles *p, SimdLevel level)
+{
+   p->simd = level;
+   p->propagate = propagatekernel(level);
+}
+
+// NULL when the memory is not there
+static inline
+void *alignedalloc(size_t alignment, size_t size)
+{
+   void *ptr = NULL;
+   if (posix_memalign(&ptr, alignment, size) != 0)
+      return NULL;
+   return ptr;
+}
+
+static inline
+int particlestride(int count)
+{
+   constexpr int lanes = particle_row_align / sizeof(f64);
+   return (count + lanes - 1) / lanes * lanes;
+}
+
+void freeparticles(Particles *p)
+{
+   free(p->histx);
+   free(p->histy);
+   free(p->birthstep);
+   free(p->basex);
+   free(p->basey);
+   free(p->basetime);
+   memset(p, 0, sizeof(*p));
+}
+
+// Returns false, with p empty, when the memory is not there.
+bool tryinitparticles(Particles *p, int count, int histcapacity)
+{
+   assert(count > 0 && histcapacity > 0);
+   memset(p, 0, sizeof(*p));
+   p->count = count;
+   p->histcapacity = histcapacity;
+   p->stride = particlestride(count);
+   p->curidx = 0;
+   p->stepcount = 0;
+
+   size_t histbytes = (size_t) histcapacity * (size_t) p->stride * sizeof(f64);
+   p->histx = (f64 *) alignedalloc(particle_row_align, histbytes);
+   p->histy = (f64 *) alignedalloc(particle_row_align, histbytes);
+   p->birthstep = (u32 *) malloc((size_t) count * sizeof(u32));
+   p->time = 0;
+   p->basex = (f64 *) alignedalloc(particle_row_align, (size_t) p->stride * sizeof(f64));
+   p->basey = (f64 *) alignedalloc(particle_row_align, (size_t) p->stride * sizeof(f64));
+   p->basetime = (f64 *) alignedalloc(particle_row_align, (size_t) p->stride * sizeof(f64));
+   if (!p->histx || !p->histy || !p->birthstep || !p->basex || !p->basey || !p->basetime)
+   {
+      freeparticles(p);
+      return false;
+   }
+   memset(p->histx, 0, histbytes);
+   memset(p->histy, 0, histbytes);
+   memset(p->birthstep, 0, (size_t) count * sizeof(u32));
+   memset(p->basex, 0, (size_t) p->stride * sizeof(f64));
+   memset(p->basey, 0, (size_t) p->stride * sizeof(f64));
+   memset(p->basetime, 0, (size_t) p->stride * sizeof(f64));
+
+   setsimdlevel(p, best_simdlevel());
+   return true;
+}
+
+void initparticles(Particles *p, int count, int histcapacity)
+{
+   bool ok = tryinitparticles(p, count, histcapacity);
+   AN(ok);
+   (void) ok;
+}
+
+// bytes of particle storage, for display and for sizing before allocating
+static inline
+size_t particlesmemory(int count, int histcapacity)
+{
+   size_t stride = (size_t) particlestride(count);
+   return 2 * (size_t) histcapacity * stride * sizeof(f64)
+        + 3 * stride * sizeof(f64)
+        + (size_t) count * sizeof(u32);
+}
+
+static inline
+size_t particlesmemory(Particles *p)
+{
+   return particlesmemory(p->count, p->histcapacity);
+}
+
+// row `ago` steps before the current one
+static inline
+f64 *histrow(Particles *p, f64 *hist, int ago)
+{
+   assert(ago >= 0 && ago < p->histcapacity);
+   int idx = p->curidx - ago;
+   if (idx < 0)
+      idx += p->histcapacity;
+   return hist + (size_t) idx * (size_t) p->stride;
+}
+
+static inline
+f64 *currentx(Particles *p)
+{
+   return histrow(p, p->histx, 0);
+}
+
+static inline
+f64 *currenty(Particles *p)
+{
+   return histrow(p, p->histy, 0);
+}
+
+// number of valid history entries of particle i, counting the current state
+static inline
+int trailsize(Particles *p, int i)
+{
+   u32 age = p->stepcount - p->birthstep[i];
+   return (int) min((u32) p->histcapacity, age + 1);
+}
+
+// number of those that are drawn: the oldest row of a full history is only
+// there for the next one to be blended from, so no drawn point jumps a step
+static inline
+int drawntrailsize(Particles *p, int i)
+{
+   return min(trailsize(p, i), p->histcapacity - 1);
+}
+
+static inline
+Vec2F64 getRecentPos(Particles *p, int i, int ago)
+{
+   assert(i >= 0 && i < p->count);
+   assert(ago < trailsize(p, i));
+   return {histrow(p, p->histx, ago)[i], histrow(p, p->histy, ago)[i]};
+}
+
+static inline
+Vec2F64 getMostRecentPos(Particles *p, int i)
+{
+   return getRecentPos(p, i, 0);
+}
+
+static inline
+Vec2F64 getLeastRecentPos(Particles *p, int i)
+{
+   return getRecentPos(p, i, trailsize(p, i) - 1);
+}
+
+// starts a new trail for particle i at pos
+static inline
+void spawnparticle(Particles *p, int i, Vec2F64 pos)
+{
+   assert(i >= 0 && i < p->count);
+   currentx(p)[i] = pos.elems[0];
+   currenty(p)[i] = pos.elems[1];
+   p->birthstep[i] = p->stepcount;
+   p->basex[i] = pos.elems[0];
+   p->basey[i] = pos.elems[1];
+   p->basetime[i] = p->time;
+}
+
+struct SpawnJob
+{
+   Particles *p;
+   int begin;
+   Rng *streams;
+   Vec2F64 lo, hi;
+};
+
+static
+void spawnchunk(void *ctx, int begin, int end)
+{
+   SpawnJob *job = (SpawnJob *) ctx;
+   Particles *p = job->p;
+   RngLanes lanes;
+   initlanes(&lanes, (const Rng *) &job->streams[begin / particle_chunk * rng_lanes]);
+   f64 *curx = currentx(p), *cury = currenty(p);
+   f64 *basex = p->basex, *basey = p->basey, *basetime = p->basetime;
+   u32 *birthstep = p->birthstep;
+   f64 time = p->time;
+   u32 stepcount = p->stepcount;
+   // small blocks, so the draws are still in L1 when they are copied
+   constexpr int block = 256;
+   for (int first = job->begin + begin; first < job->begin + end; first += block)
+   {
+      int n = min(block, job->begin + end - first);
+      filluniform(&lanes, curx + first, n, job->lo.elems[0], job->hi.elems[0]);
+      filluniform(&lanes, cury + first, n, job->lo.elems[1], job->hi.elems[1]);
+      memcpy(basex + first, curx + first, (size_t) n * sizeof(f64));
+      memcpy(basey + first, cury + first, (size_t) n * sizeof(f64));
+      for (int i = first; i < first + n; i += 1)
+      {
+         basetime[i] = time;
+         birthstep[i] = stepcount;
+      }
+   }
+}
+
+// spawns particles [begin, count) uniformly in the box [lo, hi]. Every chunk
+// draws from its own stream split off r, so the states only depend on r and
+// not on the pool; r moves past all of them.
+void spawnuniform(Particles *p, int begin, Vec2F64 lo, Vec2F64 hi, Rng *r, ThreadPool *pool = NULL)
+{
+   int n = p->count - begin;
+   if (n <= 0)
+      return;
+   int numchunks = (n + particle_chunk - 1) / particle_chunk;
+   int numstreams = numchunks * rng_lanes;
+   Rng *streams = (Rng *) malloc((size_t) (numstreams + 1) * sizeof(Rng));
+   AN(streams);
+   splitrng(*r, streams, numstreams + 1);
+   *r = streams[numstreams];
+   SpawnJob job = {p, begin, streams, lo, hi};
+   parallelfor(pool, n, particle_chunk, spawnchunk, &job);
+   free(streams);
+}
+
+struct SampledSpawnJob
+{
+   Particles *p;
+   int begin;
+   Sampler *sampler;
+   Vec2F64 lo, hi;
+};
+
+static
+void sampledspawnchunk(void *ctx, int begin, int end)
+{
+   SampledSpawnJob *job = (SampledSpawnJob *) ctx;
+   Vec2F64 size = job->hi - job->lo;
+   for (int i = begin; i < end; i += 1)
+   {
+      Vec2F64 u = samplepoint(job->sampler, job->sampler->index + (u64) i);
+      Vec2F64 pos = {job->lo.elems[0] + u.elems[0] * size.elems[0], job->lo.elems[1] + u.elems[1] * size.elems[1]};
+      spawnparticle(job->p, job->begin + i, pos);
+   }
+}
+
+// spawns particles [begin, count) in the box [lo, hi] at the sampler's next
+// points
+void spawnsampled(Particles *p, int begin, Vec2F64 lo, Vec2F64 hi, Sampler *s, ThreadPool *pool = NULL)
+{
+   int n = p->count - begin;
+   if (n <= 0)
+      return;
+   if (s->mode == SAMPLE_RANDOM)
+   {
+      spawnuniform(p, begin, lo, hi, &s->rng, pool);
+      return;
+   }
+   SampledSpawnJob job = {p, begin, s, lo, hi};
+   parallelfor(pool, n, particle_chunk, sampledspawnchunk, &job);
+   s->index += (u64) n;
+}
+
+// moves the current row forward by one, leaving the new row for the caller to fill
+static inline
+void advancehistory(Particles *p)
+{
+   p->curidx = (p->curidx + 1) % p->histcapacity;
+   p->stepcount += 1;
+}
+
+struct PropagateJob
+{
+   Particles *p;
+   Mat2x2F64 M;
+   Vec2F64 b;
+   const f64 *x, *y;
+   f64 *newx, *newy;
+};
+
+static
+void propagatechunk(void *ctx, int begin, int end)
+{
+   PropagateJob *job = (PropagateJob *) ctx;
+   job->p->propagate(job->M, job->b, job->x, job->y, job->newx, job->newy, begin, end);
+}
+
+// x <- M x + b for every particle, spread over the pool if there is one
+void propagateparticles(Particles *p, Mat2x2F64 M, Vec2F64 b, ThreadPool *pool = NULL)
+{
+   PropagateJob job;
+   job.p = p;
+   job.M = M;
+   job.b = b;
+   job.x = currentx(p);
+   job.y = currenty(p);
+   advancehistory(p);
+   job.newx = currentx(p);
+   job.newy = currenty(p);
+   parallelfor(pool, p->count, particle_chunk, propagatechunk, &job);
+}
+
+void propagateparticles(Particles *p, Mat2x2F64 M, ThreadPool *pool = NULL)
+{
+   propagateparticles(p, M, Vec2F64(), pool);
+}
+
+enum ParticleFate
+{
+   FATE_LIVE,
+   FATE_OFFSCREEN,  // outside the box
+   FATE_STALLED,    // moved less than the minimum over the last step
+};
+
+struct ClassifyJob
+{
+   Particles *p;
+   Vec2F64 lo, hi;
+   f64 minstep2;
+   u8 *fate;
+   int *counts;  // per chunk, one count per fate
+};
+
+static
+void classifychunk(void *ctx, int begin, int end)
+{
+   ClassifyJob *job = (ClassifyJob *) ctx;
+   Particles *p = job->p;
+   const f64 *x = currentx(p);
+   const f64 *y = currenty(p);
+   const f64 *prevx = histrow(p, p->histx, 1);
+   const f64 *prevy = histrow(p, p->histy, 1);
+   f64 xlo = job->lo.elems[0], ylo = job->lo.elems[1];
+   f64 xhi = job->hi.elems[0], yhi = job->hi.elems[1];
+   int counts[3] = {0, 0, 0};
+   for (int i = begin; i < end; i += 1)
+   {
+      u8 fate = FATE_LIVE;
+      f64 dx = x[i] - prevx[i];
+      f64 dy = y[i] - prevy[i];
+      if (!(x[i] >= xlo && x[i] <= xhi && y[i] >= ylo && y[i] <= yhi))
+         fate = FATE_OFFSCREEN;
+      else if (dx * dx + dy * dy < job->minstep2 && trailsize(p, i) >= 2)
+         fate = FATE_STALLED;
+      job->fate[i] = fate;
+      counts[fate] += 1;
+   }
+   memcpy(&job->counts[begin / particle_chunk * 3], counts, sizeof(counts));
+}
+
+// Sorts every particle into live, off-screen (outside [lo, hi], NaN included)
+// or stalled (moved less than minstep over its last step) and returns the
+// number of each in counts.
+void classifyparticles(Particles *p, Vec2F64 lo, Vec2F64 hi, f64 minstep, u8 *fate, int counts[3], ThreadPool *pool = NULL)
+{
+   int numchunks = (p->count + particle_chunk - 1) / particle_chunk;
+   int *chunkcounts = (int *) malloc((size_t) numchunks * 3 * sizeof(int));
+   AN(chunkcounts);
+   ClassifyJob job = {p, lo, hi, minstep * minstep, fate, chunkcounts};
+   parallelfor(pool, p->count, particle_chunk, classifychunk, &job);
+   counts[0] = counts[1] = counts[2] = 0;
+   for (int c = 0; c < numchunks * 3; c += 1)
+      counts[c % 3] += chunkcounts[c];
+   free(chunkcounts);
+}
+
+#define bounds_block 256  // particles per pass over the rows
+
+struct TrailBoundsJob
+{
+   Particles *p;
+   Vec2F64 lo, hi;
+   u8 *fate;
+};
+
+static
+void trailboundschunk(void *ctx, int begin, int end)
+{
+   TrailBoundsJob *job = (TrailBoundsJob *) ctx;
+   Particles *p = job->p;
+   f64 xlo = job->lo.elems[0], ylo = job->lo.elems[1];
+   f64 xhi = job->hi.elems[0], yhi = job->hi.elems[1];
+   f64 xmin[bounds_block], xmax[bounds_block], ymin[bounds_block], ymax[bounds_block];
+   int sizes[bounds_block];
+   for (int blockbegin = begin; blockbegin < end; blockbegin += bounds_block)
+   {
+      int count = min(bounds_block, end - blockbegin);
+      const f64 *x = currentx(p) + blockbegin;
+      const f64 *y = currenty(p) + blockbegin;
+      int longest = 1;
+      for (int k = 0; k < count; k += 1)
+      {
+         xmin[k] = xmax[k] = x[k];
+         ymin[k] = ymax[k] = y[k];
+         sizes[k] = trailsize(p, blockbegin + k);
+         longest = max(longest, sizes[k]);
+      }
+      for (int ago = 1; ago < longest; ago += 1)
+      {
+         const f64 *hx = histrow(p, p->histx, ago) + blockbegin;
+         const f64 *hy = histrow(p, p->histy, ago) + blockbegin;
+         for (int k = 0; k < count; k += 1)
+         {
+            if (ago >= sizes[k])
+               continue;
+            // a NaN stays in the bounds and culls the trail
+            xmin[k] = hx[k] < xmin[k] ? hx[k] : xmin[k];
+            xmax[k] = hx[k] > xmax[k] ? hx[k] : xmax[k];
+            ymin[k] = hy[k] < ymin[k] ? hy[k] : ymin[k];
+            ymax[k] = hy[k] > ymax[k] ? hy[k] : ymax[k];
+         }
+      }
+      for (int k = 0; k < count; k += 1)
+      {
+         bool overlaps = xmax[k] >= xlo && xmin[k] <= xhi && ymax[k] >= ylo && ymin[k] <= yhi;
+         job->fate[blockbegin + k] = overlaps ? FATE_LIVE : FATE_OFFSCREEN;
+      }
+   }
+}
+
+// FATE_OFFSCREEN for the particles whose whole trail, the bounding box of
+// its history, is outside [lo, hi], FATE_LIVE for the rest. Unlike
+// classifyparticles() a trail whose head left the box keeps being drawn.
+void classifytrails(Particles *p, Vec2F64 lo, Vec2F64 hi, u8 *fate, ThreadPool *pool = NULL)
+{
+   TrailBoundsJob job = {p, lo, hi, fate};
+   parallelfor(pool, p->count, particle_chunk, trailboundschunk, &job);
+}
+
+// Reallocates the store for a new particle count and trail length. Particles
+// that exist in both keep their state and as much of their trail as fits;
+// new particles are left at the origin with an empty trail for the caller to
+// spawn.
+// The new store is allocated before the old one is freed; returns false, with
+// p as it was, when there is no room for it.
+bool resizeparticles(Particles *p, int count, int histcapacity)
+{
+   Particles q;
+   if (!tryinitparticles(&q, count, histcapacity))
+      return false;
+   setsimdlevel(&q, p->simd);
+
+   int keepcount = min(p->count, count);
+   int keeprows = min(p->histcapacity, histcapacity);
+   q.curidx = keeprows - 1;
+   q.stepcount = p->stepcount;
+   q.time = p->time;
+   memcpy(q.basex, p->basex, (size_t) keepcount * sizeof(f64));
+   memcpy(q.basey, p->basey, (size_t) keepcount * sizeof(f64));
+   memcpy(q.basetime, p->basetime, (size_t) keepcount * sizeof(f64));
+   for (int ago = 0; ago < keeprows; ago += 1)
+   {
+      memcpy(histrow(&q, q.histx, ago), histrow(p, p->histx, ago), (size_t) keepcount * sizeof(f64));
+      memcpy(histrow(&q, q.histy, ago), histrow(p, p->histy, ago), (size_t) keepcount * sizeof(f64));
+   }
+   // trails are clamped to the rows that were copied
+   for (int i = 0; i < keepcount; i += 1)
+   {
+      int size = min(trailsize(p, i), keeprows);
+      q.birthstep[i] = q.stepcount - (u32) (size - 1);
+   }
+   for (int i = keepcount; i < count; i += 1)
+   {
+      q.birthstep[i] = q.stepcount;
+      q.basetime[i] = q.time;
+   }
+
+   freeparticles(p);
+   *p = q;
+   return true;
+}
+
+// the current states become the base states, e.g. before A changes
+void rebaseparticles(Particles *p)
+{
+   memcpy(p->basex, currentx(p), (size_t) p->count * sizeof(f64));
+   memcpy(p->basey, currenty(p), (size_t) p->count * sizeof(f64));
+   for (int i = 0; i < p->count; i += 1)
+      p->basetime[i] = p->time;
+}
+
+struct AnalyticJob
+{
+   Particles *p;
+   Mat2x2F64 A;
+   f64 time;
+   f64 *newx, *newy;
+};
+
+static
+void analyticchunk(void *ctx, int begin, int end)
+{
+   AnalyticJob *job = (AnalyticJob *) ctx;
+   Particles *p = job->p;
+   // after a rebase most particles share a base time, so the exponential is
+   // only recomputed when it changes
+   f64 lastbasetime = NAN;
+   Mat2x2F64 E = Identity2x2();
+   for (int i = begin; i < end; i += 1)
+   {
+      if (p->basetime[i] != lastbasetime)
+      {
+         lastbasetime = p->basetime[i];
+         E = expm_closedform((job->time - lastbasetime) * job->A);
+      }
+      f64 bx = p->basex[i];
+      f64 by = p->basey[i];
+      job->newx[i] = E(0, 0) * bx + E(0, 1) * by;
+      job->newy[i] = E(1, 0) * bx + E(1, 1) * by;
+   }
+}
+
+// new row with every particle at `time` under dx/dt = A x
+void evaluateparticles(Particles *p, Mat2x2F64 A, f64 time, ThreadPool *pool = NULL)
+{
+   advancehistory(p);
+   AnalyticJob job = {p, A, time, currentx(p), currenty(p)};
+   p->time = time;
+   parallelfor(pool, p->count, particle_chunk, analyticchunk, &job);
+}
+
+// Jumps to `time` without going through the steps in between: the current row
+// is evaluated directly and the older rows are filled by stepping back rowdt at
+// a time, so every particle gets a full trail ending at `time`.
+void seekparticles(Particles *p, Mat2x2F64 A, f64 time, f64 rowdt, ThreadPool *pool = NULL)
+{
+   AnalyticJob job = {p, A, time, currentx(p), currenty(p)};
+   p->time = time;
+   parallelfor(pool, p->count, particle_chunk, analyticchunk, &job);
+
+   PropagateJob back;
+   back.p = p;
+   back.M = expm_closedform(-rowdt * A);
+   back.b = Vec2F64();
+   for (int ago = 1; ago < p->histcapacity; ago += 1)
+   {
+      back.x = histrow(p, p->histx, ago - 1);
+      back.y = histrow(p, p->histy, ago - 1);
+      back.newx = histrow(p, p->histx, ago);
+      back.newy = histrow(p, p->histy, ago);
+      parallelfor(pool, p->count, particle_chunk, propagatechunk, &back);
+   }
+   for (int i = 0; i < p->count; i += 1)
+      p->birthstep[i] = p->stepcount - (u32) (p->histcapacity - 1);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "useful_utils.cpp"
+
+// A screen-sized render texture that keeps what was drawn into it and fades
+// it a little every frame, like the phosphor of an oscilloscope. Trails drawn
+// one segment per frame into it look as long as the decay makes them, at no
+// cost per point of trail.
+//
+// The texture holds premultiplied colors over a transparent background.
+// Fading scales all four channels, and then takes off one step of 8 bits,
+// so faint pixels reach zero instead of getting stuck where rounding
+// cancels the scaling.
+//
+// Both steps are 8 bit, which puts a ceiling on how slow the fade can be:
+// the factor is a multiple of 1/255, and with the step taken off a pixel
+// lasts at most 255 frames. Below a factor of 1, a full pixel halves in
+// about 64 frames at the most, about a second at 60 fps.
+
+struct PersistenceBuffer
+{
+   RenderTexture2D target;
+   int width, height;
+   bool valid;
+};
+
+void freepersistence(PersistenceBuffer *pb)
+{
+   if (pb->valid)
+      UnloadRenderTexture(pb->target);
+   *pb = {};
+}
+
+void clearpersistence(PersistenceBuffer *pb)
+{
+   if (!pb->valid)
+      return;
+   BeginTextureMode(pb->target);
+   ClearBackground(BLANK);
+   EndTextureMode();
+}
+
+// share of the brightness left after dt seconds
+static inline
+f32 persistencefactor(f32 dt, f32 halflife)
+{
+   if (!(halflife > 0))
+      return 0;
+   return powf(0.5f, dt / halflife);
+}
+
+// Starts drawing into the buffer, after fading what is in it by `factor`.
+// Resizing the buffer clears it. Returns true if the buffer was cleared.
+bool beginpersistence(PersistenceBuffer *pb, int width, int height, f32 factor)
+{
+   bool cleared = false;
+   if (!pb->valid || pb->width != width || pb->height != height)
+   {
+      freepersistence(pb);
+      pb->target = LoadRenderTexture(width, height);
+      pb->width = width;
+      pb->height = height;
+      pb->valid = true;
+      clearpersistence(pb);
+      cleared = true;
+   }
+   BeginTextureMode(pb->target);
+   if (factor < 1)
+   {
+      // dst = dst * src.a
+      rlSetBlendFactors(RL_ZERO, RL_SRC_ALPHA, RL_FUNC_ADD);
+      BeginBlendMode(BLEND_CUSTOM);
+      DrawRectangle(0, 0, width, height, (Color){0, 0, 0, (unsigned char) (255 * factor + 0.5f)});
+      EndBlendMode();
+      // dst = dst - src
+      rlSetBlendFactors(RL_ONE, RL_ONE, RL_FUNC_REVERSE_SUBTRACT);
+      BeginBlendMode(BLEND_CUSTOM);
+      DrawRectangle(0, 0, width, height, (Color){1, 1, 1, 1});
+      EndBlendMode();
+   }
+   return cleared;
+}
+
+void endpersistence(PersistenceBuffer *pb)
+{
+   EndTextureMode();
+}
+
+void drawpersistence(PersistenceBuffer *pb)
+{
+   if (!pb->valid)
+      return;
+   BeginBlendMode(BLEND_ALPHA_PREMULTIPLY);
+   // render textures are stored bottom up
+   Rectangle source = {0, 0, (f32) pb->width, (f32) -pb->height};
+   DrawTextureRec(pb->target.texture, source, (Vector2){0, 0}, WHITE);
+   EndBlendMode();
+}
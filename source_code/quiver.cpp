@@ -0,0 +1,108 @@
+#pragma once
+
+#include "useful_utils.cpp"
+#include "linearalgebra.cpp"
+#include "view_transform.cpp"
+#include "draw_backend.cpp"
+
+// Direction field of dx/dt = A x on a grid that is fixed in screen space, so
+// the number of arrows does not depend on the zoom. Every arrow has the same
+// length and points along the flow; its opacity grows with the speed. The
+// line segments are built once per change of A or the view and drawn as one
+// batch of lines.
+
+#define quiver_verts_per_arrow 6  // shaft and two strokes of the head
+
+struct Quiver
+{
+   int numarrows;
+   int capacity;
+   Vector2 *verts;
+   Color *colors;  // one per vertex
+   f32 *speeds;    // scratch for the first pass
+};
+
+void freequiver(Quiver *q)
+{
+   free(q->verts);
+   free(q->colors);
+   free(q->speeds);
+   q->verts = NULL;
+   q->colors = NULL;
+   q->speeds = NULL;
+   q->numarrows = 0;
+   q->capacity = 0;
+}
+
+void buildquiver(Quiver *q, Mat2x2F64 A, const ViewTransform *vt, int width, int height, int spacing, Color color)
+{
+   assert(spacing > 0);
+   int cols = width / spacing + 1;
+   int rows = height / spacing + 1;
+   int count = cols * rows;
+   if (count > q->capacity)
+   {
+      freequiver(q);
+      q->verts = (Vector2 *) malloc((size_t) count * quiver_verts_per_arrow * sizeof(Vector2));
+      q->colors = (Color *) malloc((size_t) count * quiver_verts_per_arrow * sizeof(Color));
+      q->speeds = (f32 *) malloc((size_t) count * sizeof(f32));
+      AN(q->verts);
+      AN(q->colors);
+      AN(q->speeds);
+      q->capacity = count;
+   }
+
+   // through the origin so the arrows line up with the axes
+   f32 x0 = (f32) fmod(vt->ox, spacing);
+   f32 y0 = (f32) fmod(vt->oy, spacing);
+   x0 += x0 < 0 ? (f32) spacing : 0;
+   y0 += y0 < 0 ? (f32) spacing : 0;
+   f32 halflength = 0.4f * (f32) spacing;
+   f32 headlength = 0.35f * (f32) spacing;
+   const f32 headcos = 0.906f, headsin = 0.423f;  // 25 degrees
+   f32 maxspeed = 0;
+   int n = 0;
+   for (int r = 0; r < rows; r += 1)
+   {
+      for (int c = 0; c < cols; c += 1)
+      {
+         f32 px = x0 + (f32) (c * spacing);
+         f32 py = y0 + (f32) (r * spacing);
+         Vec2F64 x = pixeltoview(vt, {(f64) px, (f64) py});
+         Vec2F64 v = matvecmul(A, x);
+         f32 speed = (f32) sqrt(v.elems[0] * v.elems[0] + v.elems[1] * v.elems[1]);
+         if (!(speed > 0) || !isfinite(speed))
+            continue;
+         // screen y points down
+         f32 dx = (f32) v.elems[0] / speed;
+         f32 dy = -(f32) v.elems[1] / speed;
+         Vector2 tip = {px + halflength * dx, py + halflength * dy};
+         Vector2 *vert = &q->verts[n * quiver_verts_per_arrow];
+         vert[0] = {px - halflength * dx, py - halflength * dy};
+         vert[1] = tip;
+         vert[2] = tip;
+         vert[3] = {tip.x - headlength * (headcos * dx - headsin * dy), tip.y - headlength * (headsin * dx + headcos * dy)};
+         vert[4] = tip;
+         vert[5] = {tip.x - headlength * (headcos * dx + headsin * dy), tip.y - headlength * (-headsin * dx + headcos * dy)};
+         q->speeds[n] = speed;
+         maxspeed = max(maxspeed, speed);
+         n += 1;
+      }
+   }
+   q->numarrows = n;
+
+   // log scale, so slow regions stay visible next to fast ones
+   f32 lognorm = 1 / logf(1 + maxspeed);
+   for (int i = 0; i < n; i += 1)
+   {
+      Color c = color;
+      c.a = (unsigned char) ((f32) color.a * (0.2f + 0.8f * logf(1 + q->speeds[i]) * lognorm));
+      for (int k = 0; k < quiver_verts_per_arrow; k += 1)
+         q->colors[i * quiver_verts_per_arrow + k] = c;
+   }
+}
+
+void drawquiver(Quiver *q, DrawBackend *b)
+{
+   b->lines(b->ctx, q->verts, q->colors, q->numarrows * quiver_verts_per_arrow, 1);
+}
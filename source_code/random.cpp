@@ -0,0 +1,289 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "useful_utils.cpp"
+
+#if defined(__SSE2__)
+   #include <emmintrin.h>
+#endif
+
+// xoshiro256** (Blackman and Vigna, https://prng.di.unimi.it/). Seeded through
+// splitmix64, so any u64 is a fine seed. jumprng advances a generator by 2^128
+// draws, which splits one seed into streams that never overlap in practice;
+// parallel work gives every chunk its own stream, so the result only depends
+// on the seed and not on the number of threads.
+//
+// The batch functions run rng_lanes generators side by side with the state
+// stored lane-innermost, so one vector register holds the same word of
+// several generators. The SSE2 and scalar paths give the same numbers.
+
+#define rng_lanes 4
+
+struct Rng
+{
+   u64 s[4];
+};
+
+struct RngLanes
+{
+   alignas(32) u64 s[4][rng_lanes];
+};
+
+static inline
+u64 rotl(u64 x, int k)
+{
+   return (x << k) | (x >> (64 - k));
+}
+
+static inline
+u64 splitmix64(u64 *state)
+{
+   u64 z = (*state += 0x9e3779b97f4a7c15ull);
+   z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+   z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+   return z ^ (z >> 31);
+}
+
+static inline
+void seedrng(Rng *r, u64 seed)
+{
+   for (int i = 0; i < 4; i += 1)
+      r->s[i] = splitmix64(&seed);
+}
+
+static inline
+u64 nextu64(Rng *r)
+{
+   u64 *s = r->s;
+   u64 result = rotl(s[1] * 5, 7) * 9;
+   u64 t = s[1] << 17;
+   s[2] ^= s[0];
+   s[3] ^= s[1];
+   s[1] ^= s[2];
+   s[0] ^= s[3];
+   s[2] ^= t;
+   s[3] = rotl(s[3], 45);
+   return result;
+}
+
+static inline
+void jumprng(Rng *r)
+{
+   static const u64 jump[4] = {0x180ec6d33cfd0abaull, 0xd5a61266f0c9392cull, 0xa9582618e03fc9aaull, 0x39abdc4529b1661cull};
+   u64 s[4] = {0, 0, 0, 0};
+   for (int i = 0; i < 4; i += 1)
+   {
+      for (int b = 0; b < 64; b += 1)
+      {
+         if (jump[i] & ((u64) 1 << b))
+         {
+            for (int k = 0; k < 4; k += 1)
+               s[k] ^= r->s[k];
+         }
+         nextu64(r);
+      }
+   }
+   memcpy(r->s, s, sizeof(s));
+}
+
+// n consecutive streams starting at r, each one jump after the previous
+static inline
+void splitrng(Rng r, Rng *streams, int n)
+{
+   for (int i = 0; i < n; i += 1)
+   {
+      streams[i] = r;
+      jumprng(&r);
+   }
+}
+
+// uniform in [0, 1) with all 53 bits of the mantissa random
+static inline
+f64 tounit(u64 x)
+{
+   return (f64) (x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline
+f64 randuniform(Rng *r, f64 lo, f64 hi)
+{
+   return lo + tounit(nextu64(r)) * (hi - lo);
+}
+
+// Box-Muller; the second value of the pair is thrown away
+static inline
+f64 randnormal(Rng *r, f64 mean, f64 sd)
+{
+   f64 u = 1 - tounit(nextu64(r));  // (0, 1], so the log is finite
+   f64 v = tounit(nextu64(r));
+   return mean + sd * sqrt(-2 * log(u)) * cos(2 * 3.14159265358979323846 * v);
+}
+
+// lane j continues streams[j]
+static inline
+void initlanes(RngLanes *l, const Rng *streams)
+{
+   for (int k = 0; k < 4; k += 1)
+      for (int j = 0; j < rng_lanes; j += 1)
+         l->s[k][j] = streams[j].s[k];
+}
+
+// lanes from the streams starting at r; r moves past all of them
+static inline
+void initlanes(RngLanes *l, Rng *r)
+{
+   Rng streams[rng_lanes + 1];
+   splitrng(*r, streams, rng_lanes + 1);
+   initlanes(l, (const Rng *) streams);
+   *r = streams[rng_lanes];
+}
+
+static inline
+void nextlanes(RngLanes *l, u64 *out)
+{
+   UNROLL
+   for (int j = 0; j < rng_lanes; j += 1)
+   {
+      u64 s0 = l->s[0][j], s1 = l->s[1][j], s2 = l->s[2][j], s3 = l->s[3][j];
+      out[j] = rotl(s1 * 5, 7) * 9;
+      u64 t = s1 << 17;
+      s2 ^= s0;
+      s3 ^= s1;
+      s1 ^= s2;
+      s0 ^= s3;
+      s2 ^= t;
+      s3 = rotl(s3, 45);
+      l->s[0][j] = s0;
+      l->s[1][j] = s1;
+      l->s[2][j] = s2;
+      l->s[3][j] = s3;
+   }
+}
+
+// uniform in [0, 1) from the top 52 bits by building a double in [1, 2)
+// directly, which unlike an integer conversion has a vector form everywhere
+static inline
+f64 tounit52(u64 x)
+{
+   u64 bits = (x >> 12) | 0x3ff0000000000000ull;
+   f64 d;
+   memcpy(&d, &bits, sizeof(d));
+   return d - 1;
+}
+
+#if defined(__SSE2__)
+static inline
+__m128i rotl_sse2(__m128i x, int k)
+{
+   return _mm_or_si128(_mm_slli_epi64(x, k), _mm_srli_epi64(x, 64 - k));
+}
+
+// numblocks * rng_lanes uniform values; * 5 and * 9 become shifts and adds,
+// since SSE2 has no 64-bit multiply
+static
+void uniformblocks(RngLanes *l, f64 *out, int numblocks, f64 lo, f64 width)
+{
+   constexpr int nv = rng_lanes / 2;
+   __m128i s0[nv], s1[nv], s2[nv], s3[nv];
+   for (int v = 0; v < nv; v += 1)
+   {
+      s0[v] = _mm_load_si128((__m128i *) &l->s[0][2 * v]);
+      s1[v] = _mm_load_si128((__m128i *) &l->s[1][2 * v]);
+      s2[v] = _mm_load_si128((__m128i *) &l->s[2][2 * v]);
+      s3[v] = _mm_load_si128((__m128i *) &l->s[3][2 * v]);
+   }
+   const __m128i one = _mm_set1_epi64x(0x3ff0000000000000ll);
+   const __m128d vone = _mm_set1_pd(1);
+   const __m128d vlo = _mm_set1_pd(lo);
+   const __m128d vwidth = _mm_set1_pd(width);
+   for (int b = 0; b < numblocks; b += 1)
+   {
+      UNROLL
+      for (int v = 0; v < nv; v += 1)
+      {
+         __m128i r = _mm_add_epi64(s1[v], _mm_slli_epi64(s1[v], 2));
+         r = rotl_sse2(r, 7);
+         r = _mm_add_epi64(r, _mm_slli_epi64(r, 3));
+         __m128d unit = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(_mm_srli_epi64(r, 12), one)), vone);
+         _mm_storeu_pd(out + b * rng_lanes + 2 * v, _mm_add_pd(vlo, _mm_mul_pd(unit, vwidth)));
+
+         __m128i t = _mm_slli_epi64(s1[v], 17);
+         s2[v] = _mm_xor_si128(s2[v], s0[v]);
+         s3[v] = _mm_xor_si128(s3[v], s1[v]);
+         s1[v] = _mm_xor_si128(s1[v], s2[v]);
+         s0[v] = _mm_xor_si128(s0[v], s3[v]);
+         s2[v] = _mm_xor_si128(s2[v], t);
+         s3[v] = rotl_sse2(s3[v], 45);
+      }
+   }
+   for (int v = 0; v < nv; v += 1)
+   {
+      _mm_store_si128((__m128i *) &l->s[0][2 * v], s0[v]);
+      _mm_store_si128((__m128i *) &l->s[1][2 * v], s1[v]);
+      _mm_store_si128((__m128i *) &l->s[2][2 * v], s2[v]);
+      _mm_store_si128((__m128i *) &l->s[3][2 * v], s3[v]);
+   }
+}
+#else
+static
+void uniformblocks(RngLanes *l, f64 *out, int numblocks, f64 lo, f64 width)
+{
+   u64 bits[rng_lanes];
+   for (int b = 0; b < numblocks; b += 1)
+   {
+      nextlanes(l, bits);
+      for (int j = 0; j < rng_lanes; j += 1)
+         out[b * rng_lanes + j] = lo + tounit52(bits[j]) * width;
+   }
+}
+#endif
+
+// n uniform values in [lo, hi) drawn from the lanes
+void filluniform(RngLanes *l, f64 *out, int n, f64 lo, f64 hi)
+{
+   f64 width = hi - lo;
+   int numblocks = n / rng_lanes;
+   uniformblocks(l, out, numblocks, lo, width);
+   int done = numblocks * rng_lanes;
+   if (done < n)
+   {
+      u64 bits[rng_lanes];
+      nextlanes(l, bits);
+      for (int j = 0; j < n - done; j += 1)
+         out[done + j] = lo + tounit52(bits[j]) * width;
+   }
+}
+
+// n normal values; Box-Muller over pairs of uniform blocks, using both outputs
+void fillnormal(RngLanes *l, f64 *out, int n, f64 mean, f64 sd)
+{
+   u64 ubits[rng_lanes];
+   u64 vbits[rng_lanes];
+   const f64 twopi = 2 * 3.14159265358979323846;
+   for (int i = 0; i < n; i += 2 * rng_lanes)
+   {
+      nextlanes(l, ubits);
+      nextlanes(l, vbits);
+      for (int j = 0; j < rng_lanes; j += 1)
+      {
+         f64 radius = sd * sqrt(-2 * log(1 - tounit(ubits[j])));
+         f64 angle = twopi * tounit(vbits[j]);
+         if (i + j < n)
+            out[i + j] = mean + radius * cos(angle);
+         if (i + rng_lanes + j < n)
+            out[i + rng_lanes + j] = mean + radius * sin(angle);
+      }
+   }
+}
+
+// generator for one-off draws on the main thread, e.g. spawning a single
+// particle at the mouse
+Rng mainrng = {{0x9e3779b97f4a7c15ull, 0xbf58476d1ce4e5b9ull, 0x94d049bb133111ebull, 1}};
+
+static inline
+f64 randfloat64(f64 minval, f64 maxval)
+{
+   return randuniform(&mainrng, minval, maxval);
+}
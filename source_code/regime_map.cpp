@@ -0,0 +1,211 @@
+#pragma once
+
+#include "useful_utils.cpp"
+#include "linearalgebra.cpp"
+#include "threadpool.cpp"
+
+// Where A sits among the stability regimes of dx/dt = A x. The eigenvalues
+// only depend on the trace and the determinant,
+//    lambda = tr/2 +- sqrt(tr^2/4 - det),
+// so a map over (tr, det) shows every regime at once. The other map is a
+// slice through A11 and A12 with A21 and A22 held at their current values.
+//
+// Centers (tr = 0, det > 0) and degenerate systems (det = 0 or a repeated
+// eigenvalue) are curves, so a pixel gets those classes when the curve passes
+// through it, judged from how much tr and det change across one pixel.
+
+enum Regime
+{
+   REGIME_SADDLE,
+   REGIME_STABLE_NODE,
+   REGIME_UNSTABLE_NODE,
+   REGIME_STABLE_SPIRAL,
+   REGIME_UNSTABLE_SPIRAL,
+   REGIME_CENTER,
+   REGIME_DEGENERATE,
+   NUM_REGIMES,
+};
+
+const char *regime_names[NUM_REGIMES] = {
+   "saddle",
+   "stable node",
+   "unstable node",
+   "stable spiral",
+   "unstable spiral",
+   "center",
+   "degenerate",
+};
+
+const Color regime_colors[NUM_REGIMES] = {
+   {230, 200, 120, 255},
+   {120, 170, 230, 255},
+   {230, 130, 120, 255},
+   {170, 210, 240, 255},
+   {240, 180, 170, 255},
+   { 40, 140,  60, 255},
+   { 60,  60,  60, 255},
+};
+
+enum RegimeMapMode
+{
+   REGIMEMAP_TRACEDET,
+   REGIMEMAP_SLICE,
+};
+
+struct RegimeMapView
+{
+   int mode;
+   f64 cx, cy;       // center of the map
+   f64 halfwidth;    // of the square shown
+   f64 a21, a22;     // held fixed in the slice
+};
+
+#define regime_tile 32
+
+// Classifies n systems from their traces and determinants. trtol and dettol
+// are half the change of tr and det across one pixel.
+void classifyregimes(const f64 *tr, const f64 *det, u8 *regime, int n, f64 trtol, f64 dettol)
+{
+   for (int i = 0; i < n; i += 1)
+   {
+      f64 t = tr[i];
+      f64 d = det[i];
+      f64 disc = 0.25 * t * t - d;
+      f64 disctol = fabs(t) * trtol + dettol;
+      u8 r;
+      if (fabs(d) <= dettol || fabs(disc) <= disctol)
+         r = REGIME_DEGENERATE;
+      else if (d < 0)
+         r = REGIME_SADDLE;
+      else if (fabs(t) <= trtol)
+         r = REGIME_CENTER;
+      else if (disc > 0)
+         r = t < 0 ? REGIME_STABLE_NODE : REGIME_UNSTABLE_NODE;
+      else
+         r = t < 0 ? REGIME_STABLE_SPIRAL : REGIME_UNSTABLE_SPIRAL;
+      regime[i] = r;
+   }
+}
+
+// map coordinates of pixel (px, py), y up, pixel centers
+static inline
+Vec2F64 regimemapcoords(RegimeMapView *view, int size, f64 px, f64 py)
+{
+   f64 scale = 2 * view->halfwidth / size;
+   return {view->cx + (px - 0.5 * size) * scale, view->cy - (py - 0.5 * size) * scale};
+}
+
+static inline
+Vec2F64 regimemappixel(RegimeMapView *view, int size, Vec2F64 coords)
+{
+   f64 scale = size / (2 * view->halfwidth);
+   return {(coords.elems[0] - view->cx) * scale + 0.5 * size, -(coords.elems[1] - view->cy) * scale + 0.5 * size};
+}
+
+// the point of the map for A
+static inline
+Vec2F64 regimemapposition(RegimeMapView *view, Mat2x2F64 A)
+{
+   if (view->mode == REGIMEMAP_TRACEDET)
+      return {A(0, 0) + A(1, 1), A(0, 0) * A(1, 1) - A(0, 1) * A(1, 0)};
+   return {A(0, 0), A(0, 1)};
+}
+
+// A moved to the point of the map, changing as little of A as it can
+Mat2x2F64 regimemapmatrix(RegimeMapView *view, Mat2x2F64 A, Vec2F64 point)
+{
+   if (view->mode == REGIMEMAP_SLICE)
+   {
+      A(0, 0) = point.elems[0];
+      A(0, 1) = point.elems[1];
+      return A;
+   }
+   // shifting by a multiple of I sets the trace, then one off-diagonal entry
+   // sets the determinant without touching the trace
+   f64 tr = A(0, 0) + A(1, 1);
+   f64 shift = 0.5 * (point.elems[0] - tr);
+   A(0, 0) += shift;
+   A(1, 1) += shift;
+   f64 det = A(0, 0) * A(1, 1) - A(0, 1) * A(1, 0);
+   f64 change = det - point.elems[1];
+   if (A(1, 0) != 0)
+      A(0, 1) += change / A(1, 0);
+   else if (A(0, 1) != 0)
+      A(1, 0) += change / A(0, 1);
+   else
+   {
+      A(0, 1) = 1;
+      A(1, 0) = change;
+   }
+   return A;
+}
+
+struct RegimeMapJob
+{
+   RegimeMapView *view;
+   int size;
+   int tilesperrow;
+   Color *pixels;
+};
+
+static
+void regimemaptiles(void *ctx, int begin, int end)
+{
+   RegimeMapJob *job = (RegimeMapJob *) ctx;
+   RegimeMapView *view = job->view;
+   int size = job->size;
+   f64 scale = 2 * view->halfwidth / size;
+   f64 trtol, dettol;
+   if (view->mode == REGIMEMAP_TRACEDET)
+   {
+      trtol = 0.5 * scale;
+      dettol = 0.5 * scale;
+   }
+   else
+   {
+      // tr = a11 + a22 and det = a11 a22 - a12 a21
+      trtol = 0.5 * scale;
+      dettol = 0.5 * scale * (fabs(view->a22) + fabs(view->a21));
+   }
+
+   f64 tr[regime_tile * regime_tile];
+   f64 det[regime_tile * regime_tile];
+   u8 regime[regime_tile * regime_tile];
+   for (int tile = begin; tile < end; tile += 1)
+   {
+      int x0 = (tile % job->tilesperrow) * regime_tile;
+      int y0 = (tile / job->tilesperrow) * regime_tile;
+      int w = min(regime_tile, size - x0);
+      int h = min(regime_tile, size - y0);
+      for (int y = 0; y < h; y += 1)
+      {
+         for (int x = 0; x < w; x += 1)
+         {
+            Vec2F64 c = regimemapcoords(view, size, x0 + x + 0.5, y0 + y + 0.5);
+            int k = y * w + x;
+            if (view->mode == REGIMEMAP_TRACEDET)
+            {
+               tr[k] = c.elems[0];
+               det[k] = c.elems[1];
+            }
+            else
+            {
+               tr[k] = c.elems[0] + view->a22;
+               det[k] = c.elems[0] * view->a22 - c.elems[1] * view->a21;
+            }
+         }
+      }
+      classifyregimes(tr, det, regime, w * h, trtol, dettol);
+      for (int y = 0; y < h; y += 1)
+         for (int x = 0; x < w; x += 1)
+            job->pixels[(y0 + y) * size + x0 + x] = regime_colors[regime[y * w + x]];
+   }
+}
+
+// fills size x size pixels, in tiles spread over the pool
+void computeregimemap(RegimeMapView *view, Color *pixels, int size, ThreadPool *pool = NULL)
+{
+   int tilesperrow = (size + regime_tile - 1) / regime_tile;
+   RegimeMapJob job = {view, size, tilesperrow, pixels};
+   parallelfor(pool, tilesperrow * tilesperrow, 1, regimemaptiles, &job);
+}
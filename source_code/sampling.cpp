@@ -0,0 +1,121 @@
+#pragma once
+
+#include "useful_utils.cpp"
+#include "linearalgebra.cpp"
+#include "random.cpp"
+
+// Points in the unit square for spawning particles. Random points clump and
+// leave gaps; the Halton (bases 2 and 3) and Sobol sequences fill the square
+// evenly at every prefix length, so a phase portrait reads well with fewer
+// particles. The sampler keeps its position in the sequence, so spawning a
+// few particles at a time keeps filling the holes left by earlier ones.
+//
+// Point k only depends on k, which lets a batch be generated in parallel.
+// Each sampler is randomized from its seed: the Sobol points get a digital
+// shift (xor), which keeps their stratification, and the Halton points a
+// shift modulo 1.
+
+enum SampleMode
+{
+   SAMPLE_RANDOM,
+   SAMPLE_HALTON,
+   SAMPLE_SOBOL,
+};
+
+const char *samplemode_names[] = {"random", "Halton", "Sobol"};
+
+struct Sampler
+{
+   SampleMode mode;
+   u64 index;       // next point of the sequence
+   Rng rng;         // for SAMPLE_RANDOM
+   u32 scramble[2];
+   f64 shift[2];
+};
+
+void initsampler(Sampler *s, SampleMode mode, u64 seed)
+{
+   s->mode = mode;
+   s->index = 0;
+   seedrng(&s->rng, seed);
+   u64 bits = nextu64(&s->rng);
+   s->scramble[0] = (u32) bits;
+   s->scramble[1] = (u32) (bits >> 32);
+   s->shift[0] = randuniform(&s->rng, 0, 1);
+   s->shift[1] = randuniform(&s->rng, 0, 1);
+}
+
+static inline
+f64 radicalinverse(u64 k, u32 base)
+{
+   f64 inv = 1.0 / base;
+   f64 scale = inv;
+   f64 result = 0;
+   while (k > 0)
+   {
+      result += (f64) (k % base) * scale;
+      k /= base;
+      scale *= inv;
+   }
+   return result;
+}
+
+static inline
+u32 reversebits(u32 x)
+{
+   x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+   x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+   x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+   x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+   return (x >> 16) | (x << 16);
+}
+
+// second Sobol dimension, from the primitive polynomial x + 1; the first one
+// is the van der Corput sequence, i.e. the reversed bits of k
+static inline
+u32 sobol2(u32 k)
+{
+   u32 result = 0;
+   u32 v = 1u << 31;
+   for (; k; k >>= 1, v ^= v >> 1)
+   {
+      if (k & 1)
+         result ^= v;
+   }
+   return result;
+}
+
+// point k of the sequence in [0, 1)^2; SAMPLE_RANDOM has no sequence
+static inline
+Vec2F64 samplepoint(Sampler *s, u64 k)
+{
+   const f64 twoto32 = 4294967296.0;
+   if (s->mode == SAMPLE_SOBOL)
+   {
+      u32 x = reversebits((u32) k) ^ s->scramble[0];
+      u32 y = sobol2((u32) k) ^ s->scramble[1];
+      return {(f64) x / twoto32, (f64) y / twoto32};
+   }
+   assert(s->mode == SAMPLE_HALTON);
+   f64 x = radicalinverse(k, 2) + s->shift[0];
+   f64 y = radicalinverse(k, 3) + s->shift[1];
+   return {x < 1 ? x : x - 1, y < 1 ? y : y - 1};
+}
+
+Vec2F64 nextsample(Sampler *s)
+{
+   if (s->mode == SAMPLE_RANDOM)
+      return {randuniform(&s->rng, 0, 1), randuniform(&s->rng, 0, 1)};
+   Vec2F64 result = samplepoint(s, s->index);
+   s->index += 1;
+   return result;
+}
+
+// next point mapped to the box [lo, hi]
+static inline
+Vec2F64 nextsample(Sampler *s, Vec2F64 lo, Vec2F64 hi)
+{
+   Vec2F64 u = nextsample(s);
+   return {lo.elems[0] + u.elems[0] * (hi.elems[0] - lo.elems[0]),
+           lo.elems[1] + u.elems[1] * (hi.elems[1] - lo.elems[1])};
+}
@@ -0,0 +1,647 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "useful_utils.cpp"
+#include "threadpool.cpp"
+#include "draw_backend.cpp"
+
+// A CPU rasterizer, so the frame pipeline can run and be timed where there is
+// no GPU or display, e.g. in the headless runner and the benchmarks. Drawing
+// only records commands; softrender() bins them into 64x64 tiles and
+// rasterizes the tiles over the thread pool. Every tile applies its commands
+// in the order they were recorded, so the picture does not depend on the
+// number of threads.
+//
+// Lines are anti-aliased capsules: a pixel is covered by how deep its center
+// lies inside the thick segment, ramping over one pixel at the edge.
+// Triangles cover the pixels whose centers they contain, with a fill rule
+// that gives a shared edge to only one of its triangles, and interpolate the
+// colors of their corners. Colors are straight RGBA and blended source-over.
+//
+// softbackend() draws the game's scene through it.
+
+#define soft_tile 64
+
+struct RGBA8
+{
+   u8 r, g, b, a;
+};
+
+enum SoftCommandKind
+{
+   SOFT_LINE,
+   SOFT_IMAGE,
+   SOFT_TRIANGLE,
+   SOFT_RECT,
+};
+
+struct SoftCommand
+{
+   int kind;
+   int x0, y0, x1, y1;  // pixels touched, [x0, x1) x [y0, y1)
+   f32 ax, ay, bx, by;  // line ends, or triangle corners with cx, cy
+   f32 cx, cy;
+   f32 halfwidth;
+   RGBA8 color;
+   RGBA8 colorb, colorc;  // of the triangle corners b and c
+   const u8 *image;     // RGBA rows, top left at (x0, y0)
+};
+
+struct SoftRenderer
+{
+   int width, height;
+   RGBA8 *pixels;
+   RGBA8 background;
+   int tilesx, tilesy;
+   SoftCommand *commands;
+   int numcommands;
+   int commandcapacity;
+   int *tilestart;      // commands of tile t are tileitems[tilestart[t] .. tilestart[t+1]]
+   int *tileitems;
+   int itemcapacity;
+};
+
+void initsoftrenderer(SoftRenderer *r, int width, int height)
+{
+   assert(width > 0 && height > 0);
+   *r = {};
+   r->width = width;
+   r->height = height;
+   r->pixels = (RGBA8 *) malloc((size_t) width * (size_t) height * sizeof(RGBA8));
+   r->tilesx = (width + soft_tile - 1) / soft_tile;
+   r->tilesy = (height + soft_tile - 1) / soft_tile;
+   r->tilestart = (int *) malloc((size_t) (r->tilesx * r->tilesy + 1) * sizeof(int));
+   AN(r->pixels);
+   AN(r->tilestart);
+   r->background = {255, 255, 255, 255};
+}
+
+void freesoftrenderer(SoftRenderer *r)
+{
+   free(r->pixels);
+   free(r->commands);
+   free(r->tilestart);
+   free(r->tileitems);
+   *r = {};
+}
+
+// starts a frame
+void softclear(SoftRenderer *r, RGBA8 background)
+{
+   r->background = background;
+   r->numcommands = 0;
+}
+
+static inline
+SoftCommand *pushsoftcommand(SoftRenderer *r)
+{
+   if (r->numcommands == r->commandcapacity)
+   {
+      r->commandcapacity = max(2 * r->commandcapacity, 1024);
+      r->commands = (SoftCommand *) realloc(r->commands, (size_t) r->commandcapacity * sizeof(SoftCommand));
+      AN(r->commands);
+   }
+   SoftCommand *c = &r->commands[r->numcommands];
+   r->numcommands += 1;
+   return c;
+}
+
+void softline(SoftRenderer *r, f32 ax, f32 ay, f32 bx, f32 by, f32 thickness, RGBA8 color)
+{
+   f32 halfwidth = 0.5f * thickness;
+   f32 reach = halfwidth + 1;
+   if (!(halfwidth > 0) || color.a == 0)
+      return;
+   if (!isfinite(ax) || !isfinite(ay) || !isfinite(bx) || !isfinite(by))
+      return;
+   // clamped in floats first, the ends can be far off screen
+   f32 x0 = clampfloat(min(ax, bx) - reach, 0, (f32) r->width);
+   f32 y0 = clampfloat(min(ay, by) - reach, 0, (f32) r->height);
+   f32 x1 = clampfloat(max(ax, bx) + reach, 0, (f32) r->width);
+   f32 y1 = clampfloat(max(ay, by) + reach, 0, (f32) r->height);
+   if (x0 >= x1 || y0 >= y1)
+      return;
+   SoftCommand *c = pushsoftcommand(r);
+   c->kind = SOFT_LINE;
+   c->x0 = (int) x0;
+   c->y0 = (int) y0;
+   c->x1 = (int) ceilf(x1);
+   c->y1 = (int) ceilf(y1);
+   c->ax = ax;
+   c->ay = ay;
+   c->bx = bx;
+   c->by = by;
+   c->halfwidth = halfwidth;
+   c->color = color;
+   c->image = NULL;
+}
+
+// rgba has to stay alive until softrender()
+void softimage(SoftRenderer *r, int x, int y, const u8 *rgba, int width, int height)
+{
+   if (x >= r->width || y >= r->height || x + width <= 0 || y + height <= 0)
+      return;
+   SoftCommand *c = pushsoftcommand(r);
+   c->kind = SOFT_IMAGE;
+   c->x0 = x;
+   c->y0 = y;
+   c->x1 = x + width;
+   c->y1 = y + height;
+   c->image = rgba;
+}
+
+// corners in pixels as x, y pairs; the winding does not matter
+void softtriangle(SoftRenderer *r, const f32 xy[6], const RGBA8 colors[3])
+{
+   if (colors[0].a == 0 && colors[1].a == 0 && colors[2].a == 0)
+      return;
+   for (int k = 0; k < 6; k += 1)
+      if (!isfinite(xy[k]))
+         return;
+   f32 area = (xy[2] - xy[0]) * (xy[5] - xy[1]) - (xy[3] - xy[1]) * (xy[4] - xy[0]);
+   if (area == 0)
+      return;
+   f32 x0 = clampfloat(min(xy[0], min(xy[2], xy[4])), 0, (f32) r->width);
+   f32 y0 = clampfloat(min(xy[1], min(xy[3], xy[5])), 0, (f32) r->height);
+   f32 x1 = clampfloat(max(xy[0], max(xy[2], xy[4])) + 1, 0, (f32) r->width);
+   f32 y1 = clampfloat(max(xy[1], max(xy[3], xy[5])) + 1, 0, (f32) r->height);
+   if (x0 >= x1 || y0 >= y1)
+      return;
+   // stored with a positive area, so the edge tests have one sign
+   int b = area > 0 ? 1 : 2;
+   int c = area > 0 ? 2 : 1;
+   SoftCommand *cmd = pushsoftcommand(r);
+   cmd->kind = SOFT_TRIANGLE;
+   cmd->x0 = (int) x0;
+   cmd->y0 = (int) y0;
+   cmd->x1 = (int) x1;
+   cmd->y1 = (int) y1;
+   cmd->ax = xy[0];
+   cmd->ay = xy[1];
+   cmd->bx = xy[2*b];
+   cmd->by = xy[2*b + 1];
+   cmd->cx = xy[2*c];
+   cmd->cy = xy[2*c + 1];
+   cmd->color = colors[0];
+   cmd->colorb = colors[b];
+   cmd->colorc = colors[c];
+   cmd->image = NULL;
+}
+
+void softrect(SoftRenderer *r, int x, int y, int width, int height, RGBA8 color)
+{
+   int x0 = max(x, 0), y0 = max(y, 0);
+   int x1 = min(x + width, r->width), y1 = min(y + height, r->height);
+   if (x0 >= x1 || y0 >= y1 || color.a == 0)
+      return;
+   SoftCommand *c = pushsoftcommand(r);
+   c->kind = SOFT_RECT;
+   c->x0 = x0;
+   c->y0 = y0;
+   c->x1 = x1;
+   c->y1 = y1;
+   c->color = color;
+   c->image = NULL;
+}
+
+// 5x7 glyphs of the characters in axis labels, row by row from the top, the
+// leftmost column in bit 4
+static const u8 soft_font_digits[10][7] = {
+   {0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e},
+   {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e},
+   {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f},
+   {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e},
+   {0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02},
+   {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e},
+   {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e},
+   {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+   {0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e},
+   {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c},
+};
+static const u8 soft_font_minus[7] = {0, 0, 0, 0x1f, 0, 0, 0};
+static const u8 soft_font_dot[7] = {0, 0, 0, 0, 0, 0x0c, 0x0c};
+
+// Text in the cell layout of raylib's default font: size pixels high, glyphs
+// of size/10 pixel squares. Only digits, '-' and '.' are drawn; any other
+// character leaves a gap.
+void softtext(SoftRenderer *r, const char *text, int x, int y, int size, RGBA8 color)
+{
+   int s = max(size / 10, 1);
+   for (const char *ch = text; *ch; ch += 1, x += 6 * s)
+   {
+      const u8 *glyph = *ch >= '0' && *ch <= '9' ? soft_font_digits[*ch - '0']
+         : *ch == '-' ? soft_font_minus : *ch == '.' ? soft_font_dot : NULL;
+      if (!glyph)
+         continue;
+      for (int row = 0; row < 7; row += 1)
+      {
+         // one rectangle per run of set bits
+         for (int col = 0; col < 5; )
+         {
+            if (!(glyph[row] & (0x10 >> col)))
+            {
+               col += 1;
+               continue;
+            }
+            int start = col;
+            while (col < 5 && glyph[row] & (0x10 >> col))
+               col += 1;
+            softrect(r, x + start * s, y + (row + 1) * s, (col - start) * s, s, color);
+         }
+      }
+   }
+}
+
+static inline
+void blendpixel(RGBA8 *dst, RGBA8 src, f32 alpha)
+{
+   dst->r = (u8) ((f32) dst->r + ((f32) src.r - (f32) dst->r) * alpha + 0.5f);
+   dst->g = (u8) ((f32) dst->g + ((f32) src.g - (f32) dst->g) * alpha + 0.5f);
+   dst->b = (u8) ((f32) dst->b + ((f32) src.b - (f32) dst->b) * alpha + 0.5f);
+   dst->a = (u8) ((f32) dst->a + (255 - (f32) dst->a) * alpha + 0.5f);
+}
+
+// could the line touch the tile at all, judged from the tile's bounding circle
+static inline
+bool linetouchestile(SoftCommand *c, int tx, int ty)
+{
+   f32 half = 0.5f * soft_tile;
+   f32 cx = (f32) (tx * soft_tile) + half;
+   f32 cy = (f32) (ty * soft_tile) + half;
+   f32 dx = c->bx - c->ax, dy = c->by - c->ay;
+   f32 dd = dx * dx + dy * dy;
+   f32 t = dd > 0 ? clampfloat(((cx - c->ax) * dx + (cy - c->ay) * dy) / dd, 0, 1) : 0;
+   f32 ex = cx - c->ax - t * dx, ey = cy - c->ay - t * dy;
+   f32 reach = c->halfwidth + 1 + 1.4143f * half;
+   return ex * ex + ey * ey <= reach * reach;
+}
+
+static
+void binsoftcommands(SoftRenderer *r)
+{
+   int numtiles = r->tilesx * r->tilesy;
+   for (int pass = 0; pass < 2; pass += 1)
+   {
+      if (pass == 0)
+         memset(r->tilestart, 0, (size_t) (numtiles + 1) * sizeof(int));
+      for (int k = 0; k < r->numcommands; k += 1)
+      {
+         SoftCommand *c = &r->commands[k];
+         int tx0 = max(c->x0, 0) / soft_tile;
+         int ty0 = max(c->y0, 0) / soft_tile;
+         int tx1 = (min(c->x1, r->width) - 1) / soft_tile;
+         int ty1 = (min(c->y1, r->height) - 1) / soft_tile;
+         for (int ty = ty0; ty <= ty1; ty += 1)
+         {
+            for (int tx = tx0; tx <= tx1; tx += 1)
+            {
+               if (c->kind == SOFT_LINE && !linetouchestile(c, tx, ty))
+                  continue;
+               int t = ty * r->tilesx + tx;
+               if (pass == 0)
+                  r->tilestart[t + 1] += 1;
+               else
+                  r->tileitems[r->tilestart[t + 1]++] = k;
+            }
+         }
+      }
+      if (pass == 0)
+      {
+         // tilestart[t + 1] counts up from tilestart[t] while filling
+         for (int t = 0; t < numtiles; t += 1)
+            r->tilestart[t + 1] += r->tilestart[t];
+         int numitems = r->tilestart[numtiles];
+         if (numitems > r->itemcapacity)
+         {
+            free(r->tileitems);
+            r->itemcapacity = max(numitems, 2 * r->itemcapacity);
+            r->tileitems = (int *) malloc((size_t) r->itemcapacity * sizeof(int));
+            AN(r->tileitems);
+         }
+         for (int t = numtiles; t > 0; t -= 1)
+            r->tilestart[t] = r->tilestart[t - 1];
+         r->tilestart[0] = 0;
+      }
+   }
+}
+
+static
+void rasterline(SoftRenderer *r, SoftCommand *c, int x0, int y0, int x1, int y1)
+{
+   f32 dx = c->bx - c->ax, dy = c->by - c->ay;
+   f32 dd = dx * dx + dy * dy;
+   f32 invdd = dd > 0 ? 1 / dd : 0;
+   f32 alpha = (f32) c->color.a / 255;
+   for (int y = y0; y < y1; y += 1)
+   {
+      RGBA8 *row = &r->pixels[(size_t) y * (size_t) r->width];
+      f32 py = (f32) y + 0.5f - c->ay;
+      for (int x = x0; x < x1; x += 1)
+      {
+         f32 px = (f32) x + 0.5f - c->ax;
+         f32 t = clampfloat((px * dx + py * dy) * invdd, 0, 1);
+         f32 ex = px - t * dx, ey = py - t * dy;
+         f32 coverage = c->halfwidth + 0.5f - sqrtf(ex * ex + ey * ey);
+         if (coverage <= 0)
+            continue;
+         blendpixel(&row[x], c->color, alpha * min(coverage, 1.0f));
+      }
+   }
+}
+
+static
+void rasterimage(SoftRenderer *r, SoftCommand *c, int x0, int y0, int x1, int y1)
+{
+   int imagewidth = c->x1 - c->x0;
+   for (int y = y0; y < y1; y += 1)
+   {
+      RGBA8 *row = &r->pixels[(size_t) y * (size_t) r->width];
+      const u8 *src = &c->image[4 * ((size_t) (y - c->y0) * (size_t) imagewidth + (size_t) (x0 - c->x0))];
+      for (int x = x0; x < x1; x += 1, src += 4)
+      {
+         if (src[3] == 0)
+            continue;
+         blendpixel(&row[x], {src[0], src[1], src[2], 255}, (f32) src[3] / 255);
+      }
+   }
+}
+
+static
+void rastertriangle(SoftRenderer *r, SoftCommand *c, int x0, int y0, int x1, int y1)
+{
+   // edge k is opposite corner k, its function is the weight of that corner
+   f32 ex[3] = {c->bx, c->cx, c->ax}, ey[3] = {c->by, c->cy, c->ay};
+   f32 dx[3] = {c->cx - c->bx, c->ax - c->cx, c->bx - c->ax};
+   f32 dy[3] = {c->cy - c->by, c->ay - c->cy, c->by - c->ay};
+   // of the two triangles on an edge, which run it in opposite directions,
+   // only the one with dy > 0, or dy == 0 and dx < 0, gets the pixels on it
+   bool owns[3];
+   for (int k = 0; k < 3; k += 1)
+      owns[k] = dy[k] > 0 || (dy[k] == 0 && dx[k] < 0);
+   f32 invarea = 1 / (dx[2] * (c->cy - c->ay) - dy[2] * (c->cx - c->ax));
+   RGBA8 corner[3] = {c->color, c->colorb, c->colorc};
+   for (int y = y0; y < y1; y += 1)
+   {
+      RGBA8 *row = &r->pixels[(size_t) y * (size_t) r->width];
+      f32 py = (f32) y + 0.5f;
+      for (int x = x0; x < x1; x += 1)
+      {
+         f32 px = (f32) x + 0.5f;
+         f32 w[3];
+         bool inside = true;
+         for (int k = 0; k < 3 && inside; k += 1)
+         {
+            w[k] = dx[k] * (py - ey[k]) - dy[k] * (px - ex[k]);
+            inside = w[k] > 0 || (w[k] == 0 && owns[k]);
+         }
+         if (!inside)
+            continue;
+         f32 wa = w[0] * invarea, wb = w[1] * invarea, wc = w[2] * invarea;
+         RGBA8 color;
+         color.r = (u8) (wa * (f32) corner[0].r + wb * (f32) corner[1].r + wc * (f32) corner[2].r + 0.5f);
+         color.g = (u8) (wa * (f32) corner[0].g + wb * (f32) corner[1].g + wc * (f32) corner[2].g + 0.5f);
+         color.b = (u8) (wa * (f32) corner[0].b + wb * (f32) corner[1].b + wc * (f32) corner[2].b + 0.5f);
+         f32 alpha = (wa * (f32) corner[0].a + wb * (f32) corner[1].a + wc * (f32) corner[2].a) / 255;
+         blendpixel(&row[x], color, alpha);
+      }
+   }
+}
+
+static
+void rasterrect(SoftRenderer *r, SoftCommand *c, int x0, int y0, int x1, int y1)
+{
+   f32 alpha = (f32) c->color.a / 255;
+   for (int y = y0; y < y1; y += 1)
+   {
+      RGBA8 *row = &r->pixels[(size_t) y * (size_t) r->width];
+      for (int x = x0; x < x1; x += 1)
+         blendpixel(&row[x], c->color, alpha);
+   }
+}
+
+static
+void rastertiles(void *ctx, int begin, int end)
+{
+   SoftRenderer *r = (SoftRenderer *) ctx;
+   for (int t = begin; t < end; t += 1)
+   {
+      int tx0 = (t % r->tilesx) * soft_tile;
+      int ty0 = (t / r->tilesx) * soft_tile;
+      int tx1 = min(tx0 + soft_tile, r->width);
+      int ty1 = min(ty0 + soft_tile, r->height);
+      for (int y = ty0; y < ty1; y += 1)
+         for (int x = tx0; x < tx1; x += 1)
+            r->pixels[(size_t) y * (size_t) r->width + x] = r->background;
+      for (int item = r->tilestart[t]; item < r->tilestart[t + 1]; item += 1)
+      {
+         SoftCommand *c = &r->commands[r->tileitems[item]];
+         int x0 = max(c->x0, tx0), y0 = max(c->y0, ty0);
+         int x1 = min(c->x1, tx1), y1 = min(c->y1, ty1);
+         switch (c->kind)
+         {
+            case SOFT_LINE:
+               rasterline(r, c, x0, y0, x1, y1);
+               break;
+            case SOFT_IMAGE:
+               rasterimage(r, c, x0, y0, x1, y1);
+               break;
+            case SOFT_TRIANGLE:
+               rastertriangle(r, c, x0, y0, x1, y1);
+               break;
+            case SOFT_RECT:
+               rasterrect(r, c, x0, y0, x1, y1);
+               break;
+         }
+      }
+   }
+}
+
+// rasterizes the commands recorded since softclear()
+void softrender(SoftRenderer *r, ThreadPool *pool = NULL)
+{
+   binsoftcommands(r);
+   parallelfor(pool, r->tilesx * r->tilesy, 1, rastertiles, r);
+}
+
+static inline
+RGBA8 torgba8(Color c)
+{
+   return {c.r, c.g, c.b, c.a};
+}
+
+// lines in the color of their first vertex
+static
+void soft_lines(void *ctx, const Vector2 *verts, const Color *colors, int numverts, f32 thickness)
+{
+   SoftRenderer *r = (SoftRenderer *) ctx;
+   for (int k = 0; k + 1 < numverts; k += 2)
+      softline(r, verts[k].x, verts[k].y, verts[k + 1].x, verts[k + 1].y, thickness, torgba8(colors[k]));
+}
+
+static
+void soft_triangles(void *ctx, const Vector2 *verts, const Color *colors, int numverts)
+{
+   SoftRenderer *r = (SoftRenderer *) ctx;
+   for (int k = 0; k + 2 < numverts; k += 3)
+   {
+      f32 xy[6] = {verts[k].x, verts[k].y, verts[k + 1].x, verts[k + 1].y, verts[k + 2].x, verts[k + 2].y};
+      RGBA8 corners[3] = {torgba8(colors[k]), torgba8(colors[k + 1]), torgba8(colors[k + 2])};
+      softtriangle(r, xy, corners);
+   }
+}
+
+static
+void soft_text(void *ctx, const char *text, int x, int y, int size, Color color)
+{
+   softtext((SoftRenderer *) ctx, text, x, y, size, torgba8(color));
+}
+
+static
+void soft_image(void *ctx, const BackendImage *image, int x, int y)
+{
+   if (image->rgba)
+      softimage((SoftRenderer *) ctx, x, y, image->rgba, image->width, image->height);
+}
+
+DrawBackend softbackend(SoftRenderer *r)
+{
+   DrawBackend b = {r, soft_lines, soft_triangles, soft_text, soft_image};
+   return b;
+}
+
+bool writeppm(SoftRenderer *r, FILE *f)
+{
+   fprintf(f, "P6\n%d %d\n255\n", r->width, r->height);
+   u8 *row = (u8 *) malloc((size_t) r->width * 3);
+   AN(row);
+   bool ok = true;
+   for (int y = 0; y < r->height && ok; y += 1)
+   {
+      RGBA8 *src = &r->pixels[(size_t) y * (size_t) r->width];
+      for (int x = 0; x < r->width; x += 1)
+      {
+         row[3*x + 0] = src[x].r;
+         row[3*x + 1] = src[x].g;
+         row[3*x + 2] = src[x].b;
+      }
+      ok = fwrite(row, 3, (size_t) r->width, f) == (size_t) r->width;
+   }
+   free(row);
+   return ok;
+}
+
+u32 crc32update(u32 crc, const u8 *data, size_t n)
+{
+   static u32 table[256];
+   static bool tableready = false;
+   if (!tableready)
+   {
+      for (u32 i = 0; i < 256; i += 1)
+      {
+         u32 c = i;
+         for (int k = 0; k < 8; k += 1)
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+         table[i] = c;
+      }
+      tableready = true;
+   }
+   crc = ~crc;
+   for (size_t i = 0; i < n; i += 1)
+      crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+   return ~crc;
+}
+
+static inline
+void putbe32(u8 *p, u32 v)
+{
+   p[0] = (u8) (v >> 24);
+   p[1] = (u8) (v >> 16);
+   p[2] = (u8) (v >> 8);
+   p[3] = (u8) v;
+}
+
+static
+bool writepngchunk(FILE *f, const char *type, const u8 *data, u32 n)
+{
+   u8 head[8];
+   putbe32(head, n);
+   memcpy(head + 4, type, 4);
+   u32 crc = crc32update(crc32update(0, head + 4, 4), data, n);
+   u8 tail[4];
+   putbe32(tail, crc);
+   return fwrite(head, 1, 8, f) == 8 && fwrite(data, 1, n, f) == n && fwrite(tail, 1, 4, f) == 4;
+}
+
+// An uncompressed PNG: the zlib stream in IDAT only has stored deflate
+// blocks, which is fast to write and needs no zlib.
+bool writepng(SoftRenderer *r, FILE *f)
+{
+   static const u8 signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+   u8 ihdr[13];
+   putbe32(ihdr, (u32) r->width);
+   putbe32(ihdr + 4, (u32) r->height);
+   ihdr[8] = 8;   // bits per channel
+   ihdr[9] = 6;   // RGBA
+   ihdr[10] = 0;  // deflate
+   ihdr[11] = 0;  // adaptive filtering, every row uses filter 0
+   ihdr[12] = 0;  // not interlaced
+
+   size_t rowbytes = 1 + 4 * (size_t) r->width;
+   size_t rawbytes = rowbytes * (size_t) r->height;
+   const size_t maxblock = 65535;
+   size_t numblocks = (rawbytes + maxblock - 1) / maxblock;
+   size_t idatbytes = 2 + 5 * numblocks + rawbytes + 4;
+   if (idatbytes > 0x7fffffffu)
+      return false;
+   u8 *raw = (u8 *) malloc(rawbytes);
+   u8 *idat = (u8 *) malloc(idatbytes);
+   AN(raw);
+   AN(idat);
+   for (int y = 0; y < r->height; y += 1)
+   {
+      u8 *row = &raw[(size_t) y * rowbytes];
+      row[0] = 0;
+      memcpy(row + 1, &r->pixels[(size_t) y * (size_t) r->width], 4 * (size_t) r->width);
+   }
+
+   u8 *out = idat;
+   *out++ = 0x78;  // deflate, 32K window
+   *out++ = 0x01;  // no preset dictionary, check bits
+   u32 a = 1, b = 0;
+   for (size_t done = 0; done < rawbytes; )
+   {
+      size_t n = min(maxblock, rawbytes - done);
+      *out++ = done + n == rawbytes;  // final block, stored
+      *out++ = (u8) n;
+      *out++ = (u8) (n >> 8);
+      *out++ = (u8) ~n;
+      *out++ = (u8) (~n >> 8);
+      memcpy(out, raw + done, n);
+      // adler32, with the sums reduced often enough not to overflow
+      for (size_t i = 0; i < n; )
+      {
+         size_t end = min(i + 5552, n);
+         for (; i < end; i += 1)
+         {
+            a += out[i];
+            b += a;
+         }
+         a %= 65521;
+         b %= 65521;
+      }
+      out += n;
+      done += n;
+   }
+   putbe32(out, (b << 16) | a);
+   out += 4;
+   assert((size_t) (out - idat) == idatbytes);
+
+   bool ok = fwrite(signature, 1, 8, f) == 8
+      && writepngchunk(f, "IHDR", ihdr, 13)
+      && writepngchunk(f, "IDAT", idat, (u32) idatbytes)
+      && writepngchunk(f, "IEND", NULL, 0);
+   free(raw);
+   free(idat);
+   return ok;
+}
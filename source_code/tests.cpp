@@ -2,12 +2,29 @@
 #include <assert.h>
 
 #include <raylib.h>
+#include <rlgl.h>
 #include "../dependencies/imgui/imgui.h"
 #include "../dependencies/rlImGui/rlImGui.h"
 
 #include "useful_utils.cpp"
 #include "julia_helpers.cpp"
 #include "linearalgebra.cpp"
+#include "particles.cpp"
+#include "game_data.cpp"
+#include "derived_cache.cpp"
+#include "time_varying.cpp"
+#include "expression.cpp"
+#include "adaptive.cpp"
+#include "trajectory_file.cpp"
+#include "quiver.cpp"
+#include "regime_map.cpp"
+#include "trail_mesh.cpp"
+#include "software_raster.cpp"
+#include "axes_layer.cpp"
+#include "persistence_buffer.cpp"
+#include "curve_trails.cpp"
+#include "density_map.cpp"
+#include "view_transform.cpp"
 
 typedef f64 (*g_ptr)(f64 x);
 g_ptr g = NULL;
@@ -207,21 +224,22 @@ void test_ourlinearalgebra()
    }
 
    {
+   // column-major order
    Mat4x4F64 A(
-      -0.0873228, -0.363667, -0.992568 ,  0.300909,
-       0.0403427,  1.91092 , -0.939411 , -0.949167,
-      -0.15097  , -2.30569 ,  0.0779773,  0.362943,
-      -1.21857  , -1.34864 ,  0.339221 ,  0.526252);
+      -0.0873228,  0.0403427, -0.15097  , -1.21857,
+      -0.363667 ,  1.91092  , -2.30569  , -1.34864,
+      -0.992568 , -0.939411 ,  0.0779773,  0.339221,
+       0.300909 , -0.949167 ,  0.362943 ,  0.526252);
    Mat4x4F64 B(
-       0.255513,  1.45659 , -1.07141   ,  0.631184,
-      -0.781111, -1.24806 , -0.54187   ,  1.94567 ,
-       1.82433 , -0.130912, -0.531278  , -0.598238,
-      -0.465686, -0.165724,  0.00281076,  1.27497 );
+       0.255513, -0.781111,  1.82433 , -0.465686,
+       1.45659 , -1.24806 , -0.130912, -0.165724,
+      -1.07141 , -0.54187 , -0.531278,  0.00281076,
+       0.631184,  1.94567 , -0.598238,  1.27497);
    Mat4x4F64 ans(
-      -1.68915,  0.406754,  0.818793,  0.214747,
-      -2.75412, -2.04589 , -0.582273,  3.09533,
-       1.73567,  2.58738 ,  1.37073 , -4.16533,
-       1.11586, -0.223392,  1.85763 , -2.92514);
+      -1.68915 , -2.75412 ,  1.73567,  1.11586,
+       0.406754, -2.04589 ,  2.58738, -0.223392,
+       0.818793, -0.582273,  1.37073,  1.85763,
+       0.214747,  3.09533 , -4.16533, -2.92514);
 
    Mat4x4F64 AB = matmul(A, B);
    assert(isapprox(AB, ans, 1e-4));
@@ -252,6 +270,62 @@ void test_ourlinearalgebra()
    assert(isapprox(expm(B), Mat2x2F64(0.6678580086237933, 1.7115461994715255, -1.4910689222541662, 6.606600222449386)));
    }
 
+   {
+   puts("==== pade matrix exponential ====");
+   assert(choosepade(0.01).degree == 3);
+   assert(choosepade(0.5).degree == 7);
+   assert(choosepade(5.0).degree == 13 && choosepade(5.0).squarings == 0);
+   assert(choosepade(40.0).degree == 13 && choosepade(40.0).squarings == 3);
+
+   // rotation-scaling matrices have an exact exponential, even for large norms
+   f64 a = -0.3;
+   f64 w = 20.0;
+   Mat2x2F64 A(a, w, -w, a);
+   Mat2x2F64 ans = exp(a) * Mat2x2F64(cos(w), sin(w), -sin(w), cos(w));
+   assert(isapprox(expm(A), ans));
+   assert(!isapprox(expm_taylor(A), ans));
+
+   Mat2x2F64 B(-0.03140377097524905, 0.5774392661113738, -0.5030549245201645, 1.9722014759266104);
+   assert(isapprox(expm(B), expm_taylor(B), 1e-12));
+
+   Mat2x2F64 Z = Zero2x2();
+   Mat4x4F64 Ablock = BlockMatrix(A, Z, Z, 0.1 * B);
+   Mat4x4F64 expAblock = expm(Ablock);
+   assert(isapprox(getUpperLeftBlock(expAblock), ans));
+   assert(isapprox(getUpperRightBlock(expAblock), Z));
+   assert(isapprox(expm(0.01 * Ablock), expm_taylor(0.01 * Ablock), 1e-12));
+   }
+
+   {
+   puts("==== closed form 2x2 matrix exponential ====");
+   Mat2x2F64 cases[] = {
+      Mat2x2F64(1, 3, 2, 4),             // real eigenvalues
+      Mat2x2F64(-0.3, 20, -20, -0.3),    // complex eigenvalues
+      Mat2x2F64(2, 0, 1, 2),             // repeated eigenvalue, defective
+      Mat2x2F64(0, 0, 1, 0),             // nilpotent
+      Mat2x2F64(-1.5, 0, 0, -1.5),       // repeated eigenvalue, diagonal
+      Mat2x2F64(0.5, 1e-3, 1, 0.5),      // q = 1e-3, on the series boundary
+      Mat2x2F64(0.5, 1e-3 + 1e-12, 1, 0.5),
+      Mat2x2F64(0.5, -1e-3, 1, 0.5),
+      Mat2x2F64(0.5, -1e-3 - 1e-12, 1, 0.5),
+      Mat2x2F64(0.5, 1e-14, 1, 0.5),     // discriminant barely positive
+      Mat2x2F64(0.5, -1e-14, 1, 0.5),    // discriminant barely negative
+   };
+   for (int i = 0; i < arrlen(cases); i += 1)
+   {
+      Mat2x2F64 A = cases[i];
+      Mat2x2F64 expA = expm(A);
+      f64 scale = opnorm1(expA);
+      assert(isapprox((1/scale) * expm_closedform(A), (1/scale) * expA, 1e-13));
+   }
+
+   // continuous across q = 0
+   Mat2x2F64 below = expm_closedform(Mat2x2F64(0.5, -1e-14, 1, 0.5));
+   Mat2x2F64 at = expm_closedform(Mat2x2F64(0.5, 0, 1, 0.5));
+   Mat2x2F64 above = expm_closedform(Mat2x2F64(0.5, 1e-14, 1, 0.5));
+   assert(isapprox(below, at, 1e-13) && isapprox(at, above, 1e-13));
+   }
+
    {
    puts("==== eigen decomposition ====");
    Mat2x2F64 A(1, 3, 2, 4);
@@ -274,17 +348,39 @@ void test_ourlinearalgebra()
    puts("==== block matrix ====");
    Mat2x2F64 A(1, 3, 2, 4); Mat2x2F64 B(5, 7, 6, 8);
    Mat2x2F64 C(0, 0, 0, 0); Mat2x2F64 D(9, 9, 9, 9);
-   Mat4x4F64 ans = {
-      1, 2, 5, 6,
-      3, 4, 7, 8,
-      0, 0, 9, 9,
-      0, 0, 9, 9 };
+   Mat4x4F64 ans = { // column-major order
+      1, 3, 0, 0,
+      2, 4, 0, 0,
+      5, 7, 9, 9,
+      6, 8, 9, 9 };
    assert(isapprox(BlockMatrix(A, B, C, D), ans));
 
    assert(isapprox(getUpperLeftBlock(ans), A));
    assert(isapprox(getUpperRightBlock(ans), B));
    }
 
+   {
+   puts("==== generic sizes ====");
+   Mat3x3F64 A(
+      -0.5,  0.2,  0.0,
+       1.0, -0.3,  0.4,
+       0.0, -1.0, -0.1);
+   assert(isapprox(expm(A), expm_taylor(A), 1e-12));
+   assert(isapprox(matmul(expm(A), expm(-1.0 * A)), Identity<3, f64>(), 1e-12));
+
+   Mat6x6F64 Q = BlockMatrix(A, Identity<3, f64>(), Mat3x3F64(), 2.0 * A);
+   Vec6F64 x(1, 2, 3, 4, 5, 6);
+   assert(isapprox(matvecmul(Q, leftdivide(Q, x)), x, 1e-12));
+
+   Vec3F64 v(1, 2, 3);
+   assert(dot(v, v) == 14);
+
+   Mat2x2F32 C(1, 3, 2, 4);
+   Vec2F32 y(1, 1);
+   assert(isapprox(matvecmul(C, y), Vec2F32(3, 7)));
+   assert(isapprox(expm(0.5f * C), convert<f32>(expm(0.5 * convert<f64>(C))), 1e-4f));
+   }
+
    puts("==== linear solve ====");
    {
    Mat2x2F64 A = { 0.09542656321310153, -0.8635607823993123, -1.6469693586011631, -0.8800629444940701 };
@@ -310,10 +406,1352 @@ void test_ourlinearalgebra()
    }
 }
 
+void test_particles()
+{
+   {
+   puts("==== particle propagation kernels ====");
+   // odd count so that every kernel runs its scalar tail
+   constexpr int n = 37;
+   Mat2x2F64 M = expm_closedform((1/60.0) * Mat2x2F64(-0.3, 2, -1.5, 0.1));
+   Vec2F64 b = {0.25, -0.5};
+   Vec2F64 init[n];
+   for (int i = 0; i < n; i += 1)
+      init[i] = {randfloat64(-20, 20), randfloat64(-20, 20)};
+
+   for (int level = 0; level < NUM_SIMD_LEVELS; level += 1)
+   {
+      if (!simdlevel_supported((SimdLevel) level))
+         continue;
+
+      Particles p;
+      initparticles(&p, n, 4);
+      setsimdlevel(&p, (SimdLevel) level);
+      for (int i = 0; i < n; i += 1)
+         spawnparticle(&p, i, init[i]);
+
+      for (int s = 0; s < 10; s += 1)
+         propagateparticles(&p, M, b);
+
+      for (int i = 0; i < n; i += 1)
+      {
+         Vec2F64 x = init[i];
+         for (int s = 0; s < 10; s += 1)
+            x = matvecmul(M, x) + b;
+         // same operations in the same order, so the results are identical
+         Vec2F64 got = getMostRecentPos(&p, i);
+         assert(got.elems[0] == x.elems[0] && got.elems[1] == x.elems[1]);
+      }
+      freeparticles(&p);
+   }
+   }
+   {
+   puts("==== particle history ring ====");
+   Particles p;
+   initparticles(&p, 3, 4);
+   Mat2x2F64 M = 2.0 * Identity2x2();
+   for (int i = 0; i < 3; i += 1)
+      spawnparticle(&p, i, {(f64) i, 1});
+   assert(trailsize(&p, 0) == 1);
+
+   for (int s = 0; s < 6; s += 1)
+   {
+      propagateparticles(&p, M);
+      if (s == 1)
+         spawnparticle(&p, 2, {-1, -1});
+   }
+   // the trail is capped at the history capacity and restarts on respawn
+   assert(trailsize(&p, 0) == 4);
+   assert(trailsize(&p, 2) == 5 - 1);
+   assert(isapprox(getMostRecentPos(&p, 1), Vec2F64(64, 64)));
+   assert(isapprox(getRecentPos(&p, 1, 1), Vec2F64(32, 32)));
+   assert(isapprox(getLeastRecentPos(&p, 1), Vec2F64(8, 8)));
+   assert(isapprox(getMostRecentPos(&p, 2), Vec2F64(-16, -16)));
+   assert(isapprox(getLeastRecentPos(&p, 2), Vec2F64(-2, -2)));
+   freeparticles(&p);
+   }
+   {
+   puts("==== particle resize ====");
+   Particles p;
+   initparticles(&p, 5, 8);
+   for (int i = 0; i < 5; i += 1)
+      spawnparticle(&p, i, {(f64) i, (f64) -i});
+   for (int s = 0; s < 6; s += 1)
+      propagateparticles(&p, 2.0 * Identity2x2());
+
+   // shrinking the trail keeps the newest entries
+   resizeparticles(&p, 3, 4);
+   assert(p.count == 3 && p.histcapacity == 4);
+   assert(trailsize(&p, 1) == 4);
+   assert(isapprox(getMostRecentPos(&p, 1), Vec2F64(64, -64)));
+   assert(isapprox(getLeastRecentPos(&p, 1), Vec2F64(8, -8)));
+
+   // growing adds particles with empty trails and keeps the existing ones
+   resizeparticles(&p, 1000, 16);
+   assert(trailsize(&p, 2) == 4);
+   assert(trailsize(&p, 500) == 1);
+   assert(isapprox(getMostRecentPos(&p, 2), Vec2F64(128, -128)));
+   propagateparticles(&p, 2.0 * Identity2x2());
+   assert(trailsize(&p, 2) == 5);
+   assert(isapprox(getLeastRecentPos(&p, 2), Vec2F64(16, -16)));
+   freeparticles(&p);
+   }
+   {
+   puts("==== analytic evaluation and seeking ====");
+   Mat2x2F64 A = Mat2x2F64(-0.3, 2, -1.5, 0.1);
+   f64 h = 1/60.0;
+   Mat2x2F64 M = expm_closedform(h * A);
+   Particles p;
+   initparticles(&p, 9, 4);
+   for (int i = 0; i < 9; i += 1)
+      spawnparticle(&p, i, {(f64) i, 1});
+
+   // stepping and evaluating agree; particle 3 is born later
+   Particles q;
+   initparticles(&q, 9, 4);
+   for (int i = 0; i < 9; i += 1)
+      spawnparticle(&q, i, {(f64) i, 1});
+   for (int s = 1; s <= 100; s += 1)
+   {
+      propagateparticles(&p, M);
+      p.time += h;
+      evaluateparticles(&q, A, s * h);
+      if (s == 40)
+      {
+         spawnparticle(&p, 3, {5, 5});
+         spawnparticle(&q, 3, {5, 5});
+      }
+   }
+   for (int i = 0; i < 9; i += 1)
+      assert(isapprox(getMostRecentPos(&p, i), getMostRecentPos(&q, i), 1e-9));
+   assert(trailsize(&q, 3) == 4);
+
+   // a seek lands on the same states and rebuilds the whole trail
+   seekparticles(&q, A, 30 * h, h);
+   assert(q.time == 30 * h);
+   Vec2F64 expect = matvecmul(expm_closedform((30 * h) * A), Vec2F64(2, 1));
+   assert(isapprox(getMostRecentPos(&q, 2), expect, 1e-9));
+   expect = matvecmul(expm_closedform((28 * h) * A), Vec2F64(2, 1));
+   assert(trailsize(&q, 2) == 4);
+   assert(isapprox(getRecentPos(&q, 2, 2), expect, 1e-9));
+   // before its birth particle 3 is on the trajectory through its base state
+   expect = matvecmul(expm_closedform((-10 * h) * A), Vec2F64(5, 5));
+   assert(isapprox(getMostRecentPos(&q, 3), expect, 1e-9));
+
+   // rebasing keeps the states
+   rebaseparticles(&q);
+   evaluateparticles(&q, A, 31 * h);
+   expect = matvecmul(expm_closedform((31 * h) * A), Vec2F64(2, 1));
+   assert(isapprox(getMostRecentPos(&q, 2), expect, 1e-9));
+
+   // powers of the propagator
+   MatPowers2x2 powers;
+   initmatpowers(&powers, M);
+   Mat2x2F64 M13 = Identity2x2();
+   for (int s = 0; s < 13; s += 1)
+      M13 = matmul(M, M13);
+   assert(isapprox(matpower(&powers, 13), M13, 1e-12));
+   assert(isapprox(matpower(&powers, 0), Identity2x2()));
+   assert(isapprox(matpower(&powers, 1000), expm_closedform((1000 * h) * A), 1e-9));
+   freeparticles(&p);
+   freeparticles(&q);
+   }
+}
+
+static
+void countchunk(void *ctx, int begin, int end)
+{
+   int *visits = (int *) ctx;
+   for (int i = begin; i < end; i += 1)
+      visits[i] += 1;
+}
+
+void test_threadpool()
+{
+   {
+   puts("==== parallelfor visits every index once ====");
+   constexpr int n = 100003;
+   int *visits = (int *) calloc(n, sizeof(int));
+   for (int numthreads = 1; numthreads <= 8; numthreads += 1)
+   {
+      ThreadPool pool;
+      initthreadpool(&pool, numthreads);
+      for (int rep = 0; rep < 20; rep += 1)
+         parallelfor(&pool, n, 64, countchunk, visits);
+      freethreadpool(&pool);
+   }
+   for (int i = 0; i < n; i += 1)
+      assert(visits[i] == 8 * 20);
+   free(visits);
+   }
+   {
+   puts("==== threaded propagation does not depend on the thread count ====");
+   constexpr int n = 3 * particle_chunk + 123;
+   Mat2x2F64 M = expm_closedform((1/60.0) * Mat2x2F64(0.2, 1, -1, 0.2));
+   Vec2F64 b = {0.1, 0.2};
+   Particles ref;
+   initparticles(&ref, n, 4);
+   for (int i = 0; i < n; i += 1)
+      spawnparticle(&ref, i, {randfloat64(-20, 20), randfloat64(-20, 20)});
+   Particles p;
+   initparticles(&p, n, 4);
+   for (int numthreads = 1; numthreads <= 5; numthreads += 1)
+   {
+      ThreadPool pool;
+      initthreadpool(&pool, numthreads);
+      memcpy(currentx(&p), currentx(&ref), n * sizeof(f64));
+      memcpy(currenty(&p), currenty(&ref), n * sizeof(f64));
+      for (int s = 0; s < 5; s += 1)
+         propagateparticles(&p, M, b, &pool);
+      freethreadpool(&pool);
+
+      if (numthreads == 1)
+         continue;
+      Particles single;
+      initparticles(&single, n, 4);
+      memcpy(currentx(&single), currentx(&ref), n * sizeof(f64));
+      memcpy(currenty(&single), currenty(&ref), n * sizeof(f64));
+      for (int s = 0; s < 5; s += 1)
+         propagateparticles(&single, M, b);
+      assert(memcmp(currentx(&single), currentx(&p), n * sizeof(f64)) == 0);
+      assert(memcmp(currenty(&single), currenty(&p), n * sizeof(f64)) == 0);
+      freeparticles(&single);
+   }
+   freeparticles(&ref);
+   freeparticles(&p);
+   }
+}
+
+void test_clock()
+{
+   puts("==== fixed-step clock ====");
+   sim_rate_hz = 100;
+   max_catchup_steps = 8;
+   sim_accumulator = 0;
+
+   // uneven frame times still add up to whole steps
+   int total = 0;
+   const f64 frames[] = {0.016, 0.017, 0.0165, 0.015, 0.0356};
+   for (int i = 0; i < arrlen(frames); i += 1)
+   {
+      advanceclock(frames[i]);
+      total += sim_steps;
+      assert(sim_alpha >= 0 && sim_alpha < 1);
+   }
+   assert(dt == 0.01);
+   assert(total == 10);
+   assert(isapprox(sim_alpha, 0.01, 1e-9));
+
+   // a stall is capped and the backlog dropped
+   advanceclock(2.0);
+   assert(sim_steps == 8);
+   assert(isapprox(sim_alpha, 0.0, 1e-9));
+   advanceclock(0.015);
+   assert(sim_steps == 1);
+   assert(isapprox(sim_alpha, 0.5, 1e-9));
+}
+
+void test_derivedcache()
+{
+   puts("==== derived value cache ====");
+   f64 a = 1;
+   f64 b = 2;
+   CacheNode inputa, inputb, sum, twice;
+   initcacheinput(&inputa, "a", sizeof(f64));
+   initcacheinput(&inputb, "b", sizeof(f64));
+   initderived(&sum, "a + b", &inputa, &inputb);
+   initderived(&twice, "2 (a + b)", &sum);
+
+   int sumcomputed = 0;
+   int twicecomputed = 0;
+   for (int frame = 0; frame < 10; frame += 1)
+   {
+      if (frame == 5)
+         b = 3;
+      if (frame == 7)
+         a = 1;  // same value, nothing changes
+      watchinput(&inputa, &a);
+      watchinput(&inputb, &b);
+      if (needsupdate(&sum))
+         sumcomputed += 1;
+      if (needsupdate(&twice))
+         twicecomputed += 1;
+   }
+   assert(sumcomputed == 2);
+   assert(twicecomputed == 2);
+   assert(inputa.misses == 1 && inputa.hits == 9);
+   assert(inputb.misses == 2 && inputb.hits == 8);
+   assert(sum.misses == 2 && sum.hits == 8);
+   assert(twice.version == 2);
+
+   resetcachestats();
+   assert(sum.hits == 0 && sum.misses == 0);
+   assert(!needsupdate(&twice));
+}
+
+static
+Mat2x2F64 mathieutest(void *ctx, f64 t)
+{
+   return {0, -(1.5 - 0.6 * cos(2 * t)), 1, 0};
+}
+
+// error of one state integrated to t = 4 with n Magnus steps
+static
+f64 magnuserror(int n, Vec2F64 reference)
+{
+   Particles p;
+   initparticles(&p, 1, 2);
+   spawnparticle(&p, 0, {1, 0});
+   for (int s = 0; s < n; s += 1)
+      stepmagnus(&p, mathieutest, NULL, 4.0 / n);
+   Vec2F64 d = getMostRecentPos(&p, 0) - reference;
+   freeparticles(&p);
+   return sqrt(dot(d, d));
+}
+
+void test_timevarying()
+{
+   puts("==== time-varying integrators ====");
+   // constant A: one Magnus step is the exponential
+   MatrixTable table = {};
+   Mat2x2F64 A = Mat2x2F64(-0.3, 2, -1.5, 0.1);
+   addknot(&table, 0, A);
+   assert(isapprox(magnus4(evaltable, &table, 3, 0.1), expm_closedform(0.1 * A), 1e-14));
+
+   // tables interpolate, jump at repeated knots and repeat with the period
+   table.count = 0;
+   table.period = 2;
+   addknot(&table, 0, Zero2x2());
+   addknot(&table, 1, Identity2x2());
+   addknot(&table, 1, 3.0 * Identity2x2());
+   addknot(&table, 2, 3.0 * Identity2x2());
+   assert(isapprox(evaltable(&table, 0.25), 0.25 * Identity2x2()));
+   assert(isapprox(evaltable(&table, 1.5), 3.0 * Identity2x2()));
+   assert(isapprox(evaltable(&table, 4.5), 0.5 * Identity2x2()));
+   assert(isapprox(evaltable(&table, -1.75), 0.25 * Identity2x2()));
+
+   // 4th order: halving the step cuts the error by about 16
+   Particles p;
+   initparticles(&p, 1, 2);
+   spawnparticle(&p, 0, {1, 0});
+   for (int s = 0; s < 4096; s += 1)
+      steprk4(&p, mathieutest, NULL, 4.0 / 4096);
+   Vec2F64 reference = getMostRecentPos(&p, 0);
+   freeparticles(&p);
+   f64 coarse = magnuserror(32, reference);
+   f64 fine = magnuserror(64, reference);
+   printf("magnus error %.3e -> %.3e, ratio %.1f\n", coarse, fine, coarse / fine);
+   assert(coarse / fine > 12 && coarse / fine < 20);
+}
+
+static
+Vec2F64 vanderpol(Vec2F64 s, f64 mu)
+{
+   f64 x = s.elems[0];
+   f64 y = s.elems[1];
+   return {y, mu * (1 - x * x) * y - x};
+}
+
+void test_expression()
+{
+   puts("==== expression bytecode ====");
+   Program prog;
+   VmEnv env = {0.5, {2, 3, 0, 0, 1.5}};
+   Vec2F64 s = {0.7, -1.3};
+   f64 x = s.elems[0];
+   f64 y = s.elems[1];
+
+   assert(compileprogram(&prog, "y", "mu*(1 - x^2)*y - x"));
+   assert(isapprox(evalprogram(&prog, &env, s), vanderpol(s, 1.5), 1e-15));
+
+   // powers reuse temporaries, constants fold, functions and precedence
+   assert(compileprogram(&prog, "(x + y)^3 - (x - y)^2*(x + 1)^4", "-2^2 + 3*4/2 + a*sin(t) - b^x + sqrt(abs(y))*exp(-x)"));
+   assert(prog.numconsts == 2);  // 1 and -2^2 + 3*4/2 = 2
+   Vec2F64 got = evalprogram(&prog, &env, s);
+   assert(isapprox(got.elems[0], pow(x + y, 3) - pow(x - y, 2) * pow(x + 1, 4), 1e-12));
+   assert(isapprox(got.elems[1], -4 + 6 + 2 * sin(0.5) - pow(3, x) + sqrt(fabs(y)) * exp(-x), 1e-12));
+
+   // errors point at the problem
+   assert(!compileprogram(&prog, "x + ", "y"));
+   assert(strstr(prog.error, "dx/dt") != NULL);
+   assert(!compileprogram(&prog, "x", "y*(x + 1"));
+   assert(strstr(prog.error, "expected ')'") != NULL);
+   assert(!compileprogram(&prog, "x", "z"));
+   assert(strstr(prog.error, "unknown name at column 1") != NULL);
+
+   // the batched rk4 step matches a hand-written one, across block edges
+   assert(compileprogram(&prog, "y", "mu*(1 - x^2)*y - x"));
+   constexpr int n = 3 * vm_lanes + 5;
+   Particles p;
+   initparticles(&p, n, 4);
+   for (int i = 0; i < n; i += 1)
+      spawnparticle(&p, i, {randfloat64(-3, 3), randfloat64(-3, 3)});
+   Vec2F64 init[n];
+   for (int i = 0; i < n; i += 1)
+      init[i] = getMostRecentPos(&p, i);
+   f64 h = 0.01;
+   stepnonlinear(&p, &prog, env, h);
+   stepnonlinear(&p, &prog, env, h);
+   for (int i = 0; i < n; i += 1)
+   {
+      Vec2F64 u = init[i];
+      for (int step = 0; step < 2; step += 1)
+      {
+         Vec2F64 k1 = vanderpol(u, 1.5);
+         Vec2F64 k2 = vanderpol(u + (0.5 * h) * k1, 1.5);
+         Vec2F64 k3 = vanderpol(u + (0.5 * h) * k2, 1.5);
+         Vec2F64 k4 = vanderpol(u + h * k3, 1.5);
+         u = u + (h / 6) * (k1 + 2.0 * k2 + 2.0 * k3 + k4);
+      }
+      assert(isapprox(getMostRecentPos(&p, i), u, 1e-12));
+   }
+   assert(isapprox(p.time, 2 * h, 1e-15));
+   freeparticles(&p);
+}
+
+void test_adaptive()
+{
+   puts("==== adaptive dormand-prince ====");
+   // x' = -(1 + c y^2) x, y' = 0: each particle decays at its own rate and
+   // the one with a large y is stiff
+   Program prog;
+   bool ok = compileprogram(&prog, "-(1 + c*y^2)*x", "0");
+   assert(ok);
+   (void) ok;
+   ProgramRhs rhs = {&prog, {0, {0, 0, 100, 0, 0}}};
+   constexpr int n = vm_lanes + 7;
+   Particles p;
+   initparticles(&p, n, 8);
+   for (int i = 0; i < n; i += 1)
+      spawnparticle(&p, i, {1, i == 3 ? 3.0 : 0.0});
+
+   AdaptiveSolver s;
+   initadaptive(&s, n, 1e-8, 1e-12);
+   f64 h = 0.1;
+   for (int row = 1; row <= 10; row += 1)
+   {
+      stepadaptive(&s, &p, programrhs, &rhs, h);
+      // rows land on the requested times, in between the solver's own steps
+      assert(isapprox(p.time, row * h, 1e-12));
+      for (int i = 0; i < n; i += 1)
+      {
+         f64 rate = 1 + 100 * getMostRecentPos(&p, i).elems[1] * getMostRecentPos(&p, i).elems[1];
+         f64 exact = exp(-rate * row * h);
+         assert(fabs(getMostRecentPos(&p, i).elems[0] - exact) < 1e-6 * max(exact, 1e-30) + 1e-10);
+      }
+   }
+   // the smooth particles take about one step per row, and the stiff one
+   // takes hundreds without making the others in its block take more
+   u64 stiffsteps = s.stats.steps;
+   AdaptiveSolver smooth;
+   initadaptive(&smooth, n, 1e-8, 1e-12);
+   for (int i = 0; i < n; i += 1)
+      spawnparticle(&p, i, {1, 0});
+   for (int row = 0; row < 10; row += 1)
+      stepadaptive(&smooth, &p, programrhs, &rhs, h);
+   assert(smooth.stats.steps <= 2 * 10 * (u64) n);
+   assert(stiffsteps - smooth.stats.steps > 100);
+   assert(stiffsteps - smooth.stats.steps < 1000);
+
+   // a respawned particle restarts from its new position
+   spawnparticle(&p, 5, {2, 0});
+   stepadaptive(&smooth, &p, programrhs, &rhs, h);
+   assert(isapprox(getMostRecentPos(&p, 5).elems[0], 2 * exp(-h), 1e-7));
+
+   // time-varying linear systems through A(t)
+   MatrixRhs mrhs = {mathieutest, NULL};
+   Particles q;
+   initparticles(&q, 1, 2);
+   spawnparticle(&q, 0, {1, 0});
+   AdaptiveSolver sq;
+   initadaptive(&sq, 1, 1e-10, 1e-12);
+   for (int row = 0; row < 40; row += 1)
+      stepadaptive(&sq, &q, matrixrhs, &mrhs, 0.1);
+   Particles r;
+   initparticles(&r, 1, 2);
+   spawnparticle(&r, 0, {1, 0});
+   for (int step = 0; step < 4000; step += 1)
+      stepmagnus(&r, mathieutest, NULL, 0.001);
+   assert(isapprox(getMostRecentPos(&q, 0), getMostRecentPos(&r, 0), 1e-7));
+
+   // a lane whose right-hand side is nan shrinks its step to the minimum in
+   // a few tries and then gives up, next to one that steps as usual
+   Program nanprog;
+   ok = compileprogram(&nanprog, "sqrt(x)", "0");
+   assert(ok);
+   ProgramRhs nanrhs = {&nanprog, {}};
+   Particles b;
+   initparticles(&b, 2, 4);
+   spawnparticle(&b, 0, {-1, 0});
+   spawnparticle(&b, 1, {1, 0});
+   AdaptiveSolver sb;
+   initadaptive(&sb, 2, 1e-8, 1e-12);
+   for (int row = 0; row < 5; row += 1)
+      stepadaptive(&sb, &b, programrhs, &nanrhs, h);
+   assert(sb.stats.rejected < 50 && sb.stats.steps < 100);
+   assert(sb.stats.stalled == 5);
+   assert(isapprox(getMostRecentPos(&b, 1).elems[0], (1 + 5 * h / 2) * (1 + 5 * h / 2), 1e-7));
+
+   freeadaptive(&s);
+   freeadaptive(&smooth);
+   freeadaptive(&sq);
+   freeadaptive(&sb);
+   freeparticles(&b);
+   freeparticles(&p);
+   freeparticles(&q);
+   freeparticles(&r);
+}
+
+void test_trajectoryfile()
+{
+   puts("==== trajectory file ====");
+   // zero-order hold: with u held, x' = A x + B u is an affine map per step,
+   // and for invertible A it fixes the equilibrium -A^-1 B u
+   Mat2x2F64 A = {-1, 2, -3, -0.5};
+   Mat2x2F64 B = {1, 0, 0.5, 2};
+   Vec2F64 u = {1, -1};
+   f64 dt = 0.05;
+   Discretized d = discretize(A, B, dt);
+   assert(isapprox(d.M, expm_closedform(dt * A), 1e-12));
+   Vec2F64 equilibrium = -1.0 * linsolve_nonsingular(A, matvecmul(B, u));
+   Vec2F64 next = matvecmul(d.M, equilibrium) + matvecmul(d.N, u);
+   assert(isapprox(next, equilibrium, 1e-12));
+   // for small dt the input block is about dt B
+   assert(isapprox(discretize(A, B, 1e-6).N, 1e-6 * B, 1e-11));
+
+   constexpr int n = 5;
+   f64 x[n] = {1, 2, 3, 4, 5};
+   f64 y[n] = {-1, -2, -3, -4, -5};
+   FILE *bin = tmpfile();
+   FILE *npy = tmpfile();
+   AN(bin);
+   AN(npy);
+   TrajectoryWriter w;
+   inittrajectorywriter(&w, bin, NULL, npy, maketrajectoryheader(n, 3, dt, 2 * dt, A, B, u, 42));
+   writeframe(&w, 0, x, y);
+   writeframe(&w, 2 * dt, y, x);
+   bool ok = finishtrajectorywriter(&w);
+   assert(ok);
+   (void) ok;
+
+   // the header records the frames actually written
+   TrajectoryHeader h;
+   rewind(bin);
+   size_t got = fread(&h, sizeof(h), 1, bin);
+   assert(got == 1);
+   assert(checktrajectoryheader(&h));
+   assert(h.count == n && h.numframes == 2 && h.seed == 42);
+   assert(h.dt == dt && h.frameinterval == 2 * dt);
+   assert(memcmp(h.A, A.elems, sizeof(h.A)) == 0);
+   f64 frame[1 + 2 * n];
+   fseek(bin, (long) sizeof(h) + (long) sizeof(frame), SEEK_SET);
+   got = fread(frame, sizeof(frame), 1, bin);
+   assert(got == 1);
+   assert(frame[0] == 2 * dt && frame[1] == y[0] && frame[1 + n] == x[0]);
+   assert(fgetc(bin) == EOF);
+
+   char npyheader[npy_headersize + 1] = {};
+   rewind(npy);
+   got = fread(npyheader, 1, npy_headersize, npy);
+   assert(got == npy_headersize);
+   assert(memcmp(npyheader, "\x93NUMPY\x01\x00", 8) == 0);
+   assert(strstr(npyheader + 10, "'shape': (2, 2, 5)") != NULL);
+   assert(npyheader[npy_headersize - 1] == '\n');
+   f64 npyframe[2 * n];
+   fseek(npy, npy_headersize + (long) sizeof(npyframe), SEEK_SET);
+   got = fread(npyframe, sizeof(npyframe), 1, npy);
+   assert(got == 1);
+   assert(npyframe[0] == y[0] && npyframe[n] == x[0]);
+   (void) got;
+
+   fclose(bin);
+   fclose(npy);
+}
+
+void test_random()
+{
+   puts("==== random numbers ====");
+   // reference values of xoshiro256** from the state {1, 2, 3, 4}
+   Rng r = {{1, 2, 3, 4}};
+   assert(nextu64(&r) == 11520ull);
+   assert(nextu64(&r) == 0ull);
+   assert(nextu64(&r) == 1509978240ull);
+   assert(nextu64(&r) == 1215971899390074240ull);
+
+   // same seed, same numbers; different seeds and jumped streams differ
+   Rng a, b;
+   seedrng(&a, 7);
+   seedrng(&b, 7);
+   for (int i = 0; i < 100; i += 1)
+      assert(nextu64(&a) == nextu64(&b));
+   seedrng(&b, 8);
+   assert(nextu64(&a) != nextu64(&b));
+   b = a;
+   jumprng(&b);
+   assert(nextu64(&a) != nextu64(&b));
+
+   // the vector path draws the same numbers as the lanes one at a time
+   RngLanes vec, one;
+   seedrng(&a, 3);
+   initlanes(&vec, &a);
+   one = vec;
+   f64 block[4 * rng_lanes + 3];
+   filluniform(&vec, block, arrlen(block), -1, 1);
+   for (int i = 0; i < arrlen(block); i += rng_lanes)
+   {
+      u64 bits[rng_lanes];
+      nextlanes(&one, bits);
+      for (int j = 0; j < rng_lanes && i + j < arrlen(block); j += 1)
+         assert(block[i + j] == -1 + tounit52(bits[j]) * 2);
+   }
+
+   constexpr int n = 100003;
+   f64 *u = (f64 *) malloc(n * sizeof(f64));
+   AN(u);
+   RngLanes lanes;
+   seedrng(&a, 1);
+   initlanes(&lanes, &a);
+   filluniform(&lanes, u, n, -2, 3);
+   f64 mean = 0, var = 0;
+   for (int i = 0; i < n; i += 1)
+   {
+      assert(u[i] >= -2 && u[i] < 3);
+      mean += u[i] / n;
+   }
+   for (int i = 0; i < n; i += 1)
+      var += (u[i] - mean) * (u[i] - mean) / n;
+   assert(isapprox(mean, 0.5, 0.03));
+   assert(isapprox(var, 25 / 12.0, 0.05));
+
+   fillnormal(&lanes, u, n, 1, 2);
+   mean = 0;
+   var = 0;
+   for (int i = 0; i < n; i += 1)
+      mean += u[i] / n;
+   for (int i = 0; i < n; i += 1)
+      var += (u[i] - mean) * (u[i] - mean) / n;
+   assert(isapprox(mean, 1, 0.03));
+   assert(isapprox(var, 4, 0.1));
+   free(u);
+
+   // spawning depends on the seed only, not on the threads
+   constexpr int count = 3 * particle_chunk + 17;
+   Particles p, q;
+   initparticles(&p, count, 2);
+   initparticles(&q, count, 2);
+   ThreadPool pool;
+   initthreadpool(&pool, 3);
+   seedrng(&a, 99);
+   seedrng(&b, 99);
+   spawnuniform(&p, 0, {-1, -2}, {1, 2}, &a);
+   spawnuniform(&q, 0, {-1, -2}, {1, 2}, &b, &pool);
+   assert(memcmp(currentx(&p), currentx(&q), count * sizeof(f64)) == 0);
+   assert(memcmp(currenty(&p), currenty(&q), count * sizeof(f64)) == 0);
+   assert(memcmp(&a, &b, sizeof(Rng)) == 0);
+   for (int i = 0; i < count; i += 1)
+   {
+      Vec2F64 pos = getMostRecentPos(&p, i);
+      assert(fabs(pos.elems[0]) <= 1 && fabs(pos.elems[1]) <= 2);
+      assert(p.basex[i] == pos.elems[0] && p.basey[i] == pos.elems[1]);
+   }
+   // chunks don't repeat each other
+   assert(currentx(&p)[0] != currentx(&p)[particle_chunk]);
+
+   // respawning a tail leaves the head alone
+   f64 head = currentx(&p)[10];
+   spawnuniform(&p, 20, {-1, -2}, {1, 2}, &a);
+   assert(currentx(&p)[10] == head);
+   assert(currentx(&p)[20] != currentx(&q)[20]);
+
+   freethreadpool(&pool);
+   freeparticles(&p);
+   freeparticles(&q);
+}
+
+void test_sampling()
+{
+   puts("==== low-discrepancy sampling ====");
+   assert(radicalinverse(1, 3) == 1 / 3.0);
+   assert(isapprox(radicalinverse(5, 3), 2 / 3.0 + 1 / 9.0, 1e-15));
+   assert(radicalinverse(6, 2) == 0.375);
+   assert(reversebits(1) == 1u << 31);
+   assert(sobol2(1) == 1u << 31 && sobol2(2) == 3u << 30 && sobol2(3) == 1u << 30);
+
+   // the first 1024 Sobol points put exactly one point in every cell of a
+   // 32 x 32 grid, scrambled or not; random points leave about a third empty
+   constexpr int side = 32;
+   int cells[side * side];
+   Sampler sobol, random;
+   initsampler(&sobol, SAMPLE_SOBOL, 5);
+   initsampler(&random, SAMPLE_RANDOM, 5);
+   memset(cells, 0, sizeof(cells));
+   for (int k = 0; k < side * side; k += 1)
+   {
+      Vec2F64 u = nextsample(&sobol);
+      assert(u.elems[0] >= 0 && u.elems[0] < 1 && u.elems[1] >= 0 && u.elems[1] < 1);
+      cells[(int) (u.elems[1] * side) * side + (int) (u.elems[0] * side)] += 1;
+   }
+   for (int c = 0; c < side * side; c += 1)
+      assert(cells[c] == 1);
+   memset(cells, 0, sizeof(cells));
+   for (int k = 0; k < side * side; k += 1)
+   {
+      Vec2F64 u = nextsample(&random);
+      cells[(int) (u.elems[1] * side) * side + (int) (u.elems[0] * side)] += 1;
+   }
+   int empty = 0;
+   for (int c = 0; c < side * side; c += 1)
+      empty += cells[c] == 0;
+   assert(empty > side * side / 5);
+
+   // Halton: the first 2^3 3^2 = 72 unshifted points fill an 8 x 9 grid
+   Sampler halton;
+   initsampler(&halton, SAMPLE_HALTON, 5);
+   halton.shift[0] = halton.shift[1] = 0;
+   memset(cells, 0, sizeof(cells));
+   for (int k = 0; k < 72; k += 1)
+   {
+      Vec2F64 u = nextsample(&halton);
+      // nudged up, 1/3 * 9 may round to just below 3
+      cells[(int) (u.elems[1] * 9 + 1e-9) * 8 + (int) (u.elems[0] * 8)] += 1;
+   }
+   for (int c = 0; c < 72; c += 1)
+      assert(cells[c] == 1);
+
+   // spawning in pieces continues the sequence, with or without threads
+   constexpr int count = 2 * particle_chunk + 5;
+   Particles p, q;
+   initparticles(&p, count, 2);
+   initparticles(&q, count, 2);
+   ThreadPool pool;
+   initthreadpool(&pool, 2);
+   Sampler a, b;
+   initsampler(&a, SAMPLE_HALTON, 9);
+   initsampler(&b, SAMPLE_HALTON, 9);
+   spawnsampled(&p, 0, {-1, -1}, {1, 1}, &a, &pool);
+   spawnsampled(&q, count - 100, {-1, -1}, {1, 1}, &b);
+   spawnsampled(&q, 0, {-1, -1}, {1, 1}, &b);
+   assert(a.index == count && b.index == count + 100);
+   assert(isapprox(getMostRecentPos(&q, 0), getMostRecentPos(&p, 100), 0.0));
+   assert(isapprox(getMostRecentPos(&q, count - 101), getMostRecentPos(&p, count - 1), 0.0));
+   Vec2F64 next = nextsample(&a, {-1, -1}, {1, 1});
+   Vec2F64 expected = Vec2F64(-1, -1) + 2.0 * samplepoint(&a, count);
+   assert(isapprox(next, expected, 1e-15));
+
+   freethreadpool(&pool);
+   freeparticles(&p);
+   freeparticles(&q);
+}
+
+void test_recycling()
+{
+   puts("==== particle classification ====");
+   constexpr int n = particle_chunk + 10;
+   Particles p;
+   initparticles(&p, n, 4);
+   for (int i = 0; i < n; i += 1)
+      spawnparticle(&p, i, {0.5, 0.5});
+   // moves particle 0 out of the box, stalls 1 at the origin and leaves the
+   // rest moving inside
+   Mat2x2F64 M = {0.9, 0, 0, 0.9};
+   propagateparticles(&p, M);
+   currentx(&p)[0] = 5;
+   currentx(&p)[1] = currenty(&p)[1] = 0;
+   histrow(&p, p.histx, 1)[1] = histrow(&p, p.histy, 1)[1] = 1e-4;
+   currenty(&p)[n - 1] = NAN;
+   spawnparticle(&p, 2, {0, 0});
+
+   u8 *fate = (u8 *) malloc(n);
+   AN(fate);
+   int counts[3];
+   ThreadPool pool;
+   initthreadpool(&pool, 2);
+   classifyparticles(&p, {-1, -1}, {1, 1}, 0.01, fate, counts, &pool);
+   assert(fate[0] == FATE_OFFSCREEN);
+   assert(fate[1] == FATE_STALLED);
+   assert(fate[2] == FATE_LIVE);  // just spawned, no step to judge by yet
+   assert(fate[3] == FATE_LIVE);
+   assert(fate[n - 1] == FATE_OFFSCREEN);
+   assert(counts[FATE_LIVE] == n - 3 && counts[FATE_OFFSCREEN] == 2 && counts[FATE_STALLED] == 1);
+
+   // trails are culled by their bounds: 0 still has its older point inside,
+   // 4 is outside all along, 5 crosses the box between two points outside it
+   // and 6 only has a stale row inside from before it respawned outside
+   currentx(&p)[4] = histrow(&p, p.histx, 1)[4] = 5;
+   currentx(&p)[5] = -5;
+   histrow(&p, p.histx, 1)[5] = 5;
+   currenty(&p)[5] = histrow(&p, p.histy, 1)[5] = 0;
+   spawnparticle(&p, 6, {5, 5});
+   classifytrails(&p, {-1, -1}, {1, 1}, fate, &pool);
+   assert(fate[0] == FATE_LIVE);
+   assert(fate[1] == FATE_LIVE);
+   assert(fate[3] == FATE_LIVE);
+   assert(fate[4] == FATE_OFFSCREEN);
+   assert(fate[5] == FATE_LIVE);
+   assert(fate[6] == FATE_OFFSCREEN);
+   assert(fate[n - 1] == FATE_OFFSCREEN);
+
+   freethreadpool(&pool);
+   free(fate);
+   freeparticles(&p);
+}
+
+void test_quiver()
+{
+   puts("==== direction field ====");
+   Quiver q = {};
+   Mat2x2F64 A = {0, -1, 1, 0};  // rotation, counterclockwise
+   int spacing = 40;
+   ViewTransform view = makeviewtransform(20, 400, 300);
+   buildquiver(&q, A, &view, 400, 300, spacing, BLACK);
+   // an 11 x 8 grid through the origin, minus the arrow at the fixed point
+   assert(q.numarrows == 11 * 8 - 1);
+   for (int i = 0; i < q.numarrows; i += 1)
+   {
+      Vector2 *v = &q.verts[i * quiver_verts_per_arrow];
+      f32 dx = v[1].x - v[0].x, dy = v[1].y - v[0].y;
+      assert(isapprox(sqrtf(dx * dx + dy * dy), 0.8f * (f32) spacing, 1e-3f));
+      // perpendicular to the position for a rotation
+      f32 cx = 0.5f * (v[0].x + v[1].x) - 200, cy = 0.5f * (v[0].y + v[1].y) - 150;
+      assert(fabsf(dx * cx + dy * cy) < 1e-2f * sqrtf(cx * cx + cy * cy) * (f32) spacing);
+      assert(v[2].x == v[1].x && v[4].y == v[1].y);
+   }
+   // the grid is in screen space, so zooming in changes no counts
+   int arrows = q.numarrows;
+   ViewTransform zoomed = makeviewtransform(1000, 400, 300);
+   buildquiver(&q, A, &zoomed, 400, 300, spacing, BLACK);
+   assert(q.numarrows == arrows);
+   // panned, the grid still goes through the origin
+   ViewTransform panned = makeviewtransform(20, 400, 300, 13, -7);
+   buildquiver(&q, A, &panned, 400, 300, spacing, BLACK);
+   assert(q.numarrows == arrows);
+   for (int i = 0; i < q.numarrows; i += 1)
+   {
+      Vector2 *v = &q.verts[i * quiver_verts_per_arrow];
+      f32 dx = v[1].x - v[0].x, dy = v[1].y - v[0].y;
+      f32 cx = 0.5f * (v[0].x + v[1].x) - 213, cy = 0.5f * (v[0].y + v[1].y) - 143;
+      assert(fabsf(dx * cx + dy * cy) < 1e-2f * sqrtf(cx * cx + cy * cy) * (f32) spacing);
+   }
+   // a denser grid reallocates
+   buildquiver(&q, A, &view, 400, 300, 8, BLACK);
+   assert(q.numarrows == 51 * 38 - 1 && q.capacity >= 51 * 38);
+   freequiver(&q);
+}
+
+void test_regimemap()
+{
+   puts("==== stability map ====");
+   f64 tr[] = {0, -3, 3, -1, 1, 0, 1, 4, -2};
+   f64 det[] = {-1, 2, 2, 2, 2, 1, 0, 4, 1};
+   u8 expected[] = {
+      REGIME_SADDLE, REGIME_STABLE_NODE, REGIME_UNSTABLE_NODE, REGIME_STABLE_SPIRAL, REGIME_UNSTABLE_SPIRAL,
+      REGIME_CENTER, REGIME_DEGENERATE, REGIME_DEGENERATE, REGIME_DEGENERATE,
+   };
+   u8 regime[9];
+   classifyregimes(tr, det, regime, 9, 1e-3, 1e-3);
+   for (int i = 0; i < 9; i += 1)
+      assert(regime[i] == expected[i]);
+
+   // tiles spread over threads give the same picture as one thread
+   int size = 100;  // not a multiple of the tile size
+   Color *serial = (Color *) malloc(size * size * sizeof(Color));
+   Color *parallel = (Color *) malloc(size * size * sizeof(Color));
+   ThreadPool pool;
+   initthreadpool(&pool, 4);
+   RegimeMapView view = {REGIMEMAP_TRACEDET, 0.5, 1, 3, 0, 0};
+   computeregimemap(&view, serial, size);
+   computeregimemap(&view, parallel, size, &pool);
+   assert(memcmp(serial, parallel, size * size * sizeof(Color)) == 0);
+   // lower half plane is all saddles
+   Color c = serial[(size - 1) * size + 10];
+   Color saddle = regime_colors[REGIME_SADDLE];
+   assert(c.r == saddle.r && c.g == saddle.g && c.b == saddle.b);
+   view.mode = REGIMEMAP_SLICE;
+   view.a21 = -1;
+   view.a22 = 0.5;
+   computeregimemap(&view, serial, size);
+   computeregimemap(&view, parallel, size, &pool);
+   assert(memcmp(serial, parallel, size * size * sizeof(Color)) == 0);
+   freethreadpool(&pool);
+   free(serial);
+   free(parallel);
+
+   // pixels and coordinates invert each other
+   Vec2F64 p = regimemappixel(&view, 256, regimemapcoords(&view, 256, 17.5, 200.5));
+   assert(isapprox(p.elems[0], 17.5, 1e-9) && isapprox(p.elems[1], 200.5, 1e-9));
+
+   // clicking the map moves A onto the point clicked
+   Mat2x2F64 A = {0, -1, 1, -0.2};
+   Mat2x2F64 cases[] = {A, {1, 0, 0, 2}, {0, 0, 0, 0}};
+   view.mode = REGIMEMAP_TRACEDET;
+   for (Mat2x2F64 M : cases)
+   {
+      Vec2F64 target = {-0.7, 3.25};
+      Mat2x2F64 moved = regimemapmatrix(&view, M, target);
+      Vec2F64 got = regimemapposition(&view, moved);
+      assert(isapprox(got.elems[0], target.elems[0], 1e-9) && isapprox(got.elems[1], target.elems[1], 1e-9));
+   }
+   view.mode = REGIMEMAP_SLICE;
+   Mat2x2F64 moved = regimemapmatrix(&view, A, {2, 3});
+   assert(moved(0, 0) == 2 && moved(0, 1) == 3 && moved(1, 0) == A(1, 0) && moved(1, 1) == A(1, 1));
+}
+
+void test_trailmesh()
+{
+   puts("==== trail mesh ====");
+   // a horizontal trail going left, 10 pixels per segment
+   Vector2 points[5] = {{100, 50}, {90, 50}, {80, 50}, {70, 50}, {60, 50}};
+   Vector2 verts[4 * trail_verts_per_segment];
+   Color colors[4 * trail_verts_per_segment];
+   TrailStyle style = {4, 1, 0.5f, {200, 0, 0, 200}};
+   int n = appendtrail(verts, colors, points, 5, 4, &style);
+   assert(n == 4 * trail_verts_per_segment);
+   for (int s = 0; s < 4; s += 1)
+   {
+      Vector2 *v = &verts[s * trail_verts_per_segment];
+      Color *c = &colors[s * trail_verts_per_segment];
+      // tapers from the newer to the older point
+      f32 w0 = 4 - (f32) s, w1 = 3 - (f32) s;
+      assert(v[1].x == points[s].x && isapprox(v[1].y - v[2].y, -w0, 1e-5f));
+      assert(v[0].x == points[s + 1].x && isapprox(v[0].y - v[3].y, -w1, 1e-5f));
+      assert(c[1].a == (unsigned char) (200 * (1 - 0.125f * (f32) s)) && c[0].a == (unsigned char) (200 * (1 - 0.125f * (f32) (s + 1))));
+      assert(c[0].r == 200 && c[0].g == 0);
+      // two triangles with the same winding
+      f32 cross1 = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[1].y - v[0].y) * (v[2].x - v[0].x);
+      f32 cross2 = (v[4].x - v[3].x) * (v[5].y - v[3].y) - (v[4].y - v[3].y) * (v[5].x - v[3].x);
+      assert(cross1 * cross2 >= 0);
+   }
+   // runs out of width before the end, and repeated points make no quad
+   style.taper = 2;
+   assert(appendtrail(verts, colors, points, 5, 4, &style) == 2 * trail_verts_per_segment);
+   Vector2 still[3] = {{5, 5}, {5, 5}, {6, 5}};
+   assert(appendtrail(verts, colors, still, 3, 4, &style) == trail_verts_per_segment);
+   // the taper is spread over the full trail, so a longer history still draws all of it
+   style.taper = 1;
+   assert(appendtrail(verts, colors, points, 5, 40, &style) == 4 * trail_verts_per_segment);
+   assert(isapprox(verts[3 * trail_verts_per_segment].y - verts[3 * trail_verts_per_segment + 3].y, -4 * (1 - 4 / 40.0f), 1e-5f));
+
+   // whole particles: the young one only has part of a trail, the culled one
+   // none, and the full ones leave their oldest row out
+   Particles p;
+   initparticles(&p, 3, 5);
+   for (int i = 0; i < 3; i += 1)
+      spawnparticle(&p, i, {1, 1});
+   Mat2x2F64 M = {0.9, 0, 0, 0.9};
+   for (int s = 0; s < 3; s += 1)
+      propagateparticles(&p, M);
+   spawnparticle(&p, 1, {2, 2});
+   propagateparticles(&p, M);
+   Vector2 pixels[3 * 5];
+   for (int i = 0; i < 3 * 5; i += 1)
+      pixels[i] = {(f32) (10 * i), (f32) i};
+   u8 fate[3] = {FATE_LIVE, FATE_LIVE, FATE_OFFSCREEN};
+   TrailMesh m = {};
+   reservetrailmesh(&m, 3, 4);
+   style = {2, 0, 0, WHITE};
+   buildtrailchunk(&m, &p, pixels, fate, 0, 3, &style);
+   assert(m.numchunks == 1 && m.chunkverts[0] == (3 + 1) * trail_verts_per_segment);
+   buildtrailchunk(&m, &p, pixels, NULL, 0, 3, &style);
+   assert(m.chunkverts[0] == (3 + 1 + 3) * trail_verts_per_segment);
+   // refitting to the same shape keeps the buffer, another shape replaces it
+   Vector2 *verts0 = m.verts;
+   fittrailmesh(&m, 3, 4);
+   assert(m.verts == verts0 && trailmeshmemory(&m) == 3 * 3 * trail_verts_per_segment * (sizeof(Vector2) + sizeof(Color)) + sizeof(int));
+   fittrailmesh(&m, 3, 2);
+   assert(m.maxsegments == 1 && m.count == 3);
+   freetrailmesh(&m);
+   assert(m.verts == NULL && m.numchunks == 0 && trailmeshmemory(&m) == 0);
+   freeparticles(&p);
+}
+
+void test_softraster()
+{
+   puts("==== software rasterizer ====");
+   const RGBA8 white = {255, 255, 255, 255}, black = {0, 0, 0, 255};
+   SoftRenderer r;
+   initsoftrenderer(&r, 100, 70);  // not a multiple of the tile size
+   assert(r.tilesx == 2 && r.tilesy == 2);
+
+   // 2 pixels thick through the middle of row 10, so it half covers rows 9 and 11
+   softclear(&r, white);
+   softline(&r, 10, 10.5f, 90, 10.5f, 2, black);
+   softrender(&r);
+   assert(r.pixels[10 * 100 + 50].r == 0);
+   assert(r.pixels[9 * 100 + 50].r == 128 && r.pixels[11 * 100 + 50].r == 128);
+   assert(r.pixels[12 * 100 + 50].r == 255 && r.pixels[10 * 100 + 95].r == 255);
+   assert(r.pixels[10 * 100 + 50].a == 255);
+   // lines far off screen record nothing, images are alpha blended
+   u8 image[2 * 2 * 4] = {0, 0, 255, 255,  0, 0, 255, 0,  0, 0, 255, 51,  0, 0, 255, 255};
+   softclear(&r, white);
+   softline(&r, -500, -500, -400, -100, 3, black);
+   softimage(&r, 98, 68, image, 2, 2);
+   assert(r.numcommands == 1);
+   softrender(&r);
+   assert(r.pixels[68 * 100 + 98].r == 0 && r.pixels[68 * 100 + 99].r == 255 && r.pixels[69 * 100 + 98].r == 204);
+
+   // a half transparent quad of two triangles, as the trails send them through
+   // the backend, blends every pixel once, also along the shared diagonal
+   DrawBackend b = softbackend(&r);
+   Vector2 quad[6] = {{20, 20}, {40, 20}, {40, 40}, {20, 20}, {40, 40}, {20, 40}};
+   Color quadcolors[6];
+   for (int k = 0; k < 6; k += 1)
+      quadcolors[k] = {0, 0, 0, 128};
+   softclear(&r, white);
+   b.triangles(b.ctx, quad, quadcolors, 6);
+   softrender(&r);
+   for (int y = 18; y < 42; y += 1)
+   {
+      for (int x = 18; x < 42; x += 1)
+      {
+         bool inside = x >= 20 && x < 40 && y >= 20 && y < 40;
+         assert(r.pixels[y * 100 + x].r == (inside ? 127 : 255));
+      }
+   }
+   // corner colors are interpolated
+   RGBA8 corners[3] = {{255, 0, 0, 255}, {0, 0, 255, 255}, {0, 0, 255, 255}};
+   f32 corner[6] = {0, 0, 64, 0, 0, 64};
+   softclear(&r, white);
+   softtriangle(&r, corner, corners);
+   softrender(&r);
+   assert(r.pixels[0].r > 240 && r.pixels[0].b < 15);
+   assert(r.pixels[31 * 100 + 1].r < 140 && r.pixels[31 * 100 + 1].b > 115);
+   // the axis labels: one rectangle per run of a glyph row, in 2x2 pixel squares
+   softclear(&r, white);
+   b.text(b.ctx, "-1 x", 10, 10, 20, BLACK);
+   assert(r.numcommands == 1 + 7);
+   softrender(&r);
+   assert(r.pixels[(10 + 2 * 4) * 100 + 10].r == 0 && r.pixels[(10 + 2 * 4) * 100 + 19].r == 0);
+   assert(r.pixels[(10 + 2 * 1) * 100 + 22 + 2 * 1].r == 255 && r.pixels[(10 + 2 * 1) * 100 + 22 + 2 * 2].r == 0);
+
+   // tiles over threads draw the same picture as one thread
+   SoftRenderer serial;
+   initsoftrenderer(&serial, 300, 200);
+   SoftRenderer parallel;
+   initsoftrenderer(&parallel, 300, 200);
+   ThreadPool pool;
+   initthreadpool(&pool, 4);
+   Rng rng;
+   seedrng(&rng, 5);
+   for (SoftRenderer *s : {&serial, &parallel})
+      softclear(s, white);
+   for (int i = 0; i < 500; i += 1)
+   {
+      f32 c[4];
+      for (int k = 0; k < 4; k += 1)
+         c[k] = (f32) randuniform(&rng, -50, 350);
+      RGBA8 color = {(u8) (i * 7), (u8) (i * 13), (u8) (i * 29), (u8) (100 + i % 156)};
+      for (SoftRenderer *s : {&serial, &parallel})
+         softline(s, c[0], c[1], c[2], c[3], (f32) (1 + i % 5), color);
+   }
+   softrender(&serial);
+   softrender(&parallel, &pool);
+   assert(memcmp(serial.pixels, parallel.pixels, 300 * 200 * sizeof(RGBA8)) == 0);
+   freethreadpool(&pool);
+   freesoftrenderer(&serial);
+   freesoftrenderer(&parallel);
+
+   // the checksums PNG needs, and the files
+   assert(crc32update(0, (const u8 *) "123456789", 9) == 0xcbf43926u);
+   assert(crc32update(0, (const u8 *) "IEND", 4) == 0xae426082u);
+   FILE *f = tmpfile();
+   bool ok = writepng(&r, f);
+   assert(ok);
+   long pngsize = ftell(f);
+   // signature, IHDR, IDAT with a zlib header, one stored block and adler32, IEND
+   long rawsize = 70 * (1 + 4 * 100);
+   assert(pngsize == 8 + 25 + 12 + 2 + 5 + rawsize + 4 + 12);
+   u8 head[16];
+   rewind(f);
+   ok = fread(head, 1, 16, f) == 16;
+   assert(ok);
+   assert(head[0] == 0x89 && memcmp(head + 1, "PNG", 3) == 0 && memcmp(head + 12, "IHDR", 4) == 0);
+   fclose(f);
+   f = tmpfile();
+   ok = writeppm(&r, f);
+   assert(ok);
+   (void) ok;
+   assert(ftell(f) == (long) strlen("P6\n100 70\n255\n") + 3 * 100 * 70);
+   fclose(f);
+   freesoftrenderer(&r);
+}
+
+void test_axeslayer()
+{
+   puts("==== axes layer ====");
+   // only the staleness check, redrawing needs a window
+   AxesLayer layer = {};
+   AxesKey key = makeaxeskey(AXES_2D, 20, 800, 600, BLACK);
+   assert(axeslayerstale(&layer, &key));
+   layer.key = key;
+   layer.valid = true;
+   AxesKey same = makeaxeskey(AXES_2D, 20, 800, 600, BLACK);
+   assert(!axeslayerstale(&layer, &same));
+   AxesKey changed[] = {
+      makeaxeskey(AXES_2D, 21, 800, 600, BLACK),
+      makeaxeskey(AXES_2D, 20, 801, 600, BLACK),
+      makeaxeskey(AXES_2D, 20, 800, 599, BLACK),
+      makeaxeskey(AXES_1D, 20, 800, 600, BLACK),
+      makeaxeskey(AXES_1D, 20, 800, 600, GREEN),
+      makeaxeskey(AXES_2D, 20, 800, 600, BLACK, 1, 0),
+      makeaxeskey(AXES_2D, 20, 800, 600, BLACK, 0, -1),
+   };
+   for (AxesKey k : changed)
+      assert(axeslayerstale(&layer, &k));
+   // the first tick on screen, wherever the origin is
+   assert(firsttick(0, 20) == 0 && firsttick(40, 20) == -2);
+   assert(firsttick(25, 20) == -1 && firsttick(-25, 20) == 2 && firsttick(-40, 20) == 2);
+}
+
+void test_persistence()
+{
+   puts("==== persistence buffer ====");
+   assert(persistencefactor(0, 0.5f) == 1);
+   assert(isapprox(persistencefactor(0.5f, 0.5f), 0.5f, 1e-6f));
+   assert(isapprox(persistencefactor(1 / 60.0f, 0.5f) * persistencefactor(1 / 60.0f, 0.5f), persistencefactor(2 / 60.0f, 0.5f), 1e-6f));
+   assert(persistencefactor(1 / 60.0f, 0) == 0);
+   // an unallocated buffer is left alone, allocating needs a window
+   PersistenceBuffer pb = {};
+   clearpersistence(&pb);
+   drawpersistence(&pb);
+   freepersistence(&pb);
+   assert(!pb.valid);
+}
+
+void test_curvetrails()
+{
+   puts("==== curve trails ====");
+   Vector2 points[curve_grid + 1];
+   f32 ages[curve_grid + 1];
+   CurveTrail c;
+   // half a turn of a circle of radius 5 units = 100 pixels
+   Mat2x2F64 rotation = {0, 1, -1, 0};
+   f64 rowdt = M_PI / 15;
+   ViewTransform view = makeviewtransform(20, 400, 300);
+   initcurvetrail(&c, rotation, M_PI, 0, rowdt, &view);
+   assert(curvegridend(&c, M_PI) == curve_grid && curvegridend(&c, 2 * M_PI) == curve_grid);
+   assert(curvegridend(&c, M_PI / 2) == curve_grid / 2 && curvegridend(&c, -1) == 0);
+   int coarse = tessellatecurve(&c, {5, 0}, curve_grid, 4, points, ages);
+   int fine = tessellatecurve(&c, {5, 0}, curve_grid, 0.25f, points, ages);
+   assert(coarse > curve_basepieces + 1 && fine > coarse && fine <= curve_grid + 1);
+   for (int k = 0; k < fine; k += 1)
+   {
+      f32 dx = points[k].x - 200, dy = points[k].y - 150;
+      assert(isapprox(sqrtf(dx * dx + dy * dy), 100.0f, 1e-3f));
+      if (k > 0)
+      {
+         assert(ages[k] > ages[k - 1]);
+         // the arc bulges out of its chord by at most the tolerance, 1 - cos(theta/2) of the radius
+         f32 chord = sqrtf((points[k].x - points[k-1].x) * (points[k].x - points[k-1].x)
+               + (points[k].y - points[k-1].y) * (points[k].y - points[k-1].y));
+         f32 sagitta = 100 - sqrtf(100 * 100 - 0.25f * chord * chord);
+         assert(sagitta <= 0.25f * 1.01f || chord <= (f32) (100 * M_PI / curve_grid) * 1.01f);
+      }
+   }
+   // going back in time along x' = A x: the newest point is x, the oldest e^{-pi A} x = -x
+   assert(isapprox(points[0].x, 300.0f, 1e-3f) && isapprox(points[0].y, 150.0f, 1e-3f));
+   assert(isapprox(points[fine - 1].x, 100.0f, 1e-3f) && isapprox(points[fine - 1].y, 150.0f, 1e-3f));
+   assert(isapprox(ages[fine - 1], 15.0f, 1e-4f));
+
+   // a straight path needs nothing past the coarse pieces, a young particle
+   // only part of the grid
+   initcurvetrail(&c, Mat2x2F64(-1, 0, 0, -1), 1, 0, 0.1, &view);
+   assert(tessellatecurve(&c, {3, 2}, curve_grid, 0.25f, points, ages) == curve_basepieces + 1);
+   assert(tessellatecurve(&c, {3, 2}, 2, 0.25f, points, ages) == 3);
+   assert(tessellatecurve(&c, {3, 2}, 0, 0.25f, points, ages) == 1);
+   // a particle at rest does not split either
+   initcurvetrail(&c, rotation, M_PI, 0, rowdt, &view);
+   assert(tessellatecurve(&c, {0, 0}, curve_grid, 0.25f, points, ages) == curve_basepieces + 1);
+
+   // the trail shows where particles were drawn `lag` before the current state
+   initcurvetrail(&c, rotation, M_PI, M_PI / 2, rowdt, &view);
+   tessellatecurve(&c, {5, 0}, curve_grid, 0.25f, points, ages);
+   assert(isapprox(points[0].x, 200.0f, 1e-3f) && isapprox(points[0].y, 250.0f, 1e-3f));
+   // and panning moves all of it
+   ViewTransform panned = makeviewtransform(20, 400, 300, -30, 12);
+   initcurvetrail(&c, rotation, M_PI, M_PI / 2, rowdt, &panned);
+   tessellatecurve(&c, {5, 0}, curve_grid, 0.25f, points, ages);
+   assert(isapprox(points[0].x, 170.0f, 1e-3f) && isapprox(points[0].y, 262.0f, 1e-3f));
+}
+
+void test_densitymap()
+{
+   puts("==== density map ====");
+   // 10 x 8 bins of one unit, origin in bin (5, 4), y up
+   DensityMap m = {};
+   initdensitymap(&m, 10, 8, 3, MAROON);
+   f64 x[] = {0.5, 0.5, 0.7, -4.5, 4.9, 100, NAN, 0.5};
+   f64 y[] = {0.5, 0.5, 0.1, 3.5, -3.9, 0, 0, -0.5};
+   updatedensitymap(&m, x, y, 8, 1, 5, 4, 1);
+   assert(m.density[3 * 10 + 5] == 3);
+   assert(m.density[0 * 10 + 0] == 1 && m.density[7 * 10 + 9] == 1 && m.density[4 * 10 + 5] == 1);
+   f32 total = 0;
+   for (int i = 0; i < 10 * 8; i += 1)
+      total += m.density[i];
+   assert(total == 6);  // off the map and NaN are dropped
+   assert(m.maxdensity == 3);
+   // densest bin gets the end of the ramp, empty ones are transparent
+   assert(m.pixels[3 * 10 + 5].a == 255 && m.pixels[3 * 10 + 5].r == 0);
+   assert(m.pixels[1 * 10 + 1].a == 0);
+   assert(m.pixels[0].a > 0 && m.pixels[0].a < 255);
+
+   // decay, and the private bins are empty again after every update
+   updatedensitymap(&m, x, y, 0, 1, 5, 4, 0.5f);
+   assert(m.density[3 * 10 + 5] == 1.5f && m.maxdensity == 1.5f);
+   for (int i = 0; i < 3 * 10 * 8; i += 1)
+      assert(m.bins[i] == 0);
+   cleardensitymap(&m);
+   assert(m.density[3 * 10 + 5] == 0);
+
+   // slices over threads bin the same as one
+   ThreadPool pool;
+   initthreadpool(&pool, 4);
+   int n = 100000;
+   f64 *px = (f64 *) malloc(n * sizeof(f64));
+   f64 *py = (f64 *) malloc(n * sizeof(f64));
+   Rng rng;
+   seedrng(&rng, 3);
+   for (int i = 0; i < n; i += 1)
+   {
+      px[i] = randnormal(&rng, 0, 1);
+      py[i] = randnormal(&rng, 0, 1);
+   }
+   DensityMap serial = {};
+   initdensitymap(&serial, 200, 150, 1, MAROON);
+   initdensitymap(&m, 200, 150, 4, MAROON);
+   updatedensitymap(&serial, px, py, n, 30, 100, 75, 0.9f);
+   updatedensitymap(&m, px, py, n, 30, 100, 75, 0.9f, &pool);
+   assert(memcmp(serial.density, m.density, 200 * 150 * sizeof(f32)) == 0);
+   assert(memcmp(serial.pixels, m.pixels, 200 * 150 * sizeof(Color)) == 0);
+   freethreadpool(&pool);
+   free(px);
+   free(py);
+   freedensitymap(&serial);
+   freedensitymap(&m);
+}
+
+void test_viewtransform()
+{
+   puts("==== view transform ====");
+   // unpanned, the origin is the center of the screen and y points up
+   ViewTransform vt = makeviewtransform(20, 800, 600);
+   Vec2F64 pixel = viewtopixel(&vt, {1.5, -2});
+   assert(pixel.elems[0] == 430 && pixel.elems[1] == 340);
+   ViewTransform panned = makeviewtransform(20, 800, 600, -30, 12);
+   pixel = viewtopixel(&panned, {1.5, -2});
+   assert(pixel.elems[0] == 400 && pixel.elems[1] == 352);
+   assert(isapprox(pixeltoview(&panned, pixel), Vec2F64(1.5, -2)));
+   Vec2F64 lo, hi;
+   viewbounds(&panned, 800, 600, &lo, &hi);
+   assert(isapprox(lo, Vec2F64(-18.5, -14.4)) && isapprox(hi, Vec2F64(21.5, 15.6)));
+
+   // every kernel gives the pixels of the scalar one, strided, with an odd
+   // count so the vector kernels run their scalar tails
+   constexpr int n = 37;
+   constexpr int stride = 3;
+   f64 x[n], y[n], olderx[n], oldery[n];
+   for (int i = 0; i < n; i += 1)
+   {
+      x[i] = randfloat64(-20, 20);
+      y[i] = randfloat64(-20, 20);
+      olderx[i] = x[i] + randfloat64(-1, 1);
+      oldery[i] = y[i] + randfloat64(-1, 1);
+   }
+   f32 expected[2 * n * stride] = {};
+   topixels_scalar(&panned, x, y, olderx, oldery, 0.3, expected, stride, n);
+   for (int i = 0; i < n; i += 1)
+   {
+      Vec2F64 pos = Vec2F64(olderx[i], oldery[i]) + 0.3 * (Vec2F64(x[i], y[i]) - Vec2F64(olderx[i], oldery[i]));
+      pixel = viewtopixel(&panned, pos);
+      assert(expected[2 * i * stride] == (f32) pixel.elems[0] && expected[2 * i * stride + 1] == (f32) pixel.elems[1]);
+   }
+   for (int level = 0; level < NUM_SIMD_LEVELS; level += 1)
+   {
+      if (!simdlevel_supported((SimdLevel) level))
+         continue;
+      f32 got[2 * n * stride] = {};
+      pixelkernel((SimdLevel) level)(&panned, x, y, olderx, oldery, 0.3, got, stride, n);
+      assert(memcmp(got, expected, sizeof(got)) == 0);
+      f32 packed[2 * n];
+      pixelkernel((SimdLevel) level)(&panned, x, y, x, y, 1, packed, 1, n);
+      for (int i = 0; i < n; i += 1)
+      {
+         pixel = viewtopixel(&panned, {x[i], y[i]});
+         assert(packed[2 * i] == (f32) pixel.elems[0] && packed[2 * i + 1] == (f32) pixel.elems[1]);
+      }
+   }
+
+   // whole trails, blended except the spawn point of the young ones; the full
+   // ones draw their oldest row only through the point blended from it
+   Particles p;
+   initparticles(&p, n, 4);
+   for (int i = 0; i < n; i += 1)
+      spawnparticle(&p, i, {x[i], y[i]});
+   Mat2x2F64 M = expm_closedform(0.1 * Mat2x2F64(-0.3, 2, -1.5, 0.1));
+   for (int s = 0; s < 5; s += 1)
+   {
+      propagateparticles(&p, M);
+      if (s == 3)
+         spawnparticle(&p, 5, {1, 1});
+   }
+   Vector2 trails[n * 4];
+   historytopixels(&panned, &p, 0.25, 0, n, (f32 *) trails);
+   for (int i = 0; i < n; i += 1)
+   {
+      assert(drawntrailsize(&p, i) == (i == 5 ? 2 : 3));
+      for (int ago = 0; ago < drawntrailsize(&p, i); ago += 1)
+      {
+         Vec2F64 pos = getRecentPos(&p, i, ago);
+         if (ago + 1 < trailsize(&p, i))
+            pos = getRecentPos(&p, i, ago + 1) + 0.25 * (pos - getRecentPos(&p, i, ago + 1));
+         pixel = viewtopixel(&panned, pos);
+         assert(trails[i * 4 + ago].x == (f32) pixel.elems[0] && trails[i * 4 + ago].y == (f32) pixel.elems[1]);
+      }
+   }
+   assert(trailsize(&p, 5) == 2 && trails[5 * 4 + 1].x == 390 && trails[5 * 4 + 1].y == 292);
+   // culled particles at the ends of a block are left out, the live ones match
+   u8 fate[n];
+   for (int i = 0; i < n; i += 1)
+      fate[i] = i < 3 || i == n - 1 || i == 10 ? FATE_OFFSCREEN : FATE_LIVE;
+   Vector2 culled[n * 4];
+   for (int k = 0; k < n * 4; k += 1)
+      culled[k] = {-1, -1};
+   historytopixels(&panned, &p, 0.25, 0, n, (f32 *) culled, fate);
+   for (int i = 0; i < n; i += 1)
+   {
+      for (int ago = 0; ago < drawntrailsize(&p, i); ago += 1)
+      {
+         if (fate[i] == FATE_LIVE)
+            assert(culled[i * 4 + ago].x == trails[i * 4 + ago].x && culled[i * 4 + ago].y == trails[i * 4 + ago].y);
+         else if (i != 10)
+            assert(culled[i * 4 + ago].x == -1 && culled[i * 4 + ago].y == -1);
+      }
+   }
+   freeparticles(&p);
+}
+
 int main(void)
 {
    /* test_julia(); */
    /* test_raylib_imgui(); */
    test_ourlinearalgebra();
+   test_particles();
+   test_threadpool();
+   test_clock();
+   test_derivedcache();
+   test_timevarying();
+   test_expression();
+   test_adaptive();
+   test_trajectoryfile();
+   test_random();
+   test_sampling();
+   test_recycling();
+   test_quiver();
+   test_regimemap();
+   test_trailmesh();
+   test_softraster();
+   test_axeslayer();
+   test_persistence();
+   test_curvetrails();
+   test_densitymap();
+   test_viewtransform();
    return 0;
 }
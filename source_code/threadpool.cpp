@@ -0,0 +1,220 @@
+#pragma once
+
+#ifndef WEB
+   // the min/max macros in useful_utils.cpp break the standard library headers
+   #pragma push_macro("min")
+   #pragma push_macro("max")
+   #undef min
+   #undef max
+   #include <atomic>
+   #include <condition_variable>
+   #include <mutex>
+   #include <thread>
+   #pragma pop_macro("min")
+   #pragma pop_macro("max")
+#endif
+
+#include "useful_utils.cpp"
+
+// Persistent worker pool for data-parallel loops. parallelfor splits [0, count)
+// into fixed-size chunks and hands each worker a contiguous run of them. A
+// worker takes chunks from the front of its own run and, once that is empty,
+// steals from the back of the others. Chunk boundaries only depend on count and
+// chunksize, never on the thread count, so as long as chunks are independent
+// the results are identical for any number of threads.
+//
+// The web build has no threads; everything runs on the calling thread.
+
+#define max_threads 64
+#define cacheline_size 64
+
+typedef void (*ChunkFn)(void *ctx, int begin, int end);
+
+#ifndef WEB
+// [front, back) chunk indices packed into one word so that the owner popping
+// the front and thieves popping the back can never take the same chunk
+struct alignas(cacheline_size) ChunkQueue
+{
+   std::atomic<u64> range;
+};
+#endif
+
+struct ThreadPool
+{
+   int numthreads;  // including the calling thread
+#ifndef WEB
+   std::thread workers[max_threads];
+   ChunkQueue queues[max_threads];
+
+   std::mutex mutex;
+   std::condition_variable wake;
+   std::condition_variable done;
+   u64 generation;
+   int active;
+   bool quit;
+
+   ChunkFn fn;
+   void *ctx;
+   int count;
+   int chunksize;
+#endif
+};
+
+static inline
+int hardwarethreads()
+{
+#ifdef WEB
+   return 1;
+#else
+   return clampint((int) std::thread::hardware_concurrency(), 1, max_threads);
+#endif
+}
+
+#ifndef WEB
+static inline
+u64 packrange(u32 front, u32 back)
+{
+   return (u64) front | ((u64) back << 32);
+}
+
+static inline
+int popfront(ChunkQueue *q)
+{
+   u64 range = q->range.load(std::memory_order_relaxed);
+   for (;;)
+   {
+      u32 front = (u32) range;
+      u32 back = (u32) (range >> 32);
+      if (front >= back)
+         return -1;
+      if (q->range.compare_exchange_weak(range, packrange(front + 1, back), std::memory_order_acquire))
+         return (int) front;
+   }
+}
+
+static inline
+int popback(ChunkQueue *q)
+{
+   u64 range = q->range.load(std::memory_order_relaxed);
+   for (;;)
+   {
+      u32 front = (u32) range;
+      u32 back = (u32) (range >> 32);
+      if (front >= back)
+         return -1;
+      if (q->range.compare_exchange_weak(range, packrange(front, back - 1), std::memory_order_acquire))
+         return (int) back - 1;
+   }
+}
+
+static
+void runchunks(ThreadPool *pool, int id)
+{
+   for (;;)
+   {
+      int chunk = popfront(&pool->queues[id]);
+      for (int i = 1; chunk < 0 && i < pool->numthreads; i += 1)
+         chunk = popback(&pool->queues[(id + i) % pool->numthreads]);
+      if (chunk < 0)
+         return;
+
+      int begin = chunk * pool->chunksize;
+      int end = min(begin + pool->chunksize, pool->count);
+      pool->fn(pool->ctx, begin, end);
+   }
+}
+
+static
+void workerloop(ThreadPool *pool, int id)
+{
+   u64 seen = 0;
+   for (;;)
+   {
+      {
+         std::unique_lock<std::mutex> lock(pool->mutex);
+         pool->wake.wait(lock, [&]{ return pool->quit || pool->generation != seen; });
+         if (pool->quit)
+            return;
+         seen = pool->generation;
+      }
+
+      runchunks(pool, id);
+
+      std::lock_guard<std::mutex> lock(pool->mutex);
+      pool->active -= 1;
+      if (pool->active == 0)
+         pool->done.notify_one();
+   }
+}
+#endif
+
+void initthreadpool(ThreadPool *pool, int numthreads)
+{
+#ifdef WEB
+   pool->numthreads = 1;
+#else
+   pool->numthreads = clampint(numthreads, 1, max_threads);
+   pool->generation = 0;
+   pool->active = 0;
+   pool->quit = false;
+   for (int i = 0; i < pool->numthreads; i += 1)
+      pool->queues[i].range.store(0);
+   for (int i = 1; i < pool->numthreads; i += 1)
+      pool->workers[i] = std::thread(workerloop, pool, i);
+#endif
+}
+
+void freethreadpool(ThreadPool *pool)
+{
+#ifndef WEB
+   {
+      std::lock_guard<std::mutex> lock(pool->mutex);
+      pool->quit = true;
+   }
+   pool->wake.notify_all();
+   for (int i = 1; i < pool->numthreads; i += 1)
+      pool->workers[i].join();
+#endif
+   pool->numthreads = 0;
+}
+
+// calls fn(ctx, begin, end) over [0, count) in chunks of chunksize and returns
+// once all of them are done. A NULL pool runs everything on the calling thread.
+void parallelfor(ThreadPool *pool, int count, int chunksize, ChunkFn fn, void *ctx)
+{
+   if (count <= 0)
+      return;
+   assert(chunksize > 0);
+   int numchunks = (count + chunksize - 1) / chunksize;
+   if (pool == NULL || pool->numthreads == 1 || numchunks == 1)
+   {
+      for (int begin = 0; begin < count; begin += chunksize)
+         fn(ctx, begin, min(begin + chunksize, count));
+      return;
+   }
+
+#ifndef WEB
+   int n = pool->numthreads;
+   {
+      std::lock_guard<std::mutex> lock(pool->mutex);
+      pool->fn = fn;
+      pool->ctx = ctx;
+      pool->count = count;
+      pool->chunksize = chunksize;
+      for (int i = 0; i < n; i += 1)
+      {
+         u32 front = (u32) ((i64) numchunks * i / n);
+         u32 back = (u32) ((i64) numchunks * (i + 1) / n);
+         pool->queues[i].range.store(packrange(front, back), std::memory_order_relaxed);
+      }
+      pool->active = n - 1;
+      pool->generation += 1;
+   }
+   pool->wake.notify_all();
+
+   runchunks(pool, 0);
+
+   std::unique_lock<std::mutex> lock(pool->mutex);
+   pool->done.wait(lock, [&]{ return pool->active == 0; });
+#endif
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "useful_utils.cpp"
+#include "linearalgebra.cpp"
+#include "particles.cpp"
+
+// Integrators for dx/dt = A(t) x. The 4th-order Magnus method samples A at
+// the two Gauss-Legendre points of a step and exponentiates
+//    Omega = h/2 (A1 + A2) + sqrt(3)/12 h^2 [A2, A1],
+// which is one propagator for the whole ensemble, so every particle still
+// costs a single matvec per step. For constant A it is the exact exponential.
+
+typedef Mat2x2F64 (*MatrixFn)(void *ctx, f64 t);
+
+#define max_table_knots 64
+
+// A(t) from a table of knots, linear in between. Two knots at the same time
+// make a jump. With a nonzero period the table repeats, otherwise the end
+// values are held.
+struct MatrixTable
+{
+   int count;
+   f64 period;
+   f64 times[max_table_knots];
+   Mat2x2F64 values[max_table_knots];
+};
+
+static inline
+void addknot(MatrixTable *table, f64 time, Mat2x2F64 value)
+{
+   assert(table->count < max_table_knots);
+   assert(table->count == 0 || time >= table->times[table->count - 1]);
+   table->times[table->count] = time;
+   table->values[table->count] = value;
+   table->count += 1;
+}
+
+Mat2x2F64 evaltable(void *ctx, f64 t)
+{
+   MatrixTable *table = (MatrixTable *) ctx;
+   assert(table->count > 0);
+   int n = table->count;
+   if (table->period > 0)
+   {
+      f64 phase = fmod(t - table->times[0], table->period);
+      if (phase < 0)
+         phase += table->period;
+      t = table->times[0] + phase;
+   }
+   if (t <= table->times[0])
+      return table->values[0];
+   if (t >= table->times[n - 1])
+      return table->values[n - 1];
+
+   int k = 0;
+   while (table->times[k + 1] <= t)
+      k += 1;
+   f64 frac = (t - table->times[k]) / (table->times[k + 1] - table->times[k]);
+   return table->values[k] + frac * (table->values[k + 1] - table->values[k]);
+}
+
+static inline
+Mat2x2F64 commutator(Mat2x2F64 X, Mat2x2F64 Y)
+{
+   return matmul(X, Y) - matmul(Y, X);
+}
+
+// propagator from t to t + h
+Mat2x2F64 magnus4(MatrixFn A, void *ctx, f64 t, f64 h)
+{
+   const f64 c = sqrt(3.0) / 6;
+   Mat2x2F64 A1 = A(ctx, t + (0.5 - c) * h);
+   Mat2x2F64 A2 = A(ctx, t + (0.5 + c) * h);
+   Mat2x2F64 omega = (0.5 * h) * (A1 + A2) + (sqrt(3.0) / 12 * h * h) * commutator(A2, A1);
+   return expm_closedform(omega);
+}
+
+// advances every particle by h from p->time
+void stepmagnus(Particles *p, MatrixFn A, void *ctx, f64 h, ThreadPool *pool = NULL)
+{
+   propagateparticles(p, magnus4(A, ctx, p->time, h), pool);
+   p->time += h;
+}
+
+// classic RK4 on every particle, as a reference for the Magnus integrator.
+// A is evaluated once per stage for the whole ensemble, but each particle
+// still takes four matvecs.
+void steprk4(Particles *p, MatrixFn A, void *ctx, f64 h)
+{
+   Mat2x2F64 A0 = A(ctx, p->time);
+   Mat2x2F64 Ahalf = A(ctx, p->time + 0.5 * h);
+   Mat2x2F64 A1 = A(ctx, p->time + h);
+   const f64 *x = currentx(p);
+   const f64 *y = currenty(p);
+   advancehistory(p);
+   f64 *newx = currentx(p);
+   f64 *newy = currenty(p);
+   for (int i = 0; i < p->count; i += 1)
+   {
+      Vec2F64 s = {x[i], y[i]};
+      Vec2F64 k1 = matvecmul(A0, s);
+      Vec2F64 k2 = matvecmul(Ahalf, s + (0.5 * h) * k1);
+      Vec2F64 k3 = matvecmul(Ahalf, s + (0.5 * h) * k2);
+      Vec2F64 k4 = matvecmul(A1, s + h * k3);
+      Vec2F64 next = s + (h / 6) * (k1 + 2.0 * k2 + 2.0 * k3 + k4);
+      newx[i] = next.elems[0];
+      newy[i] = next.elems[1];
+   }
+   p->time += h;
+}
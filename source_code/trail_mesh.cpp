@@ -0,0 +1,216 @@
+#pragma once
+
+#include "useful_utils.cpp"
+#include "particles.cpp"
+#include "view_transform.cpp"
+#include "draw_backend.cpp"
+
+// Every trail segment as a quad of two triangles in one buffer that lives
+// across frames, so drawing the trails is one batch of triangles instead of
+// a DrawLineEx call per segment. The quads taper towards the tail and every
+// vertex gets its own color, fading with age.
+//
+// The buffer is split in ranges of particle_chunk particles; each range is
+// filled from its start by one worker, and drawn up to the count it wrote.
+
+#define trail_verts_per_segment 6
+
+struct TrailStyle
+{
+   f32 thickness;  // of the newest segment, in pixels
+   f32 taper;      // share of the width gone at the end of a full trail
+   f32 fade;       // share of the alpha gone at the end of a full trail
+   Color color;
+};
+
+// the history trails of the game and the headless runner
+static const TrailStyle default_trailstyle = {3, 0.5f, 0.6f, MAROON};
+
+struct TrailMesh
+{
+   int count;        // particles
+   int maxsegments;  // per particle
+   int numchunks;
+   Vector2 *verts;
+   Color *colors;
+   int *chunkverts;  // vertices written in every range
+};
+
+void freetrailmesh(TrailMesh *m)
+{
+   free(m->verts);
+   free(m->colors);
+   free(m->chunkverts);
+   *m = {};
+}
+
+void reservetrailmesh(TrailMesh *m, int count, int histcapacity)
+{
+   freetrailmesh(m);
+   m->count = count;
+   m->maxsegments = histcapacity - 1;
+   m->numchunks = (count + particle_chunk - 1) / particle_chunk;
+   size_t numverts = (size_t) count * (size_t) m->maxsegments * trail_verts_per_segment;
+   m->verts = (Vector2 *) malloc(numverts * sizeof(Vector2));
+   m->colors = (Color *) malloc(numverts * sizeof(Color));
+   m->chunkverts = (int *) calloc((size_t) m->numchunks, sizeof(int));
+   AN(m->verts);
+   AN(m->colors);
+   AN(m->chunkverts);
+}
+
+// reserves the mesh only when its shape changes, so each trail mode can ask
+// for what it needs every frame
+void fittrailmesh(TrailMesh *m, int count, int histcapacity)
+{
+   if (m->verts == NULL || m->count != count || m->maxsegments != histcapacity - 1)
+      reservetrailmesh(m, count, histcapacity);
+}
+
+static inline
+size_t trailmeshmemory(int count, int maxsegments)
+{
+   size_t numverts = (size_t) count * (size_t) maxsegments * trail_verts_per_segment;
+   size_t numchunks = (size_t) ((count + particle_chunk - 1) / particle_chunk);
+   return numverts * (sizeof(Vector2) + sizeof(Color)) + numchunks * sizeof(int);
+}
+
+static inline
+size_t trailmeshmemory(TrailMesh *m)
+{
+   return trailmeshmemory(m->count, m->maxsegments);
+}
+
+// one tapered quad from a to b, with the same corners and winding as
+// DrawLineEx; returns the number of vertices written
+static inline
+int appendsegment(Vector2 *v, Color *c, Vector2 a, Vector2 b, f32 widtha, f32 widthb, Color colora, Color colorb)
+{
+   f32 dx = b.x - a.x, dy = b.y - a.y;
+   f32 length = sqrtf(dx * dx + dy * dy);
+   if (!(length > 0))
+      return 0;
+   f32 nx = -dy / length, ny = dx / length;
+   f32 rax = 0.5f * widtha * nx, ray = 0.5f * widtha * ny;
+   f32 rbx = 0.5f * widthb * nx, rby = 0.5f * widthb * ny;
+   v[0] = {b.x + rbx, b.y + rby}; c[0] = colorb;
+   v[1] = {a.x + rax, a.y + ray}; c[1] = colora;
+   v[2] = {a.x - rax, a.y - ray}; c[2] = colora;
+   v[3] = {b.x - rbx, b.y - rby}; c[3] = colorb;
+   v[4] = {b.x + rbx, b.y + rby}; c[4] = colorb;
+   v[5] = {a.x - rax, a.y - ray}; c[5] = colora;
+   return trail_verts_per_segment;
+}
+
+// width and color of the trail `age` segments back
+static inline
+f32 trailwidth(TrailStyle *style, f32 age, int maxsegments)
+{
+   return style->thickness * max(1 - style->taper / (f32) maxsegments * age, 0.0f);
+}
+
+static inline
+Color trailcolor(TrailStyle *style, f32 age, int maxsegments)
+{
+   Color c = style->color;
+   c.a = (unsigned char) ((f32) c.a * max(1 - style->fade / (f32) maxsegments * age, 0.0f));
+   return c;
+}
+
+// the quads of one trail of `size` points, newest first; returns the number
+// of vertices written
+static inline
+int appendtrail(Vector2 *verts, Color *colors, const Vector2 *points, int size, int maxsegments, TrailStyle *style)
+{
+   int n = 0;
+   for (int ago = 1; ago < size; ago += 1)
+   {
+      f32 widtha = trailwidth(style, (f32) (ago - 1), maxsegments);
+      if (widtha <= 0)
+         break;
+      n += appendsegment(&verts[n], &colors[n], points[ago - 1], points[ago],
+            widtha, trailwidth(style, (f32) ago, maxsegments),
+            trailcolor(style, (f32) (ago - 1), maxsegments), trailcolor(style, (f32) ago, maxsegments));
+   }
+   return n;
+}
+
+// Like appendtrail(), for points at any spacing: ages[k] is how many history
+// rows back point k is, which the taper and fade follow.
+static inline
+int appendcurve(Vector2 *verts, Color *colors, const Vector2 *points, const f32 *ages, int size, int maxsegments, TrailStyle *style)
+{
+   int n = 0;
+   for (int k = 1; k < size; k += 1)
+   {
+      f32 widtha = trailwidth(style, ages[k - 1], maxsegments);
+      if (widtha <= 0)
+         break;
+      n += appendsegment(&verts[n], &colors[n], points[k - 1], points[k],
+            widtha, trailwidth(style, ages[k], maxsegments),
+            trailcolor(style, ages[k - 1], maxsegments), trailcolor(style, ages[k], maxsegments));
+   }
+   return n;
+}
+
+// Fills the range of particles [begin, end), which has to be a whole chunk.
+// points[i*histcapacity + ago] are the trails in pixels; particles whose fate
+// is FATE_OFFSCREEN are left out when fate, from classifytrails(), is given.
+void buildtrailchunk(TrailMesh *m, Particles *p, const Vector2 *points, const u8 *fate, int begin, int end, TrailStyle *style)
+{
+   assert(begin % particle_chunk == 0 && end <= m->count);
+   assert(m->maxsegments == p->histcapacity - 2);
+   int hc = p->histcapacity;
+   size_t first = (size_t) begin * (size_t) m->maxsegments * trail_verts_per_segment;
+   Vector2 *verts = &m->verts[first];
+   Color *colors = &m->colors[first];
+   int n = 0;
+   for (int i = begin; i < end; i += 1)
+   {
+      if (fate && fate[i] == FATE_OFFSCREEN)
+         continue;
+      n += appendtrail(&verts[n], &colors[n], &points[(size_t) i * (size_t) hc], drawntrailsize(p, i), m->maxsegments, style);
+   }
+   m->chunkverts[begin / particle_chunk] = n;
+}
+
+struct TrailJob
+{
+   TrailMesh *m;
+   Particles *p;
+   const ViewTransform *view;
+   f64 alpha;
+   Vector2 *points;
+   const u8 *fate;
+   TrailStyle style;
+};
+
+// every trail point is drawn alpha of the way from its older neighbour, so the
+// whole trail moves smoothly between fixed steps
+static
+void trailchunk(void *ctx, int begin, int end)
+{
+   TrailJob *job = (TrailJob *) ctx;
+   historytopixels(job->view, job->p, job->alpha, begin, end, (f32 *) job->points, job->fate);
+   buildtrailchunk(job->m, job->p, job->points, job->fate, begin, end, &job->style);
+}
+
+// The quads of the history trails of all particles. points is scratch for
+// count*histcapacity pixels; fate as in buildtrailchunk().
+void buildtrails(TrailMesh *m, Particles *p, const ViewTransform *vt, f64 alpha, Vector2 *points, const u8 *fate,
+      TrailStyle style, ThreadPool *pool)
+{
+   // at most histcapacity - 1 points a trail, see drawntrailsize()
+   fittrailmesh(m, p->count, p->histcapacity - 1);
+   TrailJob job = {m, p, vt, alpha, points, fate, style};
+   parallelfor(pool, p->count, particle_chunk, trailchunk, &job);
+}
+
+void drawtrailmesh(TrailMesh *m, DrawBackend *b)
+{
+   for (int chunk = 0; chunk < m->numchunks; chunk += 1)
+   {
+      size_t first = (size_t) chunk * particle_chunk * (size_t) m->maxsegments * trail_verts_per_segment;
+      b->triangles(b->ctx, &m->verts[first], &m->colors[first], m->chunkverts[chunk]);
+   }
+}
@@ -1,30 +1,84 @@
 #pragma once
 
-#define histcapacity 16
-struct Trajectory
+#include "particles.cpp"
+#include "derived_cache.cpp"
+#include "expression.cpp"
+#include "adaptive.cpp"
+#include "quiver.cpp"
+#include "trail_mesh.cpp"
+#include "persistence_buffer.cpp"
+#include "curve_trails.cpp"
+#include "density_map.cpp"
+#include "regime_map.cpp"
+#include "eigen_lines.cpp"
+
+// sizes can be changed at runtime from the controls or the command line
+#ifdef WEB
+   #define default_numtrajectories 300
+#else
+   #define default_numtrajectories 400
+#endif
+#define default_histcapacity 16
+#define max_numtrajectories 1000000
+#define min_histcapacity 3  // two drawn points, blended from the rows behind them
+#define max_histcapacity 256
+// for everything sized by the particles, with the trail mesh of the history
+// trails; the longer the trails, the fewer particles fit
+#ifdef WEB
+   #define trajectory_memory_budget ((size_t) 512 << 20)
+#else
+   #define trajectory_memory_budget ((size_t) 2 << 30)
+#endif
+
+Particles particles;
+int newtrajidx = 0;
+ThreadPool threadpool;
+Sampler spawnsampler;  // where new particles start, shared by resets and spawning over time
+
+// Particles that left the view or came to rest are classified once per frame.
+// Spawning reuses them before going round robin. Trails are culled separately,
+// by their bounds, so a trail whose head left the view is still drawn.
+struct Recycler
 {
-   Vec2F64 recentpositions[histcapacity];
-   int curidx;
-   int size;
+   u8 *fate;   // ParticleFate of every particle
+   u8 *trailfate;  // FATE_OFFSCREEN when the whole trail is outside the view
+   int *dead;  // off-screen or stalled, in index order
+   int numdead;
+   int nextdead;
+   int counts[3];
+   u64 recycled;
 };
 
-void initTrajectory(Trajectory *t)
-{
-   memset(t->recentpositions, 0, histcapacity * sizeof(t->recentpositions[0]));
-   t->curidx = 0;
-   t->size = 0;
-}
+Recycler recycler;
+bool recycle_immediately = false;
+f32 recycle_minspeed = 0.05f;  // units per second
 
-void updateposition(Trajectory *t, Vec2F64 position)
-{
-   t->recentpositions[t->curidx] = position;
-   t->curidx = (t->curidx + 1) % histcapacity;
-   t->size = min(histcapacity, t->size + 1);
-}
+// trails in pixel coordinates, trailpixels[i*histcapacity + ago]; refilled
+// every frame because the view can change
+Vector2 *trailpixels = NULL;
+TrailMesh trailmesh = {};
 
-#define numtrajectories 400
-Trajectory trajectories[numtrajectories];
-int newtrajidx = 0;
+// persistent trails: every frame only the segment from where each particle
+// was drawn last frame goes into the fading persistbuffer
+bool persistent_trails = false;
+f32 persist_halflife = 0.5f;  // seconds
+bool persist_restart = true;
+PersistenceBuffer persistbuffer = {};
+Vector2 *lastpixel = NULL;
+u32 *lastbirth = NULL;  // particles respawned since have no segment to draw
+
+// smooth trails: the linear flow tessellated by screen-space error
+bool smooth_trails = false;
+f32 curve_tolerance = 0.25f;  // pixels
+CurveTrail curvetrail;
+int curvesegments = 0;        // drawn last frame
+
+// density map instead of trails, for particle counts where lines blur
+bool show_density = false;
+f32 density_halflife = 0.25f;  // seconds
+int density_binsize = 2;       // pixels per bin
+DensityMap densitymap = {};
+Texture2D densitytexture = {};
 
 #ifdef JULIA_BACKEND
    f64 *currentstates;
@@ -32,36 +86,169 @@ int newtrajidx = 0;
    jl_array_t *x_jlarr;
    jl_function_t *solve_autonomous;
 #else
-   Vec2F64 currentstates[numtrajectories];
    Mat2x2F64 A;
 #endif
 
 f64 *AData;
 bool spawn_new_trajectories = true;
 bool show_eigenvectors = true;
+bool show_quiver = true;
+int quiver_spacing = 32;  // pixels between arrows
+
+#define regimemap_size 256
+RegimeMapView regimeview = {REGIMEMAP_TRACEDET, 0, 0, 4, 0, 0};
+Texture2D regimetexture = {};
+Color *regimepixels = NULL;
 bool show_trajeigencomponents = false;
+f64 steptime_ms = 0;
 
 constexpr f64 trajectory_lifetime_s = 5;
 f64 time_since_last_spawn = 0;
-constexpr f64 spawn_period = trajectory_lifetime_s / numtrajectories;
+
+// how each history row is computed: by stepping the previous one, or from the
+// base states with the exponential of A (see particles.cpp)
+enum TimeMode
+{
+   TIME_STEP,
+   TIME_ANALYTIC,
+};
+
+#define max_fastforward 256
+
+TimeMode timemode = TIME_STEP;
+int fastforward = 1;     // fixed steps per history row
+f64 timelinebegin = 0;   // the analytic mode cannot seek to before A last changed
+f64 timelineend = 0;
+// steps taken under anything but x' = A x, by the nonlinear system, Hill's
+// equation or the control input; the analytic base states are stale after
+// any of them
+u64 foreignsteps = 0;
+MatPowers2x2 propagatorpowers;
+
+// x' = f(x) typed into the controls, in place of x' = A x
+enum Dynamics
+{
+   DYNAMICS_LINEAR,
+   DYNAMICS_NONLINEAR,
+};
+
+struct NonlinearPreset
+{
+   const char *name;
+   const char *fx;
+   const char *fy;
+   f64 params[num_vm_params];  // a, b, c, d, mu
+};
+
+const NonlinearPreset nonlinearpresets[] = {
+   {"Van der Pol", "y", "mu*(1 - x^2)*y - x", {1, 1, 1, 1, 1.5}},
+   {"Lotka-Volterra", "a*x - b*x*y", "d*x*y - c*y", {1.1, 0.4, 0.4, 0.1, 0}},
+   {"Duffing", "y", "-d*y - a*x - b*x^3 + c*cos(mu*t)", {-1, 1, 0.3, 0.2, 1.2}},
+   {"damped pendulum", "y", "-a*sin(x) - b*y", {1, 0.2, 0, 0, 0}},
+};
+
+Dynamics dynamics = DYNAMICS_LINEAR;
+int nonlinearpreset = 0;
+char nonlinearfx[max_expression_length];
+char nonlinearfy[max_expression_length];
+Program nonlinearprogram;
+bool nonlinearcompiled = false;
+VmEnv nonlinearenv;
+
+enum Integrator
+{
+   INTEGRATOR_RK4,
+   INTEGRATOR_DOPRI,
+};
+
+Integrator nonlinearintegrator = INTEGRATOR_RK4;
+AdaptiveSolver adaptivesolver;
+
+static inline
+void loadnonlinearpreset(int idx)
+{
+   const NonlinearPreset *preset = &nonlinearpresets[idx];
+   nonlinearpreset = idx;
+   snprintf(nonlinearfx, sizeof(nonlinearfx), "%s", preset->fx);
+   snprintf(nonlinearfy, sizeof(nonlinearfy), "%s", preset->fy);
+   memcpy(nonlinearenv.params, preset->params, sizeof(nonlinearenv.params));
+   nonlinearcompiled = compileprogram(&nonlinearprogram, nonlinearfx, nonlinearfy);
+   invalidateadaptive(&adaptivesolver);
+}
+
+// derived values, recomputed only when their inputs change; see derived_cache.cpp
+struct ViewState
+{
+   int pixelsperunit;
+   int screenwidth;
+   int screenheight;
+   int panx;
+   int pany;
+};
+
+CacheNode cache_A;           // AData, set from the sliders
+CacheNode cache_stepA;       // the matrix passed to step()
+CacheNode cache_dt;
+CacheNode cache_view;
+CacheNode cache_eigen;       // decomposition of A
+CacheNode cache_propagator;  // exp(dt * stepA)
+CacheNode cache_eigenlines;  // eigenvector lines in pixels
+CacheNode cache_fastforward;
+CacheNode cache_powers;         // propagatorpowers
+CacheNode cache_rowpropagator;  // exp(dt * stepA)^fastforward
+CacheNode cache_foreignsteps;
+CacheNode cache_analyticbase;   // particle base states, retaken when stepA changes or
+                                // the particles moved under other dynamics
+CacheNode cache_quiverspacing;
+CacheNode cache_quiver;         // direction field arrows in pixels
+CacheNode cache_regimeview;
+CacheNode cache_regimemap;      // regimetexture
+CacheNode cache_persistence;    // persistbuffer, drawn for one view
+CacheNode cache_density;        // densitymap, binned for one view
+
+Eigen cached_eigen;
+Mat2x2F64 cached_propagator;
+Mat2x2F64 cached_rowpropagator;
+EigenLines cached_eigenlines;
+Quiver cached_quiver;
+
+static inline
+f64 spawn_period()
+{
+   return trajectory_lifetime_s / particles.count;
+}
 
 #ifdef JULIA_BACKEND
 void step(jl_array_t *A)
 {
    ZoneScoped;
+   // the julia side works on an interleaved 2xN matrix
+   f64 *x = currentx(&particles);
+   f64 *y = currenty(&particles);
+   for (int i = 0; i < particles.count; i++)
+   {
+      currentstates[2*i + 0] = x[i];
+      currentstates[2*i + 1] = y[i];
+   }
+
    jl_value_t *matrix_2xN_newstates = call(solve_autonomous, x_jlarr, A, jl_box_float64(dt));
    JL_GC_PUSH1(&matrix_2xN_newstates);
    f64 *newstates = (f64 *)jl_array_data((jl_array_t *) matrix_2xN_newstates);
 
-   for (int i = 0; i < numtrajectories; i++)
+   advancehistory(&particles);
+   particles.time += dt;
+   x = currentx(&particles);
+   y = currenty(&particles);
+   for (int i = 0; i < particles.count; i++)
    {
-      updateposition(&trajectories[i], *(Vec2F64 *)&newstates[2*i]);
+      x[i] = newstates[2*i + 0];
+      y[i] = newstates[2*i + 1];
    }
-   memcpy(currentstates, newstates, numtrajectories * 2 * sizeof(f64));
    JL_GC_POP();
 }
 
-void step(Mat2x2F64 myA)
+// the julia backend always steps one fixed step per row
+void step(Mat2x2F64 myA, TimeMode mode = TIME_STEP, int ff = 1)
 {
    for (int i = 0; i < 4; i++)
    {
@@ -72,182 +259,853 @@ void step(Mat2x2F64 myA)
 
 #else
 
-void step(Mat2x2F64 A)
+// base states are only valid for the A they were taken under, and only while
+// nothing else has moved the particles since
+void syncanalyticbase(Mat2x2F64 A)
 {
-   Mat2x2F64 dynamicsUpdateMatrix = expm(dt * A);
-   for (int i = 0; i < numtrajectories; i += 1)
+   watchinput(&cache_stepA, &A);
+   watchinput(&cache_foreignsteps, &foreignsteps);
+   if (needsupdate(&cache_analyticbase))
    {
-      Vec2F64 newstate = matvecmul(dynamicsUpdateMatrix, currentstates[i]);
+      rebaseparticles(&particles);
+      timelinebegin = particles.time;
+   }
+}
 
-      updateposition(&trajectories[i], newstate);
-      currentstates[i] = newstate;
+// one history row, ff fixed steps after the previous one
+void step(Mat2x2F64 A, TimeMode mode = TIME_STEP, int ff = 1)
+{
+   ZoneScoped;
+   watchinput(&cache_stepA, &A);
+   watchinput(&cache_dt, &dt);
+   watchinput(&cache_fastforward, &ff);
+   f64 rowdt = ff * dt;
+   if (mode == TIME_ANALYTIC)
+   {
+      syncanalyticbase(A);
+      evaluateparticles(&particles, A, particles.time + rowdt, &threadpool);
    }
+   else
+   {
+      if (needsupdate(&cache_propagator))
+         cached_propagator = expm_closedform(dt * A);
+      if (needsupdate(&cache_powers))
+         initmatpowers(&propagatorpowers, cached_propagator);
+      if (needsupdate(&cache_rowpropagator))
+         cached_rowpropagator = matpower(&propagatorpowers, (u32) ff);
+      propagateparticles(&particles, cached_rowpropagator, &threadpool);
+      particles.time += rowdt;
+   }
+   timelineend = max(timelineend, particles.time);
 }
 #endif
 
-Vec2F64 getRecentPos(Trajectory t, int ago)
+static inline
+void viewbox(Vec2F64 *lo, Vec2F64 *hi)
 {
-   assert(ago < t.size);
-   int idx = t.curidx - 1 - ago;
-   if (idx < 0)
-      idx += histcapacity;
-   return t.recentpositions[idx];
+   viewbounds(&viewtransform, screenwidth, screenheight, lo, hi);
 }
 
-Vec2F64 getMostRecentPos(Trajectory t)
+static inline
+Vec2F64 randomcoord()
 {
-   assert(t.size > 0);
-   return getRecentPos(t, 0);
+   Vec2F64 lo, hi;
+   viewbox(&lo, &hi);
+   return nextsample(&spawnsampler, lo, hi);
 }
 
-Vec2F64 getLeastRecentPos(Trajectory t)
+#define boxlim 20.0
+
+static inline
+void resetstates(Particles *p, int begin = 0)
 {
-   assert(t.size > 0);
-   return getRecentPos(t, t.size - 1);
+   spawnsampled(p, begin, {-boxlim, -boxlim}, {boxlim, boxlim}, &spawnsampler, &threadpool);
 }
 
 static inline
-Vec2F64 randomcoord()
+bool culled(int i)
 {
-   f64 xmax = 0.5 * screenwidth / pixelsperunit;
-   f64 ymax = 0.5 * screenheight / pixelsperunit;
-   return {randfloat64(-xmax, xmax), randfloat64(-ymax, ymax)};
+   return recycler.trailfate[i] == FATE_OFFSCREEN;
 }
 
-#define boxlim 20.0
+// the particle to respawn next: a dead one if there is any left, otherwise
+// the next one round robin
+static inline
+int nextspawnindex()
+{
+   while (recycler.nextdead < recycler.numdead)
+   {
+      int i = recycler.dead[recycler.nextdead++];
+      if (recycler.fate[i] != FATE_LIVE)
+      {
+         recycler.recycled += 1;
+         return i;
+      }
+   }
+   int i = newtrajidx;
+   newtrajidx = (newtrajidx + 1) % particles.count;
+   return i;
+}
 
 static inline
-void resetstates(f64 *arr_2xN)
+void respawn(int i, Vec2F64 pos)
+{
+   spawnparticle(&particles, i, pos);
+   recycler.fate[i] = FATE_LIVE;
+}
+
+// once per frame, after stepping
+void findrecyclable()
 {
-   for (int i = 0; i < numtrajectories; i += 1)
+   ZoneScoped;
+   Vec2F64 lo, hi;
+   viewbox(&lo, &hi);
+   classifyparticles(&particles, lo, hi, (f64) recycle_minspeed * dt, recycler.fate, recycler.counts, &threadpool);
+   recycler.numdead = 0;
+   recycler.nextdead = 0;
+   for (int i = 0; i < particles.count; i += 1)
    {
-      arr_2xN[2*i + 0] = randfloat64(-boxlim, boxlim);
-      arr_2xN[2*i + 1] = randfloat64(-boxlim, boxlim);
+      recycler.dead[recycler.numdead] = i;
+      recycler.numdead += recycler.fate[i] != FATE_LIVE;
    }
+   if (recycle_immediately && !paused)
+   {
+      for (int k = 0; k < recycler.numdead; k += 1)
+         respawn(recycler.dead[k], randomcoord());
+      recycler.recycled += (u64) recycler.numdead;
+      recycler.nextdead = recycler.numdead;
+   }
+   classifytrails(&particles, lo, hi, recycler.trailfate, &threadpool);
+}
+
+void recyclecontrols()
+{
+   ImGui::Checkbox("recycle dead particles at once", &recycle_immediately);
+   ImGui::SliderFloat("stalled below speed", &recycle_minspeed, 0, 1, "%.3f");
+   ImGui::Text("live %d, culled %d, stalled %d, recycled %llu",
+         recycler.counts[FATE_LIVE], recycler.counts[FATE_OFFSCREEN], recycler.counts[FATE_STALLED],
+         (unsigned long long) recycler.recycled);
+}
+
+// The per-particle buffers besides the particles and the solver, allocated
+// for the new sizes before the old ones go, so a failed resize changes nothing.
+struct TrajectoryBuffers
+{
+   Vector2 *trailpixels;
+   Vector2 *lastpixel;
+   u32 *lastbirth;
+   u8 *fate;
+   u8 *trailfate;
+   int *dead;
+};
+
+static
+void freebuffers(TrajectoryBuffers *b)
+{
+   free(b->trailpixels);
+   free(b->lastpixel);
+   free(b->lastbirth);
+   free(b->fate);
+   free(b->trailfate);
+   free(b->dead);
+   memset(b, 0, sizeof(*b));
+}
+
+static
+bool allocbuffers(TrajectoryBuffers *b, int count, int histcapacity)
+{
+   b->trailpixels = (Vector2 *) malloc((size_t) count * (size_t) histcapacity * sizeof(Vector2));
+   b->lastpixel = (Vector2 *) malloc((size_t) count * sizeof(Vector2));
+   b->lastbirth = (u32 *) malloc((size_t) count * sizeof(u32));
+   b->fate = (u8 *) calloc((size_t) count, sizeof(u8));
+   b->trailfate = (u8 *) calloc((size_t) count, sizeof(u8));
+   b->dead = (int *) malloc((size_t) count * sizeof(int));
+   if (!b->trailpixels || !b->lastpixel || !b->lastbirth || !b->fate || !b->trailfate || !b->dead)
+   {
+      freebuffers(b);
+      return false;
+   }
+   return true;
+}
+
+static
+void installbuffers(TrajectoryBuffers *b)
+{
+   TrajectoryBuffers old = {trailpixels, lastpixel, lastbirth, recycler.fate, recycler.trailfate, recycler.dead};
+   freebuffers(&old);
+   trailpixels = b->trailpixels;
+   lastpixel = b->lastpixel;
+   lastbirth = b->lastbirth;
+   recycler.fate = b->fate;
+   recycler.trailfate = b->trailfate;
+   recycler.dead = b->dead;
+   recycler.numdead = 0;
+   recycler.nextdead = 0;
+   // 72 bytes a segment, so it is only reserved by the trail mode that draws
+   freetrailmesh(&trailmesh);
+   persist_restart = true;
 }
 
-#ifdef JULIA_BACKEND
 static inline
-void addstate(f64 *currentstates, int idx, Vec2F64 newtrajectorycoords)
+size_t buffersmemory(int count, int histcapacity)
 {
-   assert(inarraybounds(&currentstates[2*idx + 0], currentstates, &currentstates[2*numtrajectories]));
-   assert(inarraybounds(&currentstates[2*idx + 1], currentstates, &currentstates[2*numtrajectories]));
-   currentstates[2*idx + 0] = newtrajectorycoords.elems[0];
-   currentstates[2*idx + 1] = newtrajectorycoords.elems[1];
+   return (size_t) count * ((size_t) histcapacity * sizeof(Vector2) + sizeof(Vector2) + sizeof(u32) + 2 * sizeof(u8) + sizeof(int));
 }
-#else
+
+// what count particles with histcapacity rows take at most, in the trail
+// mode with the largest mesh
 static inline
-void addstate(Vec2F64 *currentstates, int idx, Vec2F64 newtrajectorycoords)
+size_t trajectorymemory(int count, int histcapacity)
 {
-   currentstates[idx] = newtrajectorycoords;
+   return particlesmemory(count, histcapacity) + adaptivememory(count) + buffersmemory(count, histcapacity)
+      + trailmeshmemory(count, histcapacity - 1);
 }
-#endif
 
-void gameloop_trajectories()
+// the most particles with histcapacity rows that fit the memory budget
+static inline
+int maxtrajectories(int histcapacity)
 {
-   ImGuiIO& io = ImGui::GetIO();
-   if (IsMouseButtonDown(MOUSE_BUTTON_LEFT) && !io.WantCaptureMouse)
-   {
-      Vec2F64 newcoords = pixels2coords(GetMousePosition());
-      initTrajectory(&trajectories[newtrajidx]);
-      addstate(currentstates, newtrajidx, newcoords);
-      newtrajidx = (newtrajidx + 1) % numtrajectories;
+   size_t perparticle = trajectorymemory(1 << 10, histcapacity) >> 10;
+   return (int) min((size_t) max_numtrajectories, trajectory_memory_budget / perparticle);
+}
 
-      time_since_last_spawn = 0;
+void initderivedcache()
+{
+   initcacheinput(&cache_A, "A", 4 * sizeof(f64));
+   initcacheinput(&cache_stepA, "step A", sizeof(Mat2x2F64));
+   initcacheinput(&cache_dt, "dt", sizeof(f64));
+   initcacheinput(&cache_view, "view", sizeof(ViewState));
+   initderived(&cache_eigen, "eigen", &cache_A);
+   initderived(&cache_propagator, "propagator", &cache_stepA, &cache_dt);
+   initderived(&cache_eigenlines, "eigenvector lines", &cache_eigen, &cache_view);
+   initcacheinput(&cache_fastforward, "fast-forward", sizeof(int));
+   initderived(&cache_powers, "propagator powers", &cache_propagator);
+   initderived(&cache_rowpropagator, "row propagator", &cache_powers, &cache_fastforward);
+   initcacheinput(&cache_foreignsteps, "foreign steps", sizeof(u64));
+   initderived(&cache_analyticbase, "analytic base", &cache_stepA, &cache_foreignsteps);
+   initcacheinput(&cache_quiverspacing, "quiver spacing", sizeof(int));
+   initderived(&cache_quiver, "quiver", &cache_A, &cache_view, &cache_quiverspacing);
+   initcacheinput(&cache_regimeview, "stability map view", sizeof(RegimeMapView));
+   initderived(&cache_regimemap, "stability map", &cache_regimeview);
+   initderived(&cache_persistence, "persistent trails", &cache_view);
+   initderived(&cache_density, "density map", &cache_view);
+}
+
+// called at the start of a frame, after the previous frame's ui changes
+void watchframeinputs()
+{
+   watchinput(&cache_A, AData);
+   ViewState view = {pixelsperunit, screenwidth, screenheight, panx, pany};
+   watchinput(&cache_view, &view);
+   watchinput(&cache_quiverspacing, &quiver_spacing);
+}
+
+Eigen *geteigen()
+{
+   if (needsupdate(&cache_eigen))
+      cached_eigen = decomposition(A);
+   return &cached_eigen;
+}
+
+Quiver *getquiver()
+{
+   if (needsupdate(&cache_quiver))
+      buildquiver(&cached_quiver, A, &viewtransform, screenwidth, screenheight, quiver_spacing, DARKBLUE);
+   return &cached_quiver;
+}
+
+// The map only depends on its own view (and in the slice on A21 and A22), so
+// dragging A around only moves the marker.
+void regimemapwindow()
+{
+   Mat2x2F64 current;
+   memcpy(current.elems, AData, sizeof(current.elems));
+   bool slice = regimeview.mode == REGIMEMAP_SLICE;
+   regimeview.a21 = slice ? current(1, 0) : 0;
+   regimeview.a22 = slice ? current(1, 1) : 0;
+   watchinput(&cache_regimeview, &regimeview);
+   if (regimepixels == NULL)
+   {
+      regimepixels = (Color *) calloc(regimemap_size * regimemap_size, sizeof(Color));
+      AN(regimepixels);
+      Image img = {regimepixels, regimemap_size, regimemap_size, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+      regimetexture = LoadTextureFromImage(img);
    }
-   else if (!paused && spawn_new_trajectories)
+   if (needsupdate(&cache_regimemap))
    {
-      time_since_last_spawn += dt;
+      computeregimemap(&regimeview, regimepixels, regimemap_size, &threadpool);
+      UpdateTexture(regimetexture, regimepixels);
+   }
 
-      while (time_since_last_spawn > spawn_period)
+   // the wheel zooms the map instead of scrolling the window
+   ImGui::Begin("Stability map", NULL, ImGuiWindowFlags_NoScrollWithMouse);
+   ImGui::RadioButton("trace-determinant", &regimeview.mode, REGIMEMAP_TRACEDET);
+   ImGui::SameLine();
+   ImGui::RadioButton("A11-A12 slice", &regimeview.mode, REGIMEMAP_SLICE);
+   rlImGuiImageSize(&regimetexture, regimemap_size, regimemap_size);
+   ImVec2 corner = ImGui::GetItemRectMin();
+   // a button over the image owns the clicks, so a drag that starts on the map
+   // keeps setting A when it leaves it and one that starts elsewhere never does
+   ImGui::SetCursorScreenPos(corner);
+   ImGui::InvisibleButton("regime map", ImVec2(regimemap_size, regimemap_size));
+   bool hovered = ImGui::IsItemHovered();
+   bool active = ImGui::IsItemActive();
+   ImVec2 mouse = ImGui::GetMousePos();
+   Vec2F64 point = regimemapcoords(&regimeview, regimemap_size, (f64) (mouse.x - corner.x), (f64) (mouse.y - corner.y));
+   if (hovered)
+   {
+      // zoom about the point under the mouse
+      f32 wheel = ImGui::GetIO().MouseWheel;
+      if (wheel != 0)
       {
-         Vec2F64 newcoords = randomcoord();
-         initTrajectory(&trajectories[newtrajidx]);
-         addstate(currentstates, newtrajidx, newcoords);
-         newtrajidx = (newtrajidx + 1) % numtrajectories;
+         f64 factor = pow(1.1, (f64) -wheel);
+         regimeview.cx = point.elems[0] - factor * (point.elems[0] - regimeview.cx);
+         regimeview.cy = point.elems[1] - factor * (point.elems[1] - regimeview.cy);
+         regimeview.halfwidth = clampdouble(factor * regimeview.halfwidth, 1e-3, 1e3);
+      }
+   }
+   if (active)
+   {
+      current = regimemapmatrix(&regimeview, current, point);
+      memcpy(AData, current.elems, sizeof(current.elems));
+   }
+   if (hovered || active)
+      ImGui::Text(slice ? "A11 = %.3f, A12 = %.3f" : "tr = %.3f, det = %.3f", point.elems[0], point.elems[1]);
+   else
+      ImGui::Text("click to set A, scroll to zoom");
 
-         time_since_last_spawn -= spawn_period;
+   Vec2F64 marker = regimemappixel(&regimeview, regimemap_size, regimemapposition(&regimeview, current));
+   if (marker.elems[0] >= 0 && marker.elems[0] <= regimemap_size && marker.elems[1] >= 0 && marker.elems[1] <= regimemap_size)
+   {
+      ImVec2 center = {corner.x + (f32) marker.elems[0], corner.y + (f32) marker.elems[1]};
+      ImGui::GetWindowDrawList()->AddCircleFilled(center, 4, IM_COL32(0, 0, 0, 255));
+      ImGui::GetWindowDrawList()->AddCircle(center, 6, IM_COL32(255, 255, 255, 255));
+   }
+   for (int r = 0; r < NUM_REGIMES; r += 1)
+   {
+      Color c = regime_colors[r];
+      ImGui::TextColored(ImVec4(c.r / 255.0f, c.g / 255.0f, c.b / 255.0f, 1), "%s", regime_names[r]);
+      if (r % 3 != 2 && r + 1 < NUM_REGIMES)
+         ImGui::SameLine();
+   }
+   ImGui::End();
+}
+
+EigenLines *geteigenlines()
+{
+   Eigen *eigen = geteigen();
+   if (needsupdate(&cache_eigenlines))
+      buildeigenlines(&cached_eigenlines, eigen, &viewtransform);
+   return &cached_eigenlines;
+}
+
+void drawcachestats()
+{
+   if (!ImGui::CollapsingHeader("derived value cache"))
+      return;
+   for (int i = 0; i < numcachenodes; i += 1)
+   {
+      CacheNode *node = cachenodes[i];
+      ImGui::Text("%-18s hits %8llu  misses %6llu", node->name,
+            (unsigned long long) node->hits, (unsigned long long) node->misses);
+   }
+   if (ImGui::Button("reset counters"))
+      resetcachestats();
+}
+
+// returns false when the memory for the sizes is not there
+bool inittrajectories(int count, int histcapacity, int numthreads)
+{
+   initderivedcache();
+   loadnonlinearpreset(0);
+   initsampler(&spawnsampler, SAMPLE_SOBOL, nextu64(&mainrng));
+   TrajectoryBuffers buffers = {};
+   if (!tryinitparticles(&particles, count, histcapacity))
+      return false;
+   if (!tryinitadaptive(&adaptivesolver, count) || !allocbuffers(&buffers, count, histcapacity))
+   {
+      freeparticles(&particles);
+      freeadaptive(&adaptivesolver);
+      return false;
+   }
+   installbuffers(&buffers);
+   initthreadpool(&threadpool, numthreads);
+   return true;
+}
+
+// Returns false, with the old sizes kept, when the memory for the new ones is
+// not there. The old and new stores are both held while copying.
+bool resizetrajectories(int count, int histcapacity)
+{
+   histcapacity = clampint(histcapacity, min_histcapacity, max_histcapacity);
+   count = clampint(count, 1, maxtrajectories(histcapacity));
+   int oldcount = particles.count;
+   AdaptiveSolver solver;
+   TrajectoryBuffers buffers = {};
+   if (!tryinitadaptive(&solver, count, adaptivesolver.rtol))
+      return false;
+   if (!allocbuffers(&buffers, count, histcapacity) || !resizeparticles(&particles, count, histcapacity))
+   {
+      freeadaptive(&solver);
+      freebuffers(&buffers);
+      return false;
+   }
+   freeadaptive(&adaptivesolver);
+   adaptivesolver = solver;
+   installbuffers(&buffers);
+   resetstates(&particles, min(oldcount, count));
+   newtrajidx = newtrajidx % count;
+
+#ifdef JULIA_BACKEND
+   jl_value_t *jlMatF64type = jl_apply_array_type((jl_value_t *) jl_float64_type, 2);
+   x_jlarr = jl_alloc_array_2d(jlMatF64type, 2, count);
+   currentstates = (f64 *) jl_array_data(x_jlarr);
+#endif
+   return true;
+}
+
+// trail pixels and their quads for drawtrails()
+void updatetrailpixels(f64 alpha, TrailStyle style)
+{
+   ZoneScoped;
+   buildtrails(&trailmesh, &particles, &viewtransform, alpha, trailpixels, recycler.trailfate, style, &threadpool);
+}
+
+struct PersistJob
+{
+   Particles *p;
+   f64 alpha;
+   bool restart;
+   TrailStyle style;
+};
+
+// the newest segment of every particle into its chunk of trailmesh
+static
+void persistchunk(void *ctx, int begin, int end)
+{
+   PersistJob *job = (PersistJob *) ctx;
+   Particles *p = job->p;
+   f64 alpha = job->alpha;
+   const f64 *x = histrow(p, p->histx, 0);
+   const f64 *y = histrow(p, p->histy, 0);
+   const f64 *olderx = histrow(p, p->histx, 1);
+   const f64 *oldery = histrow(p, p->histy, 1);
+   size_t first = (size_t) begin * (size_t) trailmesh.maxsegments * trail_verts_per_segment;
+   Vector2 *verts = &trailmesh.verts[first];
+   Color *colors = &trailmesh.colors[first];
+   int n = 0;
+   for (int i = begin; i < end; i += 1)
+   {
+      Vec2F64 pos = {x[i], y[i]};
+      if (trailsize(p, i) > 1)
+         pos = Vec2F64(olderx[i], oldery[i]) + alpha * (pos - Vec2F64(olderx[i], oldery[i]));
+      Vector2 points[2] = {coords2pixels(pos), lastpixel[i]};
+      if (!job->restart && lastbirth[i] == p->birthstep[i] && !culled(i))
+         n += appendtrail(&verts[n], &colors[n], points, 2, 1, &job->style);
+      lastpixel[i] = points[0];
+      lastbirth[i] = p->birthstep[i];
+   }
+   trailmesh.chunkverts[begin / particle_chunk] = n;
+}
+
+// trails as long as the fading of persistbuffer makes them, for the cost of
+// one segment per particle
+void drawpersistenttrails(f64 alpha, TrailStyle style)
+{
+   ZoneScoped;
+   bool viewchanged = needsupdate(&cache_persistence);
+   bool restart = persist_restart || viewchanged;
+   f32 factor = paused ? 1 : persistencefactor((f32) frame_dt, persist_halflife);
+   beginpersistence(&persistbuffer, screenwidth, screenheight, factor);
+   if (restart)
+      ClearBackground(BLANK);
+   // one segment per particle
+   fittrailmesh(&trailmesh, particles.count, 2);
+   PersistJob job = {&particles, alpha, restart, style};
+   parallelfor(&threadpool, particles.count, particle_chunk, persistchunk, &job);
+   drawtrailmesh(&trailmesh, &raylibbackend);
+   endpersistence(&persistbuffer);
+   persist_restart = false;
+   drawpersistence(&persistbuffer);
+}
+
+struct CurveJob
+{
+   Particles *p;
+   f64 lag;  // of the drawn states behind the current ones
+   f64 rowdt;
+   TrailStyle style;
+};
+
+static
+void curvechunk(void *ctx, int begin, int end)
+{
+   CurveJob *job = (CurveJob *) ctx;
+   Particles *p = job->p;
+   const f64 *x = currentx(p);
+   const f64 *y = currenty(p);
+   size_t first = (size_t) begin * (size_t) trailmesh.maxsegments * trail_verts_per_segment;
+   Vector2 *verts = &trailmesh.verts[first];
+   Color *colors = &trailmesh.colors[first];
+   int room = (end - begin) * trailmesh.maxsegments * trail_verts_per_segment;
+   Vector2 points[curve_grid + 1];
+   f32 ages[curve_grid + 1];
+   int n = 0;
+   for (int i = begin; i < end; i += 1)
+   {
+      if (culled(i))
+         continue;
+      // not past the spawn or the last change of A
+      f64 seconds = min((trailsize(p, i) - 1) * job->rowdt, p->time - p->basetime[i]) - job->lag;
+      int kend = curvegridend(&curvetrail, seconds);
+      // the chunk has room for the history trails; the few curls that need
+      // more segments than that get only the coarse pieces once it runs low
+      int left = room - n;
+      f32 tolerance = curve_tolerance;
+      if (left < curve_grid * trail_verts_per_segment)
+      {
+         if (left < curve_basepieces * trail_verts_per_segment)
+            break;
+         tolerance = INFINITY;
       }
+      int size = tessellatecurve(&curvetrail, {x[i], y[i]}, kend, tolerance, points, ages);
+      // tapered like a history trail, over its histcapacity - 2 segments
+      n += appendcurve(&verts[n], &colors[n], points, ages, size, p->histcapacity - 2, &job->style);
    }
+   trailmesh.chunkverts[begin / particle_chunk] = n;
+}
 
-   if (!paused)
+// trails along the exact flow of the linear system, as long as the history
+// trails, with vertices where the curve bends
+void drawsmoothtrails(f64 alpha, TrailStyle style)
+{
+   ZoneScoped;
+   syncanalyticbase(A);
+   f64 rowdt = fastforward * dt;
+   f64 lag = (1 - alpha) * rowdt;
+   // the drawn history trails reach histcapacity - 2 rows behind their head
+   f64 span = (particles.histcapacity - 2) * rowdt;
+   initcurvetrail(&curvetrail, A, span, lag, rowdt, &viewtransform);
+   fittrailmesh(&trailmesh, particles.count, particles.histcapacity);
+   CurveJob job = {&particles, lag, rowdt, style};
+   parallelfor(&threadpool, particles.count, particle_chunk, curvechunk, &job);
+   drawtrailmesh(&trailmesh, &raylibbackend);
+   curvesegments = 0;
+   for (int c = 0; c < trailmesh.numchunks; c += 1)
+      curvesegments += trailmesh.chunkverts[c] / trail_verts_per_segment;
+}
+
+void drawdensity()
+{
+   ZoneScoped;
+   int binsize = density_binsize;
+   int width = (screenwidth + binsize - 1) / binsize;
+   int height = (screenheight + binsize - 1) / binsize;
+   bool viewchanged = needsupdate(&cache_density);
+   // the density map is for counts where the trail mesh would not fit
+   freetrailmesh(&trailmesh);
+   bool resized = width != densitymap.width || height != densitymap.height
+      || threadpool.numthreads != densitymap.numslices;
+   if (resized)
    {
-      step(A);
+      initdensitymap(&densitymap, width, height, threadpool.numthreads, MAROON);
+      if (densitytexture.id != 0)
+         UnloadTexture(densitytexture);
+      Image img = {densitymap.pixels, width, height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+      densitytexture = LoadTextureFromImage(img);
    }
+   else if (viewchanged)
+      cleardensitymap(&densitymap);
 
-   drawcoordaxes();
+   // while paused the same states would pile up in the bins
+   if (!paused || viewchanged || resized)
+   {
+      f32 decay = paused ? 1 : persistencefactor((f32) frame_dt, density_halflife);
+      updatedensitymap(&densitymap, currentx(&particles), currenty(&particles), particles.count,
+            (f64) pixelsperunit / binsize, viewtransform.ox / binsize, viewtransform.oy / binsize,
+            decay, &threadpool);
+      UpdateTexture(densitytexture, densitymap.pixels);
+   }
+   Rectangle source = {0, 0, (f32) width, (f32) height};
+   Rectangle dest = {0, 0, (f32) (width * binsize), (f32) (height * binsize)};
+   DrawTexturePro(densitytexture, source, dest, (Vector2){0, 0}, 0, WHITE);
+}
 
-   DrawText(TextFormat("Frame time: %02.02f ms", drawtime_ms), 10, 50, 20, DARKGRAY);
-   DrawText(TextFormat("t = %f", t), 10, 30, 20, DARKGRAY);
+// Random spawns for `elapsed` seconds. Called between fixed steps, so spawn
+// times do not depend on the frame rate.
+void spawnovertime(f64 elapsed)
+{
+   time_since_last_spawn += elapsed;
+   while (time_since_last_spawn > spawn_period())
+   {
+      respawn(nextspawnindex(), randomcoord());
+      time_since_last_spawn -= spawn_period();
+   }
+}
 
-   { ZoneScopedN("draw trajectories");
-   for (int i = 0; i < numtrajectories; i++)
+// takes this frame's fixed steps
+void simulate(Mat2x2F64 A, bool spawn, TimeMode mode = TIME_STEP, int ff = 1)
+{
+   f64 t_stepstart = GetTime();
+   for (int s = 0; s < sim_steps; s += 1)
    {
-      Trajectory trajectory = trajectories[i];
-      Vector2 points[histcapacity];
-      for (int i = 0; i < trajectory.size; i += 1)
+      if (spawn)
+         spawnovertime(dt);
+      step(A, mode, ff);
+   }
+   steptime_ms = (GetTime() - t_stepstart) * 1000;
+}
+
+// particle count and trail length, applied on demand since reallocating
+// millions of particles on every keystroke would stall the ui
+void trajectorysizecontrols()
+{
+   static int newcount = 0;
+   static int newhistcapacity = 0;
+   if (newcount == 0)
+   {
+      newcount = particles.count;
+      newhistcapacity = particles.histcapacity;
+   }
+   static bool resizefailed = false;
+   ImGui::InputInt("particles", &newcount, 100, 10000);
+   ImGui::InputInt("trail length", &newhistcapacity);
+   newhistcapacity = clampint(newhistcapacity, min_histcapacity, max_histcapacity);
+   int maxcount = maxtrajectories(newhistcapacity);
+   newcount = clampint(newcount, 1, maxcount);
+   if (ImGui::Button("apply sizes"))
+      resizefailed = !resizetrajectories(newcount, newhistcapacity);
+   ImGui::SameLine();
+   ImGui::Text("up to %.1f MB (at most %d particles)",
+         (f64) trajectorymemory(newcount, newhistcapacity) / (1024 * 1024), maxcount);
+   if (resizefailed)
+      ImGui::TextColored(ImVec4(1, 0.2f, 0.2f, 1), "not enough memory for these sizes, kept the old ones");
+   int samplemode = spawnsampler.mode;
+   if (ImGui::Combo("spawn points", &samplemode, samplemode_names, arrlen(samplemode_names)))
+      initsampler(&spawnsampler, (SampleMode) samplemode, nextu64(&mainrng));
+   ImGui::SameLine();
+   size_t bytes = particlesmemory(&particles) + (size_t) particles.count * (size_t) particles.histcapacity * sizeof(Vector2)
+      + trailmeshmemory(&trailmesh) + (size_t) particles.count * (sizeof(*lastpixel) + sizeof(*lastbirth));
+   ImGui::Text("memory: %.1f MB", (f64) bytes / (1024 * 1024));
+   ImGui::Checkbox("density map", &show_density);
+   if (show_density)
+   {
+      ImGui::SliderFloat("density half-life (s)", &density_halflife, 0.01f, 5, "%.2f", ImGuiSliderFlags_Logarithmic);
+      ImGui::SliderInt("bin size (px)", &density_binsize, 1, 8);
+   }
+   else
+   {
+      if (ImGui::Checkbox("persistent trails", &persistent_trails))
+         persist_restart = true;
+      // longer half-lives are more than the 8 bit fading can show
+      if (persistent_trails)
+         ImGui::SliderFloat("trail half-life (s)", &persist_halflife, 0.02f, 1, "%.2f", ImGuiSliderFlags_Logarithmic);
+      else if (dynamics == DYNAMICS_LINEAR)
       {
-         points[i] = coords2pixels(getRecentPos(trajectory, i));
+         ImGui::Checkbox("smooth trails from the exact flow", &smooth_trails);
+         if (smooth_trails)
+         {
+            ImGui::SliderFloat("curve tolerance (px)", &curve_tolerance, 0.05f, 4, "%.2f", ImGuiSliderFlags_Logarithmic);
+            ImGui::Text("%d segments, %.1f per particle", curvesegments, (f64) curvesegments / particles.count);
+         }
       }
-      for (int i = 0; i < trajectory.size - 1; i += 1)
+   }
+
+   int numthreads = threadpool.numthreads;
+   if (ImGui::SliderInt("threads", &numthreads, 1, hardwarethreads()))
+   {
+      freethreadpool(&threadpool);
+      initthreadpool(&threadpool, numthreads);
+   }
+}
+
+// takes this frame's fixed steps of the typed-in system
+void simulatenonlinear(bool spawn)
+{
+   if (!nonlinearcompiled)
+      return;
+   f64 t_stepstart = GetTime();
+   for (int s = 0; s < sim_steps; s += 1)
+   {
+      if (spawn)
+         spawnovertime(dt);
+      if (nonlinearintegrator == INTEGRATOR_DOPRI)
       {
-         DrawLineEx(points[i], points[i + 1], 3-0.1f*i, MAROON);
+         ProgramRhs rhs = {&nonlinearprogram, nonlinearenv};
+         stepadaptive(&adaptivesolver, &particles, programrhs, &rhs, dt, &threadpool);
       }
+      else
+         stepnonlinear(&particles, &nonlinearprogram, nonlinearenv, dt, &threadpool);
+      foreignsteps += 1;
    }
+   timelineend = max(timelineend, particles.time);
+   steptime_ms = (GetTime() - t_stepstart) * 1000;
+}
+
+// integrator choice, and tolerance and step counts for the adaptive one
+void adaptivecontrols(Integrator *integrator, AdaptiveSolver *s)
+{
+   int kind = *integrator;
+   ImGui::RadioButton("fixed step", &kind, INTEGRATOR_RK4);
+   ImGui::SameLine();
+   ImGui::RadioButton("adaptive (Dormand-Prince)", &kind, INTEGRATOR_DOPRI);
+   *integrator = (Integrator) kind;
+   if (*integrator != INTEGRATOR_DOPRI)
+      return;
+
+   f32 rtol = (f32) s->rtol;
+   if (ImGui::SliderFloat("rel. tolerance", &rtol, 1e-10f, 1e-2f, "%.1e", ImGuiSliderFlags_Logarithmic))
+   {
+      s->rtol = (f64) rtol;
+      s->atol = 1e-3 * s->rtol;
    }
+   ImGui::Text("accepted %llu, rejected %llu, stalled %llu",
+         (unsigned long long) s->stats.steps, (unsigned long long) s->stats.rejected, (unsigned long long) s->stats.stalled);
+   if (ImGui::Button("reset step counts"))
+      memset(&s->stats, 0, sizeof(s->stats));
+}
 
-   Eigen eigen = decomposition(A);
-   bool eigvals_are_real = eigen.values[0].im == 0 && eigen.values[1].im == 0;
+void dynamicscontrols()
+{
+   int kind = dynamics;
+   ImGui::RadioButton("x' = Ax", &kind, DYNAMICS_LINEAR);
+   ImGui::SameLine();
+   ImGui::RadioButton("x' = f(x)", &kind, DYNAMICS_NONLINEAR);
+   dynamics = (Dynamics) kind;
+   if (dynamics != DYNAMICS_NONLINEAR)
+      return;
 
-   Vec2F64 v1rl = {eigen.vectors[0][0].rl, eigen.vectors[0][1].rl};
-   Vec2F64 v2rl = {eigen.vectors[1][0].rl, eigen.vectors[1][1].rl};
+   const char *names[arrlen(nonlinearpresets)];
+   for (int i = 0; i < arrlen(nonlinearpresets); i += 1)
+      names[i] = nonlinearpresets[i].name;
+   int preset = nonlinearpreset;
+   if (ImGui::Combo("preset", &preset, names, arrlen(names)))
+      loadnonlinearpreset(preset);
 
-   if (show_eigenvectors)
+   bool edited = ImGui::InputText("dx/dt", nonlinearfx, sizeof(nonlinearfx));
+   edited = ImGui::InputText("dy/dt", nonlinearfy, sizeof(nonlinearfy)) || edited;
+   if (edited)
    {
-      f32 thickness = 3;
-      f64 lenscale = 1000;
+      nonlinearcompiled = compileprogram(&nonlinearprogram, nonlinearfx, nonlinearfy);
+      invalidateadaptive(&adaptivesolver);
+   }
+   if (nonlinearcompiled)
+      ImGui::Text("%d instructions, %d constants", nonlinearprogram.numcode, nonlinearprogram.numconsts);
+   else
+      ImGui::Text("%s", nonlinearprogram.error);
 
-      if (eigvals_are_real)
+   for (int k = 0; k < num_vm_params; k += 1)
+   {
+      f32 value = (f32) nonlinearenv.params[k];
+      if (ImGui::SliderFloat(vmvar_names[VM_A + k], &value, -5, 5))
       {
-         Color v1color = eigen.values[0].rl > 0 ? GREEN : BLUE;
-         Color v2color = eigen.values[1].rl > 0 ? GREEN : BLUE;
+         nonlinearenv.params[k] = (f64) value;
+         invalidateadaptive(&adaptivesolver);
+      }
+   }
 
-         DrawLineEx(
-            coords2pixels(lenscale * v1rl),
-            coords2pixels(-lenscale * v1rl),
-            thickness,
-            v1color);
-         DrawLineEx(
-            coords2pixels(lenscale * v2rl),
-            coords2pixels(-lenscale * v2rl),
-            thickness,
-            v2color);
+   adaptivecontrols(&nonlinearintegrator, &adaptivesolver);
+}
+
+// stepping or analytic evaluation, fast-forward, and in the analytic mode a
+// scrubber that jumps straight to any time since A last changed
+void timecontrols()
+{
+#ifndef JULIA_BACKEND
+   int mode = timemode;
+   ImGui::RadioButton("step", &mode, TIME_STEP);
+   ImGui::SameLine();
+   ImGui::RadioButton("analytic", &mode, TIME_ANALYTIC);
+   timemode = (TimeMode) mode;
+   ImGui::SliderInt("fast-forward", &fastforward, 1, max_fastforward, "%dx", ImGuiSliderFlags_Logarithmic);
+   fastforward = clampint(fastforward, 1, max_fastforward);
+
+   if (timemode == TIME_ANALYTIC)
+   {
+      f32 seek = (f32) particles.time;
+      f32 latest = (f32) (timelineend + trajectory_lifetime_s);
+      if (ImGui::SliderFloat("time", &seek, (f32) timelinebegin, latest, "%.2f s"))
+      {
+         paused = true;
+         syncanalyticbase(A);
+         seekparticles(&particles, A, max((f64) seek, timelinebegin), fastforward * dt, &threadpool);
+         timelineend = max(timelineend, particles.time);
       }
+   }
+#endif
+}
+
+// expects updatetrailpixels() to have run this frame
+void drawtrails()
+{
+   ZoneScoped;
+   drawtrailmesh(&trailmesh, &raylibbackend);
+}
+
+void gameloop_trajectories()
+{
+   watchframeinputs();
+
+   ImGuiIO& io = ImGui::GetIO();
+   bool mousespawning = IsMouseButtonDown(MOUSE_BUTTON_LEFT) && !io.WantCaptureMouse;
+   if (mousespawning)
+   {
+      Vec2F64 newcoords = pixels2coords(GetMousePosition());
+      spawnparticle(&particles, newtrajidx, newcoords);
+      newtrajidx = (newtrajidx + 1) % particles.count;
+
+      time_since_last_spawn = 0;
+   }
+
+   if (!paused)
+   {
+      bool spawn = spawn_new_trajectories && !mousespawning;
+      if (dynamics == DYNAMICS_NONLINEAR)
+         simulatenonlinear(spawn);
       else
-      {
-         Color v1color = eigen.values[0].rl > 0 ? LIME : SKYBLUE;
+         simulate(A, spawn, timemode, fastforward);
+   }
 
-         DrawLineEx(
-            coords2pixels(lenscale * v1rl),
-            coords2pixels(-lenscale * v1rl),
-            thickness,
-            v1color);
-         Vec2F64 v1im = {eigen.vectors[0][0].im, eigen.vectors[0][1].im};
-         DrawLineEx(
-            coords2pixels(lenscale * v1im),
-            coords2pixels(-lenscale * v1im),
-            thickness,
-            v1color);
-      }
+   drawcoordaxes();
+   if (show_quiver && dynamics == DYNAMICS_LINEAR)
+      drawquiver(getquiver(), &raylibbackend);
+   if (dynamics == DYNAMICS_LINEAR)
+      regimemapwindow();
+
+   DrawText(TextFormat("Frame time: %02.02f ms", drawtime_ms), 10, 50, 20, DARKGRAY);
+   DrawText(TextFormat("t = %f", t), 10, 30, 20, DARKGRAY);
+
+   findrecyclable();
+   { ZoneScopedN("draw trajectories");
+   if (show_density)
+      drawdensity();
+   else if (persistent_trails)
+      drawpersistenttrails(paused ? 1 : sim_alpha, {3, 0, 0, MAROON});
+   else if (smooth_trails && dynamics == DYNAMICS_LINEAR)
+      drawsmoothtrails(paused ? 1 : sim_alpha, default_trailstyle);
+   else
+   {
+      updatetrailpixels(paused ? 1 : sim_alpha, default_trailstyle);
+      drawtrails();
+   }
    }
 
-   if (eigvals_are_real && show_trajeigencomponents)
+   Eigen eigen = *geteigen();
+   bool eigvals_are_real = eigen.values[0].im == 0 && eigen.values[1].im == 0;
+
+   Vec2F64 v1rl = {eigen.vectors[0][0].rl, eigen.vectors[0][1].rl};
+   Vec2F64 v2rl = {eigen.vectors[1][0].rl, eigen.vectors[1][1].rl};
+
+   if (show_eigenvectors && dynamics == DYNAMICS_LINEAR)
+      draweigenlines(geteigenlines(), &raylibbackend);
+
+   if (eigvals_are_real && show_trajeigencomponents && dynamics == DYNAMICS_LINEAR)
    {
       constexpr int subset = 1;
       for (int i = 0; i < subset; i++)
       {
          Mat2x2F64 V = { v1rl.elems[0], v1rl.elems[1], v2rl.elems[0], v2rl.elems[1] };
-         Vec2F64 x = currentstates[i];
+         Vec2F64 x = getMostRecentPos(&particles, i);
          LinsolveResult result = linsolve(V, x);
          if (result.error_occurred)
          {
@@ -282,9 +1140,7 @@ void gameloop_trajectories()
    {
       t = 0;
 
-      resetstates((f64 *)currentstates);
-      for (int i = 0; i < numtrajectories; i++)
-         initTrajectory(&trajectories[i]);
+      resetstates(&particles);
    }
 
    if (paused)
@@ -296,7 +1152,7 @@ void gameloop_trajectories()
    }
    else
    {
-      t += dt;
+      t += sim_steps * (dynamics == DYNAMICS_LINEAR ? fastforward : 1) * dt;
 
       pausewasclicked = ImGui::Button("pause");
       if (pausewasclicked || (IsKeyPressed(KEY_SPACE) && !io.WantCaptureKeyboard))
@@ -304,7 +1160,17 @@ void gameloop_trajectories()
    }
    ImGui::Checkbox("spawn new trajectories", &spawn_new_trajectories);
    ImGui::Checkbox("show eigenvectors", &show_eigenvectors);
+   ImGui::Checkbox("show direction field", &show_quiver);
+   if (show_quiver)
+      ImGui::SliderInt("arrow spacing (px)", &quiver_spacing, 8, 100);
    ImGui::Checkbox("show trajectory eigen components", &show_trajeigencomponents);
+   ImGui::Text("step: %.3f ms (%s kernel)", steptime_ms, simdlevel_names[particles.simd]);
+   trajectorysizecontrols();
+   recyclecontrols();
+   dynamicscontrols();
+   if (dynamics == DYNAMICS_LINEAR)
+      timecontrols();
+   drawcachestats();
 
    f32 maxval = 5;
    static f32 newAData[4] = {0, 0, 0, 0}; // row-major order because of ImGui
@@ -327,5 +1193,6 @@ void gameloop_trajectories()
    ImGui::End();
    }
 
-   DrawTexture(equation_texture, 250, 30, WHITE);
+   BackendImage equation = textureimage(equation_texture);
+   raylibbackend.image(raylibbackend.ctx, &equation, 250, 30);
 }
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+#include "useful_utils.cpp"
+#include "linearalgebra.cpp"
+
+// Trajectory files written by the headless simulator. The binary file is a
+// fixed 128 byte header followed by one frame per saved step:
+//    f64 time, f64 x[count], f64 y[count]
+// all little endian. Matrices are stored column-major like Mat.
+//
+// The same frames can also go to a CSV file (one line per particle and frame)
+// and to a NumPy .npy file of shape (numframes, 2, count), where [f, 0] holds
+// the x coordinates of frame f and [f, 1] the y coordinates.
+
+#define trajectory_magic "xdotAx\r\n"
+#define trajectory_version 1
+#define npy_headersize 128
+
+struct TrajectoryHeader
+{
+   char magic[8];
+   u32 version;
+   u32 headersize;
+   u32 count;
+   u32 numframes;
+   f64 dt;             // integration step
+   f64 frameinterval;  // time between saved frames
+   f64 A[4];
+   f64 B[4];
+   f64 u[2];
+   u64 seed;
+};
+
+static_assert(sizeof(TrajectoryHeader) == 128, "trajectory header layout changed");
+
+struct TrajectoryWriter
+{
+   FILE *bin;
+   FILE *csv;
+   FILE *npy;
+   TrajectoryHeader header;
+   u32 framesdone;
+};
+
+static inline
+TrajectoryHeader maketrajectoryheader(int count, u32 numframes, f64 dt, f64 frameinterval,
+      Mat2x2F64 A, Mat2x2F64 B, Vec2F64 u, u64 seed)
+{
+   TrajectoryHeader h;
+   memset(&h, 0, sizeof(h));
+   memcpy(h.magic, trajectory_magic, sizeof(h.magic));
+   h.version = trajectory_version;
+   h.headersize = sizeof(TrajectoryHeader);
+   h.count = (u32) count;
+   h.numframes = numframes;
+   h.dt = dt;
+   h.frameinterval = frameinterval;
+   memcpy(h.A, A.elems, sizeof(h.A));
+   memcpy(h.B, B.elems, sizeof(h.B));
+   memcpy(h.u, u.elems, sizeof(h.u));
+   h.seed = seed;
+   return h;
+}
+
+static inline
+bool checktrajectoryheader(TrajectoryHeader *h)
+{
+   return memcmp(h->magic, trajectory_magic, sizeof(h->magic)) == 0
+      && h->version == trajectory_version
+      && h->headersize == sizeof(TrajectoryHeader);
+}
+
+// version 1.0 header, padded with spaces so the data starts at npy_headersize
+// and the header can be rewritten in place once the frame count is final
+static
+void writenpyheader(FILE *f, u32 numframes, u32 count)
+{
+   char dict[npy_headersize];
+   int len = snprintf(dict, sizeof(dict),
+         "{'descr': '<f8', 'fortran_order': False, 'shape': (%u, 2, %u), }", numframes, count);
+   int dictsize = npy_headersize - 10;
+   assert(len > 0 && len < dictsize);
+   memset(dict + len, ' ', (size_t) (dictsize - len));
+   dict[dictsize - 1] = '\n';
+
+   u8 preamble[10] = {0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0, (u8) (dictsize & 0xff), (u8) (dictsize >> 8)};
+   fwrite(preamble, 1, sizeof(preamble), f);
+   fwrite(dict, 1, (size_t) dictsize, f);
+}
+
+// any of the files may be NULL
+void inittrajectorywriter(TrajectoryWriter *w, FILE *bin, FILE *csv, FILE *npy, TrajectoryHeader header)
+{
+   w->bin = bin;
+   w->csv = csv;
+   w->npy = npy;
+   w->header = header;
+   w->framesdone = 0;
+   if (bin)
+      fwrite(&w->header, sizeof(w->header), 1, bin);
+   if (csv)
+      fputs("time,particle,x,y\n", csv);
+   if (npy)
+      writenpyheader(npy, header.numframes, header.count);
+}
+
+void writeframe(TrajectoryWriter *w, f64 time, const f64 *x, const f64 *y)
+{
+   size_t count = w->header.count;
+   if (w->bin)
+   {
+      fwrite(&time, sizeof(f64), 1, w->bin);
+      fwrite(x, sizeof(f64), count, w->bin);
+      fwrite(y, sizeof(f64), count, w->bin);
+   }
+   if (w->npy)
+   {
+      fwrite(x, sizeof(f64), count, w->npy);
+      fwrite(y, sizeof(f64), count, w->npy);
+   }
+   if (w->csv)
+   {
+      for (size_t i = 0; i < count; i += 1)
+         fprintf(w->csv, "%.17g,%zu,%.17g,%.17g\n", time, i, x[i], y[i]);
+   }
+   w->framesdone += 1;
+}
+
+// patches the frame count in case the run stopped early; returns false if
+// any of the writes failed
+bool finishtrajectorywriter(TrajectoryWriter *w)
+{
+   bool ok = true;
+   w->header.numframes = w->framesdone;
+   if (w->bin)
+   {
+      fseek(w->bin, 0, SEEK_SET);
+      fwrite(&w->header, sizeof(w->header), 1, w->bin);
+      fflush(w->bin);
+      ok = ok && !ferror(w->bin);
+   }
+   if (w->npy)
+   {
+      fseek(w->npy, 0, SEEK_SET);
+      writenpyheader(w->npy, w->framesdone, w->header.count);
+      fflush(w->npy);
+      ok = ok && !ferror(w->npy);
+   }
+   if (w->csv)
+   {
+      fflush(w->csv);
+      ok = ok && !ferror(w->csv);
+   }
+   return ok;
+}
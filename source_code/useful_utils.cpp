@@ -4,6 +4,7 @@
 #include <math.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <time.h>
 
 // taken from https://github.com/varnishcache/varnish-cache/blob/master/include/vas.h
 #define AZ(foo)		do { assert((foo) == 0); } while (0)
@@ -18,6 +19,15 @@
 #define showptr(x) printf(str(x)" = %p\n", x)
 #define showaddr(x) printf("&" str(x)" = %p\n", &x)
 
+// fully unroll the following loop; meant for loops with compile-time trip counts
+#if defined(__clang__)
+   #define UNROLL _Pragma("unroll")
+#elif defined(__GNUC__)
+   #define UNROLL _Pragma("GCC unroll 64")
+#else
+   #define UNROLL
+#endif
+
 #define min(a,b) (((a)<(b))?(a):(b))
 #define max(a,b) (((a)>(b))?(a):(b))
 #define min3(a,b,c) min(a, min(b, c))
@@ -101,9 +111,11 @@ bool isapprox(f64 a, f64 b, f64 tol = 1e-5)
 }
 
 static inline
-f64 randfloat64(f64 minval, f64 maxval)
+f64 gettime_s()
 {
-   return (f64)rand() / (f64)(RAND_MAX) * (maxval - minval) + minval;
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (f64) ts.tv_sec + 1e-9 * (f64) ts.tv_nsec;
 }
 
 static inline
@@ -0,0 +1,215 @@
+#pragma once
+
+#include "useful_utils.cpp"
+#include "linearalgebra.cpp"
+#include "particles.cpp"
+
+// The map from the plane to the screen, pixel = S x + o with S diagonal:
+// pixelsperunit to the right and up, and the origin at pixel o, which panning
+// moves. The trails turn whole history rows into pixels with it, a few
+// particles per vector, instead of calling a function for every point.
+//
+// Points are written as (x, y) pairs of floats, the layout of Vector2, so the
+// output can go straight into the buffer the trail renderer reads.
+
+#define view_block 256  // particles per pass over the rows, so their pixels stay in cache
+
+struct ViewTransform
+{
+   f64 sx, sy;  // pixels per unit; sy < 0, since screen y points down
+   f64 ox, oy;  // pixel of the origin
+};
+
+// the origin lies (panx, pany) pixels off the center of the screen
+static inline
+ViewTransform makeviewtransform(int pixelsperunit, int width, int height, int panx = 0, int pany = 0)
+{
+   ViewTransform vt;
+   vt.sx = pixelsperunit;
+   vt.sy = -pixelsperunit;
+   vt.ox = width / 2 + panx;
+   vt.oy = height / 2 + pany;
+   return vt;
+}
+
+static inline
+Vec2F64 viewtopixel(const ViewTransform *vt, Vec2F64 x)
+{
+   return {x.elems[0] * vt->sx + vt->ox, x.elems[1] * vt->sy + vt->oy};
+}
+
+static inline
+Vec2F64 pixeltoview(const ViewTransform *vt, Vec2F64 pixel)
+{
+   return {(pixel.elems[0] - vt->ox) / vt->sx, (pixel.elems[1] - vt->oy) / vt->sy};
+}
+
+// the part of the plane on a width x height screen
+static inline
+void viewbounds(const ViewTransform *vt, int width, int height, Vec2F64 *lo, Vec2F64 *hi)
+{
+   Vec2F64 topleft = pixeltoview(vt, {0, 0});
+   Vec2F64 bottomright = pixeltoview(vt, {(f64) width, (f64) height});
+   *lo = {topleft.elems[0], bottomright.elems[1]};
+   *hi = {bottomright.elems[0], topleft.elems[1]};
+}
+
+// Writes the pixel of older + t (x - older) for the points [0, count) to
+// out[2 k stride] and out[2 k stride + 1]. t = 1 with older = x gives the
+// pixels of x itself.
+typedef void (*PixelKernel)(
+      const ViewTransform *vt,
+      const f64 *x, const f64 *y,
+      const f64 *olderx, const f64 *oldery, f64 t,
+      f32 *out, int stride, int count);
+
+// The vector kernels round to f32 once, after the same f64 operations in the
+// same order as the scalar one, so all of them give the same pixels.
+
+static
+void topixels_scalar(const ViewTransform *vt, const f64 *x, const f64 *y, const f64 *olderx, const f64 *oldery, f64 t,
+      f32 *out, int stride, int count)
+{
+   for (int k = 0; k < count; k += 1)
+   {
+      f64 bx = olderx[k] + t * (x[k] - olderx[k]);
+      f64 by = oldery[k] + t * (y[k] - oldery[k]);
+      f32 *dst = &out[2 * (size_t) k * (size_t) stride];
+      dst[0] = (f32) (bx * vt->sx + vt->ox);
+      dst[1] = (f32) (by * vt->sy + vt->oy);
+   }
+}
+
+#ifdef PARTICLES_X86
+__attribute__((target("sse2")))
+static
+void topixels_sse2(const ViewTransform *vt, const f64 *x, const f64 *y, const f64 *olderx, const f64 *oldery, f64 t,
+      f32 *out, int stride, int count)
+{
+   __m128d sx = _mm_set1_pd(vt->sx);
+   __m128d sy = _mm_set1_pd(vt->sy);
+   __m128d ox = _mm_set1_pd(vt->ox);
+   __m128d oy = _mm_set1_pd(vt->oy);
+   __m128d tt = _mm_set1_pd(t);
+   size_t step = 2 * (size_t) stride;
+
+   int k = 0;
+   for (; k + 2 <= count; k += 2)
+   {
+      __m128d oldx = _mm_loadu_pd(olderx + k);
+      __m128d oldy = _mm_loadu_pd(oldery + k);
+      __m128d bx = _mm_add_pd(oldx, _mm_mul_pd(tt, _mm_sub_pd(_mm_loadu_pd(x + k), oldx)));
+      __m128d by = _mm_add_pd(oldy, _mm_mul_pd(tt, _mm_sub_pd(_mm_loadu_pd(y + k), oldy)));
+      __m128 px = _mm_cvtpd_ps(_mm_add_pd(_mm_mul_pd(bx, sx), ox));
+      __m128 py = _mm_cvtpd_ps(_mm_add_pd(_mm_mul_pd(by, sy), oy));
+      __m128 xy = _mm_unpacklo_ps(px, py);  // x0 y0 x1 y1
+      f32 *dst = &out[(size_t) k * step];
+      _mm_storel_pi((__m64 *) dst, xy);
+      _mm_storeh_pi((__m64 *) (dst + step), xy);
+   }
+   topixels_scalar(vt, x + k, y + k, olderx + k, oldery + k, t, &out[(size_t) k * step], stride, count - k);
+}
+
+__attribute__((target("avx2")))
+static
+void topixels_avx2(const ViewTransform *vt, const f64 *x, const f64 *y, const f64 *olderx, const f64 *oldery, f64 t,
+      f32 *out, int stride, int count)
+{
+   __m256d sx = _mm256_set1_pd(vt->sx);
+   __m256d sy = _mm256_set1_pd(vt->sy);
+   __m256d ox = _mm256_set1_pd(vt->ox);
+   __m256d oy = _mm256_set1_pd(vt->oy);
+   __m256d tt = _mm256_set1_pd(t);
+   size_t step = 2 * (size_t) stride;
+
+   int k = 0;
+   for (; k + 4 <= count; k += 4)
+   {
+      __m256d oldx = _mm256_loadu_pd(olderx + k);
+      __m256d oldy = _mm256_loadu_pd(oldery + k);
+      __m256d bx = _mm256_add_pd(oldx, _mm256_mul_pd(tt, _mm256_sub_pd(_mm256_loadu_pd(x + k), oldx)));
+      __m256d by = _mm256_add_pd(oldy, _mm256_mul_pd(tt, _mm256_sub_pd(_mm256_loadu_pd(y + k), oldy)));
+      __m128 px = _mm256_cvtpd_ps(_mm256_add_pd(_mm256_mul_pd(bx, sx), ox));
+      __m128 py = _mm256_cvtpd_ps(_mm256_add_pd(_mm256_mul_pd(by, sy), oy));
+      __m128 lo = _mm_unpacklo_ps(px, py);  // x0 y0 x1 y1
+      __m128 hi = _mm_unpackhi_ps(px, py);  // x2 y2 x3 y3
+      f32 *dst = &out[(size_t) k * step];
+      if (stride == 1)
+      {
+         _mm_storeu_ps(dst, lo);
+         _mm_storeu_ps(dst + 4, hi);
+      }
+      else
+      {
+         _mm_storel_pi((__m64 *) dst, lo);
+         _mm_storeh_pi((__m64 *) (dst + step), lo);
+         _mm_storel_pi((__m64 *) (dst + 2 * step), hi);
+         _mm_storeh_pi((__m64 *) (dst + 3 * step), hi);
+      }
+   }
+   topixels_scalar(vt, x + k, y + k, olderx + k, oldery + k, t, &out[(size_t) k * step], stride, count - k);
+}
+#endif
+
+// wasm and other targets use the scalar loop
+static inline
+PixelKernel pixelkernel(SimdLevel level)
+{
+   assert(simdlevel_supported(level));
+   switch (level)
+   {
+#ifdef PARTICLES_X86
+      case SIMD_SSE2:
+         return topixels_sse2;
+      case SIMD_AVX2:
+         return topixels_avx2;
+#endif
+      default:
+         return topixels_scalar;
+   }
+}
+
+// The pixels of the drawn trails of particles [begin, end), drawntrailsize()
+// points each, into out[2 (i histcapacity + ago)]. Every point is alpha of the
+// way from its older neighbour, except the spawn point of a young trail,
+// which has none; the oldest row of a full trail is not drawn. When fate is
+// given, the culled particles at either end of each block are skipped and
+// whole culled blocks cost nothing; those inside a block are converted with
+// the rest, which keeps the rows in whole vectors.
+void historytopixels(const ViewTransform *vt, Particles *p, f64 alpha, int begin, int end, f32 *out, const u8 *fate = NULL)
+{
+   PixelKernel topixels = pixelkernel(p->simd);
+   int hc = p->histcapacity;
+   for (int blockbegin = begin; blockbegin < end; blockbegin += view_block)
+   {
+      int first = blockbegin;
+      int last = min(blockbegin + view_block, end);
+      if (fate)
+      {
+         while (first < last && fate[first] == FATE_OFFSCREEN)
+            first += 1;
+         while (last > first && fate[last - 1] == FATE_OFFSCREEN)
+            last -= 1;
+      }
+      int count = last - first;
+      if (count == 0)
+         continue;
+      for (int ago = 0; ago + 1 < hc; ago += 1)
+      {
+         topixels(vt,
+               histrow(p, p->histx, ago) + first, histrow(p, p->histy, ago) + first,
+               histrow(p, p->histx, ago + 1) + first, histrow(p, p->histy, ago + 1) + first, alpha,
+               &out[2 * ((size_t) first * (size_t) hc + (size_t) ago)], hc, count);
+      }
+   }
+   for (int i = begin; i < end; i += 1)
+   {
+      int oldest = trailsize(p, i) - 1;
+      if (oldest + 1 >= hc || (fate && fate[i] == FATE_OFFSCREEN))
+         continue;
+      Vec2F64 pixel = viewtopixel(vt, {histrow(p, p->histx, oldest)[i], histrow(p, p->histy, oldest)[i]});
+      f32 *dst = &out[2 * ((size_t) i * (size_t) hc + (size_t) oldest)];
+      dst[0] = (f32) pixel.elems[0];
+      dst[1] = (f32) pixel.elems[1];
+   }
+}